@@ -195,6 +195,9 @@ if(MSVC)
 		)
 
 	set(COMMON_COMPILER_DEFINITIONS ${COMMON_COMPILER_DEFINITIONS} $<$<CONFIG:Debug>:NTA_ASSERTIONS_ON>)
+	if(PERMANENCE_FIXED16)
+	  set(COMMON_COMPILER_DEFINITIONS ${COMMON_COMPILER_DEFINITIONS} NTA_PERMANENCE_FIXED16)
+	endif()
 		
 	# common libs
 	# Libraries linked by defaultwith all C++ applications
@@ -225,6 +228,10 @@ else()
 	  set(COMMON_COMPILER_DEFINITIONS ${COMMON_COMPILER_DEFINITIONS} -DNTA_ASSERTIONS_ON)
 	endif()
 
+	if(PERMANENCE_FIXED16)
+	  set(COMMON_COMPILER_DEFINITIONS ${COMMON_COMPILER_DEFINITIONS} -DNTA_PERMANENCE_FIXED16)
+	endif()
+
 	if(UNIX) # or UNIX like (i.e. APPLE and CYGWIN)
 	  set(COMMON_COMPILER_DEFINITIONS ${COMMON_COMPILER_DEFINITIONS} -DHAVE_UNISTD_H)
 	endif()
@@ -62,8 +62,28 @@ R"(Compatibility Warning: This classes API is unstable and may change without wa
         py::arg("presynaticCell"),
         py::arg("permanence"));
 
+    py_Connections.def("createSynapses",
+        [](Connections &self, Segment segment, const std::vector<CellIdx> &presynapticCells, Permanence permanence)
+          { self.createSynapses(segment, presynapticCells, permanence); },
+        py::arg("segment"),
+        py::arg("presynapticCells"),
+        py::arg("permanence"));
+
+    py_Connections.def("createSynapses",
+        [](Connections &self, Segment segment, const std::vector<CellIdx> &presynapticCells, const std::vector<Permanence> &permanences)
+          { self.createSynapses(segment, presynapticCells, permanences); },
+        py::arg("segment"),
+        py::arg("presynapticCells"),
+        py::arg("permanences"));
+
     py_Connections.def("destroySynapse", &Connections::destroySynapse);
 
+    py_Connections.def("compact", &Connections::compact);
+
+    py_Connections.def_property("compactionThreshold",
+        &Connections::getCompactionThreshold,
+        &Connections::setCompactionThreshold);
+
     py_Connections.def("updateSynapsePermanence", &Connections::updateSynapsePermanence,
         py::arg("synapse"),
         py::arg("permanence"));
@@ -208,5 +228,17 @@ R"(Returns pair of:
             C->load( buf );
             return C; } );
 
+    py_Connections.def("saveSnapshot",
+        [](const Connections &self, const std::string &path) { self.saveSnapshot( path ); },
+R"(Write a flat binary snapshot to the file, see loadSnapshot.)",
+        py::arg("path"));
+
+    py_Connections.def("loadSnapshot",
+        [](Connections &self, const std::string &path) { self.loadSnapshot( path ); },
+R"(Replace the contents with a snapshot written by saveSnapshot. The file
+is memory mapped and the connections are bulk-built from it, which is much
+faster than load for large models.)",
+        py::arg("path"));
+
   } // End function init_Connections
 }   // End namespace htm_ext
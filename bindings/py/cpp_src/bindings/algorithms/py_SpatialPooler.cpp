@@ -28,6 +28,7 @@ PyBind11 bindings for SpatialPooler class
 #include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 
+#include <htm/algorithms/FrozenSpatialPooler.hpp>
 #include <htm/algorithms/SpatialPooler.hpp>
 #include <htm/types/Sdr.hpp>
 
@@ -426,5 +427,39 @@ Argument output An SDR representing the winning columns after
             return sp;
         }));
 
+
+        // FrozenSpatialPooler
+        py::class_<FrozenSpatialPooler> py_FrozenSpatialPooler(m, "FrozenSpatialPooler",
+R"(A trained SpatialPooler, compiled for inference. Computes the same active
+columns as SpatialPooler.compute(input, False, output) at the time of
+freezing, and pickles to a much smaller object.)");
+
+        py_FrozenSpatialPooler.def(py::init<const SpatialPooler&>(), py::arg("sp"));
+
+        py_FrozenSpatialPooler.def("compute", [](const FrozenSpatialPooler& self, const SDR& input, SDR& output)
+            { self.compute( input, output ); },
+            py::arg("input"), py::arg("output"));
+
+        py_FrozenSpatialPooler.def("getInputDimensions", &FrozenSpatialPooler::getInputDimensions);
+        py_FrozenSpatialPooler.def("getColumnDimensions", &FrozenSpatialPooler::getColumnDimensions);
+        py_FrozenSpatialPooler.def("getNumInputs", &FrozenSpatialPooler::getNumInputs);
+        py_FrozenSpatialPooler.def("getNumColumns", &FrozenSpatialPooler::getNumColumns);
+        py_FrozenSpatialPooler.def("getNumConnectedSynapses", &FrozenSpatialPooler::getNumConnectedSynapses);
+
+        py_FrozenSpatialPooler.def(py::pickle(
+            [](const FrozenSpatialPooler& frozen)
+        {
+            std::stringstream ss;
+            frozen.save(ss);
+            return py::bytes( ss.str() );
+        },
+            [](py::bytes &s)
+        {
+            std::stringstream ss( s.cast<std::string>() );
+            FrozenSpatialPooler frozen;
+            frozen.load(ss);
+            return frozen;
+        }));
+
     }
 } // namespace htm_ext
@@ -38,7 +38,7 @@ using namespace htm;
 
 
 // work-load
-Real64 BenchmarkHotgym::run(UInt EPOCHS, bool useSPlocal, bool useSPglobal, bool useTM, const UInt COLS, const UInt DIM_INPUT, const UInt CELLS) {
+Real64 BenchmarkHotgym::run(UInt EPOCHS, bool useSPlocal, bool useSPglobal, bool useTM, const UInt COLS, const UInt DIM_INPUT, const UInt CELLS, const UInt THREADS) {
 #ifndef NDEBUG
   EPOCHS = 2; // make test faster in Debug
 #endif
@@ -48,7 +48,7 @@ Real64 BenchmarkHotgym::run(UInt EPOCHS, bool useSPlocal, bool useSPglobal, bool
   }
 
   std::cout << "starting test. DIM_INPUT=" << DIM_INPUT
-  		<< ", DIM=" << COLS << ", CELLS=" << CELLS << std::endl;
+  		<< ", DIM=" << COLS << ", CELLS=" << CELLS << ", THREADS=" << THREADS << std::endl;
   std::cout << "EPOCHS = " << EPOCHS << std::endl;
 
 
@@ -65,6 +65,8 @@ Real64 BenchmarkHotgym::run(UInt EPOCHS, bool useSPlocal, bool useSPglobal, bool
   SpatialPooler  spLocal(enc.dimensions, vector<UInt>{COLS}); // Spatial pooler with local inh
   spGlobal.setGlobalInhibition(true);
   spLocal.setGlobalInhibition(false);
+  spGlobal.setNumThreads(THREADS);
+  spLocal.setNumThreads(THREADS);
   Random rnd(42); //uses fixed seed for deterministic output checks
 
   TemporalMemory tm(vector<UInt>{COLS}, CELLS);
@@ -212,7 +214,12 @@ Real64 BenchmarkHotgym::run(UInt EPOCHS, bool useSPlocal, bool useSPglobal, bool
       const float goldAn    = 0.627451f;
       const float goldAnAvg = 0.407265f;
 
-      if(EPOCHS == 5000) { //these hand-written values are only valid for EPOCHS = 5000 (default), but not for debug and custom runs. 
+#ifdef NTA_PERMANENCE_FIXED16
+      const bool checkGolden = false; //golden values are for Real32 permanences
+#else
+      const bool checkGolden = true;
+#endif
+      if(EPOCHS == 5000 and checkGolden) { //these hand-written values are only valid for EPOCHS = 5000 (default), but not for debug and custom runs. 
         NTA_CHECK(input == goldEnc) << "Deterministic output of Encoder failed!\n" << input << "should be:\n" << goldEnc;
         if(useSPglobal) { NTA_CHECK(outSPglobal == goldSP) << "Deterministic output of SP (g) failed!\n" << outSP << "should be:\n" << goldSP; }
         if(useSPlocal) {  NTA_CHECK(outSPlocal == goldSPlocal) << "Deterministic output of SP (l) failed!\n" << outSPlocal << "should be:\n" << goldSPlocal; }
@@ -21,7 +21,8 @@ public:
     bool useTM=true,
     const UInt COLS = 2048, // number of columns in SP, TP
     const UInt DIM_INPUT = 1000,
-    const UInt CELLS = 8 // cells per column in TP
+    const UInt CELLS = 8, // cells per column in TP
+    const UInt THREADS = 1 // threads of the SPs, see SpatialPooler::setNumThreads
   );
 
   //timers
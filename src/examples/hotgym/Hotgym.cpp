@@ -5,12 +5,16 @@
 //this runs as executable
 int main(int argc, char* argv[]) {
   htm::UInt EPOCHS = 5000; // number of iterations (calls to SP/TP compute() )
+  htm::UInt THREADS = 1; // threads of the SPs, 0 = all hardware threads
 
-  if(argc == 2) {
+  if(argc >= 2) {
     EPOCHS = std::stoi(argv[1]);
   }
+  if(argc >= 3) {
+    THREADS = std::stoi(argv[2]);
+  }
 
   auto bench = examples::BenchmarkHotgym();
-  bench.run(EPOCHS);
+  bench.run(EPOCHS, true, true, true, 2048, 1000, 8, THREADS);
   return 0;
 }
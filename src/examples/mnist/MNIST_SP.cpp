@@ -70,6 +70,7 @@ class MNIST {
 
   public:
     UInt verbosity = 1;
+    UInt numThreads = 1u; //of the SP, see SpatialPooler::setNumThreads
     const UInt train_dataset_iterations = 1u; //epochs somewhat help, at linear time
 
 
@@ -94,6 +95,7 @@ void setup() {
     /* seed */                        4u,
     /* spVerbosity */                 1u,
     /* wrapAround */                  true); // does not matter (helps slightly)
+  sp.setNumThreads(numThreads);
 
   // Save the connections to file for postmortem analysis.
   ofstream dump("mnist_sp_initial.connections", ofstream::binary | ofstream::trunc | ofstream::out);
@@ -195,6 +197,9 @@ void test(const bool skipSP=false) {
 
 int main(int argc, char **argv) {
   MNIST m;
+  if(argc >= 2) {
+    m.numThreads = std::stoi(argv[1]); //0 = all hardware threads
+  }
   m.setup();
   cout << "===========BASELINE: no SP====================" << endl;
   m.train(true); //skip SP learning
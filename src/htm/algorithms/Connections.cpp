@@ -21,23 +21,34 @@
 
 #include <algorithm> // nth_element
 #include <climits>
+#include <cstring> // memcmp
+#include <fstream>
+#include <functional> // greater
 #include <iomanip>
 #include <iostream>
+#include <limits>
 
 #include <htm/algorithms/Connections.hpp>
+#include <htm/os/MappedFile.hpp>
+#include <htm/utils/Parallel.hpp>
 
 using std::endl;
 using std::string;
 using std::vector;
 using namespace htm;
 
+const Segment Connections::REMOVED_SEGMENT;
+const Synapse Connections::REMOVED_SYNAPSE;
+
 Connections::Connections(const CellIdx numCells, 
 		         const Permanence connectedThreshold, 
-			 const bool timeseries) {
-  initialize(numCells, connectedThreshold, timeseries);
+			 const bool timeseries,
+			 const bool flatPresynapticIndex) {
+  initialize(numCells, connectedThreshold, timeseries, flatPresynapticIndex);
 }
 
-void Connections::initialize(CellIdx numCells, Permanence connectedThreshold, bool timeseries) {
+void Connections::initialize(CellIdx numCells, Permanence connectedThreshold, bool timeseries,
+                             bool flatPresynapticIndex) {
   cells_ = vector<CellData>(numCells);
   segments_.clear();
   destroyedSegments_.clear();
@@ -47,10 +58,22 @@ void Connections::initialize(CellIdx numCells, Permanence connectedThreshold, bo
   connectedSynapsesForPresynapticCell_.clear();
   potentialSegmentsForPresynapticCell_.clear();
   connectedSegmentsForPresynapticCell_.clear();
+  flatIndex_ = flatPresynapticIndex;
+  potentialPresynapticFlat_.clear();
+  connectedPresynapticFlat_.clear();
   eventHandlers_.clear();
+  bufferedEventHandlers_.clear();
+  eventBuffer_.clear();
   NTA_CHECK(connectedThreshold >= minPermanence);
   NTA_CHECK(connectedThreshold <= maxPermanence);
+#ifdef NTA_PERMANENCE_FIXED16
+  // Stored permanences are exact multiples of the fixed point step, and so is
+  // the threshold; they compare exactly, without the Epsilon.
+  connectedThreshold_ = roundPermanence(connectedThreshold);
+  NTA_CHECK(connectedThreshold_ > minPermanence) << "Connections: connectedThreshold must be above zero with 16-bit permanences.";
+#else
   connectedThreshold_ = connectedThreshold - htm::Epsilon;
+#endif
   iteration_ = 0;
 
   nextEventToken_ = 0;
@@ -59,15 +82,125 @@ void Connections::initialize(CellIdx numCells, Permanence connectedThreshold, bo
   reset();
 }
 
-UInt32 Connections::subscribe(ConnectionsEventHandler *handler) {
+void FlatPresynapticMap::clear() {
+  offset.clear();
+  size.clear();
+  capacity.clear();
+  synapses.clear();
+  segments.clear();
+  holes = 0;
+}
+
+Synapse FlatPresynapticMap::add(const CellIdx cell, const Synapse synapse, const Segment segment) {
+  if( cell >= size.size() ) { //first synapse from a cell beyond the current range
+    offset.resize(  cell + 1, 0 );
+    size.resize(    cell + 1, 0 );
+    capacity.resize(cell + 1, 0 );
+  }
+
+  if( size[cell] == capacity[cell] ) { //block is full, relocate it to the end with twice the room
+    const Synapse newCapacity = std::max<Synapse>(4u, 2u * capacity[cell]);
+    const size_t  newOffset   = synapses.size();
+    synapses.resize( newOffset + newCapacity );
+    segments.resize( newOffset + newCapacity );
+    std::copy_n( synapses.begin() + offset[cell], size[cell], synapses.begin() + newOffset );
+    std::copy_n( segments.begin() + offset[cell], size[cell], segments.begin() + newOffset );
+    holes         += capacity[cell];
+    offset[cell]   = newOffset;
+    capacity[cell] = newCapacity;
+
+    if( holes > synapses.size() / 2 ) {
+      compact();
+    }
+  }
+
+  const Synapse index = size[cell]++;
+  synapses[offset[cell] + index] = synapse;
+  segments[offset[cell] + index] = segment;
+  return index;
+}
+
+void FlatPresynapticMap::compact() {
+  size_t total = 0;
+  for( const auto cap : capacity ) {
+    total += cap;
+  }
+  vector<Synapse> newSynapses( total );
+  vector<Segment> newSegments( total );
+
+  size_t pos = 0;
+  for( size_t cell = 0; cell < offset.size(); cell++ ) {
+    std::copy_n( synapses.begin() + offset[cell], size[cell], newSynapses.begin() + pos );
+    std::copy_n( segments.begin() + offset[cell], size[cell], newSegments.begin() + pos );
+    offset[cell] = pos;
+    pos += capacity[cell];
+  }
+
+  synapses.swap( newSynapses );
+  segments.swap( newSegments );
+  holes = 0;
+}
+
+
+UInt32 Connections::subscribe(ConnectionsEventHandler *handler, const bool buffered) {
   UInt32 token = nextEventToken_++;
-  eventHandlers_[token] = handler;
+  if( buffered ) {
+    bufferedEventHandlers_[token] = handler;
+  } else {
+    eventHandlers_[token] = handler;
+  }
   return token;
 }
 
 void Connections::unsubscribe(UInt32 token) {
-  delete eventHandlers_.at(token);
-  eventHandlers_.erase(token);
+  if( bufferedEventHandlers_.count(token) ) {
+    flushEvents(); //it gets the changes made while it was subscribed
+    delete bufferedEventHandlers_.at(token);
+    bufferedEventHandlers_.erase(token);
+  } else {
+    delete eventHandlers_.at(token);
+    eventHandlers_.erase(token);
+  }
+}
+
+void Connections::flushEvents() {
+  if( eventBuffer_.empty() ) return;
+  for (auto h : bufferedEventHandlers_) {
+    h.second->onEvents(eventBuffer_);
+  }
+  eventBuffer_.clear();
+}
+
+void Connections::dispatch_(const ConnectionsEvent &event) {
+  for (auto h : eventHandlers_) {
+    switch( event.type ) {
+      case ConnectionsEvent::CREATE_SEGMENT:
+        h.second->onCreateSegment(event.segment); break;
+      case ConnectionsEvent::DESTROY_SEGMENT:
+        h.second->onDestroySegment(event.segment); break;
+      case ConnectionsEvent::CREATE_SYNAPSE:
+        h.second->onCreateSynapse(event.synapse); break;
+      case ConnectionsEvent::DESTROY_SYNAPSE:
+        h.second->onDestroySynapse(event.synapse); break;
+      case ConnectionsEvent::UPDATE_SYNAPSE_PERMANENCE:
+        h.second->onUpdateSynapsePermanence(event.synapse, event.permanence); break;
+    }
+  }
+}
+
+void FlatPresynapticMap::reserve(const vector<Synapse> &count) {
+  NTA_ASSERT(synapses.empty());
+  offset.resize(  count.size() );
+  size.assign(    count.size(), 0u );
+  capacity.assign(count.begin(), count.end());
+  size_t total = 0;
+  for( size_t cell = 0; cell < count.size(); cell++ ) {
+    offset[cell] = total;
+    total += count[cell];
+  }
+  synapses.resize( total );
+  segments.resize( total );
+  holes = 0;
 }
 
 Segment Connections::createSegment(const CellIdx cell, 
@@ -76,38 +209,29 @@ Segment Connections::createSegment(const CellIdx cell,
   //limit number of segmets per cell. If exceeded, remove the least recently used ones.
   NTA_ASSERT(maxSegmentsPerCell > 0);
   while (numSegments(cell) >= maxSegmentsPerCell) {
-    const auto& destroyCandidates = segmentsForCell(cell);
-    const auto compareSegmentsByLRU = [&](const Segment a, const Segment b) {
-	if(dataForSegment(a).lastUsed == dataForSegment(b).lastUsed) {
-	  return a < b; //needed for deterministic sort
-        } 
-	else return dataForSegment(a).lastUsed < dataForSegment(b).lastUsed; //sort segments by access time
-      };
-    const auto leastRecentlyUsedSegment = std::min_element(destroyCandidates.cbegin(), 
-        destroyCandidates.cend(), compareSegmentsByLRU);
-
-    destroySegment(*leastRecentlyUsedSegment);
+    destroySegment(cells_[cell].lruHead_); //least recently used, ties by the lower Segment
   }
 
   //proceed to create a new segment
   Segment segment;
+  const SegmentData segmentData(cell, nextSegmentOrdinal_++, iteration_);
   if (!destroyedSegments_.empty() ) { //reuse old, destroyed segs
     segment = destroyedSegments_.back();
     destroyedSegments_.pop_back();
+    segments_[segment] = segmentData;
   } else { //create a new segment
     NTA_CHECK(segments_.size() < std::numeric_limits<Segment>::max()) << "Add segment failed: Range of Segment (data-type) insufficinet size."
 	    << (size_t)segments_.size() << " < " << (size_t)std::numeric_limits<Segment>::max();
     segment = static_cast<Segment>(segments_.size());
-    const SegmentData& segmentData = SegmentData(cell, iteration_, nextSegmentOrdinal_++);
     segments_.push_back(segmentData);
   }
 
   CellData &cellData = cells_[cell];
+  segments_[segment].idxOnCell_ = static_cast<SegmentIdx>(cellData.segments.size());
   cellData.segments.push_back(segment); //assign the new segment to its mother-cell
+  lruInsert_(segment);
 
-  for (auto h : eventHandlers_) {
-    h.second->onCreateSegment(segment);
-  }
+  notify_(ConnectionsEvent(ConnectionsEvent::CREATE_SEGMENT, segment));
 
   return segment;
 }
@@ -135,34 +259,129 @@ Synapse Connections::createSynapse(Segment segment,
   synapseData.id              = nextSynapseOrdinal_++; //TODO move these to SynData constructor
   // Start in disconnected state.
   synapseData.permanence           = connectedThreshold_ - 1.0f;
-  synapseData.presynapticMapIndex_ = 
-    (Synapse)potentialSynapsesForPresynapticCell_[presynapticCell].size();
-  potentialSynapsesForPresynapticCell_[presynapticCell].push_back(synapse);
-  potentialSegmentsForPresynapticCell_[presynapticCell].push_back(segment);
+  if( flatIndex_ ) {
+    synapseData.presynapticMapIndex_ =
+      potentialPresynapticFlat_.add(presynapticCell, synapse, segment);
+  } else {
+    synapseData.presynapticMapIndex_ = 
+      (Synapse)potentialSynapsesForPresynapticCell_[presynapticCell].size();
+    potentialSynapsesForPresynapticCell_[presynapticCell].push_back(synapse);
+    potentialSegmentsForPresynapticCell_[presynapticCell].push_back(segment);
+  }
 
   SegmentData &segmentData = segments_[segment];
   segmentData.synapses.push_back(synapse);
 
-
-  for (auto h : eventHandlers_) {
-    h.second->onCreateSynapse(synapse);
-  }
+  notify_(ConnectionsEvent(ConnectionsEvent::CREATE_SYNAPSE, segment, synapse, permanence));
 
   updateSynapsePermanence(synapse, permanence);
 
   return synapse;
 }
 
+void Connections::createSynapses(const Segment segment,
+                                 const vector<CellIdx> &presynapticCells,
+                                 const Permanence permanence) {
+  createSynapses_(segment, presynapticCells, &permanence, 0u);
+}
+
+void Connections::createSynapses(const Segment segment,
+                                 const vector<CellIdx> &presynapticCells,
+                                 const vector<Permanence> &permanences) {
+  NTA_CHECK(permanences.size() == presynapticCells.size())
+    << "createSynapses: need one permanence for each presynaptic cell, got "
+    << permanences.size() << " for " << presynapticCells.size() << " cells.";
+  createSynapses_(segment, presynapticCells, permanences.data(), 1u);
+}
+
+void Connections::createSynapses_(const Segment segment,
+                                  const vector<CellIdx> &presynapticCells,
+                                  const Permanence *permanences,
+                                  const size_t stride) {
+  const size_t count = presynapticCells.size();
+  if( count == 0u ) return;
+
+  // Grow the storage once: reuse the destroyed synapses first (in the same
+  // order as createSynapse), then append the rest.
+  const size_t reused = std::min(count, destroyedSynapses_.size());
+  const size_t fresh  = count - reused;
+  NTA_CHECK(synapses_.size() + fresh <= std::numeric_limits<Synapse>::max())
+    << "Add synapse failed: Range of Synapse (data-type) insufficient size."
+    << synapses_.size() + fresh << " <= " << (size_t)std::numeric_limits<Synapse>::max();
+  Synapse nextFresh = static_cast<Synapse>(synapses_.size());
+  synapses_.resize(synapses_.size() + fresh);
+
+  SegmentData &segmentData = segments_[segment];
+  auto &segmentSynapses = segmentData.synapses;
+  if( segmentSynapses.capacity() < segmentSynapses.size() + count ) {
+    segmentSynapses.reserve(std::max(2u * segmentSynapses.capacity(),
+                                     segmentSynapses.size() + count));
+  }
+
+  for(size_t i = 0; i < count; i++) {
+    Synapse synapse;
+    if( i < reused ) {
+      synapse = destroyedSynapses_.back();
+      destroyedSynapses_.pop_back();
+    } else {
+      synapse = nextFresh++;
+    }
+
+    const CellIdx presynapticCell = presynapticCells[i];
+    Permanence permanence = permanences[i * stride];
+    permanence = std::min(permanence, maxPermanence );
+    permanence = std::max(permanence, minPermanence );
+    permanence = roundPermanence(permanence);
+    const bool connected = permanence >= connectedThreshold_;
+
+    SynapseData &synapseData    = synapses_[synapse];
+    synapseData.presynapticCell = presynapticCell;
+    synapseData.segment         = segment;
+    synapseData.id              = nextSynapseOrdinal_++;
+    synapseData.permanence      = permanence;
+
+    // Insert directly into the connected or potential index.
+    if( flatIndex_ ) {
+      auto &flatMap = connected ? connectedPresynapticFlat_ : potentialPresynapticFlat_;
+      synapseData.presynapticMapIndex_ = flatMap.add(presynapticCell, synapse, segment);
+    } else {
+      auto &preSynapses = connected ? connectedSynapsesForPresynapticCell_[presynapticCell]
+                                    : potentialSynapsesForPresynapticCell_[presynapticCell];
+      auto &preSegments = connected ? connectedSegmentsForPresynapticCell_[presynapticCell]
+                                    : potentialSegmentsForPresynapticCell_[presynapticCell];
+      synapseData.presynapticMapIndex_ = (Synapse)preSynapses.size();
+      preSynapses.push_back(synapse);
+      preSegments.push_back(segment);
+    }
+    if( connected ) {
+      segmentData.numConnected++;
+    }
+
+    segmentSynapses.push_back(synapse);
+    if( !bufferedEventHandlers_.empty() ) {
+      eventBuffer_.emplace_back(ConnectionsEvent::CREATE_SYNAPSE, segment, synapse, permanence);
+    }
+  }
+
+  if( !eventHandlers_.empty() ) {
+    const vector<Synapse> created(segmentSynapses.end() - count, segmentSynapses.end());
+    for (auto h : eventHandlers_) {
+      h.second->onCreateSynapses(created);
+    }
+  }
+}
+
 bool Connections::segmentExists_(const Segment segment) const {
+  if( segment >= segments_.size() ) return false;
   const SegmentData &segmentData = segments_[segment];
-  const vector<Segment> &segmentsOnCell = cells_[segmentData.cell].segments;
-  return (std::find(segmentsOnCell.cbegin(), segmentsOnCell.cend(), segment) !=
-          segmentsOnCell.cend());
+  const SegmentList &segmentsOnCell = cells_[segmentData.cell].segments;
+  return segmentData.idxOnCell_ < segmentsOnCell.size() &&
+         segmentsOnCell[segmentData.idxOnCell_] == segment;
 }
 
 bool Connections::synapseExists_(const Synapse synapse) const {
   const SynapseData &synapseData = synapses_[synapse];
-  const vector<Synapse> &synapsesOnSegment =
+  const SynapseList &synapsesOnSegment =
       segments_[synapseData.segment].synapses;
   return (std::find(synapsesOnSegment.begin(), synapsesOnSegment.end(),
                     synapse) != synapsesOnSegment.end());
@@ -191,11 +410,30 @@ void Connections::removeSynapseFromPresynapticMap_(
 }
 
 
+/**
+ * Same as removeSynapseFromPresynapticMap_, for the flat layout: the last
+ * entry of the cell's block is moved over the removed synapse.
+ */
+void Connections::removeSynapseFromFlatMap_(
+    const Synapse index,
+    const CellIdx presynapticCell,
+    FlatPresynapticMap &flatMap)
+{
+  NTA_ASSERT( index < flatMap.sizeOf(presynapticCell) );
+
+  const size_t  block = flatMap.offset[presynapticCell];
+  const Synapse last  = --flatMap.size[presynapticCell];
+
+  const auto move = flatMap.synapses[block + last];
+  synapses_[move].presynapticMapIndex_ = index;
+  flatMap.synapses[block + index] = move;
+  flatMap.segments[block + index] = flatMap.segments[block + last];
+}
+
+
 void Connections::destroySegment(const Segment segment) {
   NTA_ASSERT(segmentExists_(segment));
-  for (auto h : eventHandlers_) {
-    h.second->onDestroySegment(segment);
-  }
+  notify_(ConnectionsEvent(ConnectionsEvent::DESTROY_SEGMENT, segment));
 
   SegmentData &segmentData = segments_[segment];
 
@@ -204,28 +442,96 @@ void Connections::destroySegment(const Segment segment) {
   while( !segmentData.synapses.empty() )
     destroySynapse(segmentData.synapses.back());
 
+  lruRemove_(segment);
+
+  // Move the cell's last segment into this one's place.
   CellData &cellData = cells_[segmentData.cell];
+  const SegmentIdx idx = segmentData.idxOnCell_;
+  NTA_ASSERT(cellData.segments[idx] == segment) << "Segment to be destroyed not found on the cell!";
+  const Segment moved = cellData.segments.back();
+  cellData.segments[idx] = moved;
+  segments_[moved].idxOnCell_ = idx;
+  cellData.segments.pop_back();
+
+  SynapseList().swap( segmentData.synapses ); //return the memory to the pool for reuse
+  destroyedSegments_.push_back(segment);
+}
 
-  const auto segmentOnCell = std::find(cellData.segments.cbegin(), cellData.segments.cend(), segment);
-  NTA_ASSERT(segmentOnCell != cellData.segments.cend()) << "Segment to be destroyed not found on the cell!";
-  NTA_ASSERT(*segmentOnCell == segment);
 
-  cellData.segments.erase(segmentOnCell);
-  destroyedSegments_.push_back(segment);
+void Connections::touchSegment(const Segment segment) {
+  NTA_ASSERT(segmentExists_(segment));
+  SegmentData &segmentData = segments_[segment];
+  if( segmentData.lastUsed == iteration_ &&
+      segmentData.lruNext_ == std::numeric_limits<Segment>::max() ) {
+    return; //already the most recently used
+  }
+  lruRemove_(segment);
+  segmentData.lastUsed = iteration_;
+  lruInsert_(segment);
+}
+
+
+void Connections::lruInsert_(const Segment segment) {
+  const Segment none = std::numeric_limits<Segment>::max();
+  SegmentData &segmentData = segments_[segment];
+  CellData &cellData = cells_[segmentData.cell];
+
+  // Find the last segment which sorts before this one.
+  Segment prev = cellData.lruTail_;
+  while( prev != none ) {
+    const SegmentData &prevData = segments_[prev];
+    if( prevData.lastUsed < segmentData.lastUsed ||
+       (prevData.lastUsed == segmentData.lastUsed && prev < segment) ) {
+      break;
+    }
+    prev = prevData.lruPrev_;
+  }
+
+  const Segment next = prev == none ? cellData.lruHead_ : segments_[prev].lruNext_;
+  segmentData.lruPrev_ = prev;
+  segmentData.lruNext_ = next;
+  if( prev == none ) cellData.lruHead_ = segment;
+  else segments_[prev].lruNext_ = segment;
+  if( next == none ) cellData.lruTail_ = segment;
+  else segments_[next].lruPrev_ = segment;
+}
+
+
+void Connections::lruRemove_(const Segment segment) {
+  const Segment none = std::numeric_limits<Segment>::max();
+  SegmentData &segmentData = segments_[segment];
+  CellData &cellData = cells_[segmentData.cell];
+  const Segment prev = segmentData.lruPrev_;
+  const Segment next = segmentData.lruNext_;
+
+  if( prev == none ) cellData.lruHead_ = next;
+  else segments_[prev].lruNext_ = next;
+  if( next == none ) cellData.lruTail_ = prev;
+  else segments_[next].lruPrev_ = prev;
+  segmentData.lruPrev_ = none;
+  segmentData.lruNext_ = none;
 }
 
 
 void Connections::destroySynapse(const Synapse synapse) {
   NTA_ASSERT(synapseExists_(synapse));
-  for (auto h : eventHandlers_) {
-    h.second->onDestroySynapse(synapse);
-  }
+  notify_(ConnectionsEvent(ConnectionsEvent::DESTROY_SYNAPSE, synapses_[synapse].segment, synapse));
 
   const SynapseData &synapseData = synapses_[synapse];
         SegmentData &segmentData = segments_[synapseData.segment];
   const auto         presynCell  = synapseData.presynapticCell;
 
-  if( synapseData.permanence >= connectedThreshold_ ) {
+  if( flatIndex_ ) {
+    if( synapseData.permanence >= connectedThreshold_ ) {
+      segmentData.numConnected--;
+      removeSynapseFromFlatMap_( synapseData.presynapticMapIndex_, presynCell,
+                                 connectedPresynapticFlat_ );
+    } else {
+      removeSynapseFromFlatMap_( synapseData.presynapticMapIndex_, presynCell,
+                                 potentialPresynapticFlat_ );
+    }
+  }
+  else if( synapseData.permanence >= connectedThreshold_ ) {
     segmentData.numConnected--;
 
     removeSynapseFromPresynapticMap_(
@@ -266,10 +572,170 @@ void Connections::destroySynapse(const Synapse synapse) {
 }
 
 
+/**
+ * Helper for compact: removes the entries which newIndex maps to `removed`
+ * and moves the others down, keeping their order. As newIndex numbers the
+ * kept entries in increasing order, each entry lands at its new index.
+ * Vectors shorter than newIndex (which are grown lazily) are handled too.
+ */
+template<typename T, typename Index>
+static void compactIndexed(vector<T> &values, const vector<Index> &newIndex, const Index removed) {
+  const size_t size = std::min(values.size(), newIndex.size());
+  size_t kept = 0u;
+  for(size_t old = 0u; old < size; old++) {
+    if( newIndex[old] != removed ) {
+      NTA_ASSERT(newIndex[old] == kept);
+      if( kept != old ) values[kept] = std::move(values[old]);
+      kept++;
+    }
+  }
+  values.erase(values.begin() + kept, values.end());
+}
+
+
+void Connections::compact() {
+  vector<Segment> segmentMap;
+  vector<Synapse> synapseMap;
+  compact_(segmentMap, synapseMap);
+}
+
+
+void Connections::compact_(vector<Segment> &segmentMap, vector<Synapse> &synapseMap) {
+  segmentMap.clear();
+  synapseMap.clear();
+  if( destroyedSegments_.empty() && destroyedSynapses_.empty() ) return;
+  flushEvents(); //the buffered events refer to the old handles
+
+  // Number the remaining segments & synapses densely, in their current order.
+  segmentMap.assign(segments_.size(), 0u);
+  for(const auto segment : destroyedSegments_) {
+    segmentMap[segment] = REMOVED_SEGMENT;
+  }
+  Segment nextSegment = 0u;
+  for(auto &newSegment : segmentMap) {
+    if( newSegment != REMOVED_SEGMENT ) newSegment = nextSegment++;
+  }
+  synapseMap.assign(synapses_.size(), 0u);
+  for(const auto synapse : destroyedSynapses_) {
+    synapseMap[synapse] = REMOVED_SYNAPSE;
+  }
+  Synapse nextSynapse = 0u;
+  for(auto &newSynapse : synapseMap) {
+    if( newSynapse != REMOVED_SYNAPSE ) newSynapse = nextSynapse++;
+  }
+
+  // Fix up the handles stored inside of the data, then drop the dead entries.
+  for(Synapse synapse = 0u; synapse < synapses_.size(); synapse++) {
+    if( synapseMap[synapse] != REMOVED_SYNAPSE ) {
+      auto &segment = synapses_[synapse].segment;
+      segment = segmentMap[segment];
+    }
+  }
+  for(auto &segmentData : segments_) {
+    for(auto &synapse : segmentData.synapses) { //destroyed segments have no synapses
+      synapse = synapseMap[synapse];
+    }
+  }
+  const auto remapLink = [&segmentMap](Segment &segment) {
+    if( segment != std::numeric_limits<Segment>::max() ) segment = segmentMap[segment];
+  };
+  for(auto &segmentData : segments_) {
+    remapLink(segmentData.lruPrev_); //destroyed segments are unlinked
+    remapLink(segmentData.lruNext_);
+  }
+  for(auto &cellData : cells_) {
+    for(auto &segment : cellData.segments) {
+      segment = segmentMap[segment];
+    }
+    remapLink(cellData.lruHead_);
+    remapLink(cellData.lruTail_);
+  }
+  compactIndexed(synapses_, synapseMap, REMOVED_SYNAPSE);
+  compactIndexed(segments_, segmentMap, REMOVED_SEGMENT);
+  synapses_.shrink_to_fit();
+  segments_.shrink_to_fit();
+  destroyedSynapses_.clear();
+  destroyedSegments_.clear();
+  compactIndexed(previousUpdates_, synapseMap, REMOVED_SYNAPSE);
+  compactIndexed(currentUpdates_,  synapseMap, REMOVED_SYNAPSE);
+
+  // The presynaptic indexes only hold live synapses, their positions stay.
+  if( flatIndex_ ) {
+    for(auto flatMap : {&potentialPresynapticFlat_, &connectedPresynapticFlat_}) {
+      for(size_t cell = 0u; cell < flatMap->offset.size(); cell++) {
+        const size_t begin = flatMap->offset[cell];
+        const size_t end   = begin + flatMap->size[cell];
+        for(size_t i = begin; i < end; i++) {
+          flatMap->synapses[i] = synapseMap[flatMap->synapses[i]];
+          flatMap->segments[i] = segmentMap[flatMap->segments[i]];
+        }
+      }
+      flatMap->compact();
+    }
+  } else {
+    for(auto presynapticMap : {&potentialSynapsesForPresynapticCell_, &connectedSynapsesForPresynapticCell_}) {
+      for(auto &cellSynapses : *presynapticMap) {
+        for(auto &synapse : cellSynapses.second) {
+          synapse = synapseMap[synapse];
+        }
+      }
+    }
+    for(auto presynapticMap : {&potentialSegmentsForPresynapticCell_, &connectedSegmentsForPresynapticCell_}) {
+      for(auto &cellSegments : *presynapticMap) {
+        for(auto &segment : cellSegments.second) {
+          segment = segmentMap[segment];
+        }
+      }
+    }
+  }
+
+  for (auto h : eventHandlers_) {
+    h.second->onCompact(segmentMap, synapseMap);
+  }
+  for (auto h : bufferedEventHandlers_) {
+    h.second->onCompact(segmentMap, synapseMap);
+  }
+}
+
+
+void Connections::setCompactionThreshold(const Real deadRatio) {
+  NTA_CHECK(deadRatio >= 0.0f && deadRatio <= 1.0f)
+    << "Connections: compaction threshold must be in [0, 1], got " << deadRatio;
+  compactionThreshold_ = deadRatio;
+}
+
+
+vector<Segment> Connections::segmentsInCreationOrder_(const CellData &cellData) const {
+  vector<Segment> segments(cellData.segments.begin(), cellData.segments.end());
+  std::sort(segments.begin(), segments.end(), [&](const Segment a, const Segment b) {
+    return segments_[a].id < segments_[b].id;
+  });
+  return segments;
+}
+
+
+void Connections::compactIfNeeded_(vector<SynapseIdx> &numActiveConnectedSynapsesForSegment,
+                                   vector<SynapseIdx> *numActivePotentialSynapsesForSegment) {
+  if( compactionThreshold_ <= 0.0f ) return;
+  const bool segmentsDue = destroyedSegments_.size() > compactionThreshold_ * segments_.size();
+  const bool synapsesDue = destroyedSynapses_.size() > compactionThreshold_ * synapses_.size();
+  if( !segmentsDue && !synapsesDue ) return;
+
+  vector<Segment> segmentMap;
+  vector<Synapse> synapseMap;
+  compact_(segmentMap, synapseMap);
+  compactIndexed(numActiveConnectedSynapsesForSegment, segmentMap, REMOVED_SEGMENT);
+  if( numActivePotentialSynapsesForSegment != nullptr ) {
+    compactIndexed(*numActivePotentialSynapsesForSegment, segmentMap, REMOVED_SEGMENT);
+  }
+}
+
+
 void Connections::updateSynapsePermanence(const Synapse synapse,
                                           Permanence permanence) {
   permanence = std::min(permanence, maxPermanence );
   permanence = std::max(permanence, minPermanence );
+  permanence = roundPermanence(permanence); //to what will be stored
 
   auto &synData = synapses_[synapse];
   
@@ -282,6 +748,20 @@ void Connections::updateSynapsePermanence(const Synapse synapse,
   if( before == after ) { //no change in dis/connected status
       return;
   }
+  if( flatIndex_ ) {
+    const auto presyn  = synData.presynapticCell;
+    const auto segment = synData.segment;
+    if( after ) { //connect
+      segments_[segment].numConnected++;
+      removeSynapseFromFlatMap_( synData.presynapticMapIndex_, presyn, potentialPresynapticFlat_ );
+      synData.presynapticMapIndex_ = connectedPresynapticFlat_.add( presyn, synapse, segment );
+    }
+    else { //disconnected
+      segments_[segment].numConnected--;
+      removeSynapseFromFlatMap_( synData.presynapticMapIndex_, presyn, connectedPresynapticFlat_ );
+      synData.presynapticMapIndex_ = potentialPresynapticFlat_.add( presyn, synapse, segment );
+    }
+  } else {
     const auto &presyn    = synData.presynapticCell;
     auto &potentialPresyn = potentialSynapsesForPresynapticCell_[presyn];
     auto &potentialPreseg = potentialSegmentsForPresynapticCell_[presyn];
@@ -314,18 +794,15 @@ void Connections::updateSynapsePermanence(const Synapse synapse,
       potentialPresyn.push_back( synapse );
       potentialPreseg.push_back( segment );
     }
+  }
 
-    for (auto h : eventHandlers_) { //TODO handle callbacks in performance-critical method only in Debug?
-      h.second->onUpdateSynapsePermanence(synapse, permanence);
-    }
+  notify_(ConnectionsEvent(ConnectionsEvent::UPDATE_SYNAPSE_PERMANENCE, synData.segment, synapse, permanence));
 }
 
 
 SegmentIdx Connections::idxOnCellForSegment(const Segment segment) const {
-  const vector<Segment> &segments = segmentsForCell(cellForSegment(segment));
-  const auto it = std::find(segments.begin(), segments.end(), segment);
-  NTA_ASSERT(it != segments.end());
-  return (SegmentIdx)std::distance(segments.begin(), it);
+  NTA_ASSERT(segmentExists_(segment));
+  return segments_[segment].idxOnCell_;
 }
 
 
@@ -356,6 +833,16 @@ bool Connections::compareSegments(const Segment a, const Segment b) const {
 vector<Synapse> Connections::synapsesForPresynapticCell(const CellIdx presynapticCell) const {
   vector<Synapse> all;
 
+  if( flatIndex_ ) {
+    for( const auto flat : { &potentialPresynapticFlat_, &connectedPresynapticFlat_ } ) {
+      const Synapse num = flat->sizeOf(presynapticCell);
+      if( num == 0 ) continue;
+      const auto begin = flat->synapses.cbegin() + flat->offset[presynapticCell];
+      all.insert( all.cend(), begin, begin + num );
+    }
+    return all;
+  }
+
   if (potentialSynapsesForPresynapticCell_.count(presynapticCell)) {
     const auto& potential = potentialSynapsesForPresynapticCell_.at(presynapticCell);
     all.assign(potential.cbegin(), potential.cend());
@@ -380,13 +867,98 @@ void Connections::reset()
 }
 
 
+void Connections::setNumThreads(const UInt numThreads) {
+  threads_.resize(numThreads);
+}
+
+
+void Connections::countActiveSynapsesRange_(
+    SynapseIdx *counts,
+    const bool connected,
+    const CellIdx *begin,
+    const CellIdx *end,
+    const SynapseIdx delta) const
+{
+  if( flatIndex_ ) {
+    const auto &flatMap = connected ? connectedPresynapticFlat_ : potentialPresynapticFlat_;
+    for(auto cell = begin; cell != end; cell++) {
+      const Synapse num = flatMap.sizeOf(*cell);
+      if( num == 0 ) continue;
+      const Segment *segments = flatMap.segments.data() + flatMap.offset[*cell];
+      for(Synapse i = 0; i < num; i++) {
+        counts[segments[i]] = static_cast<SynapseIdx>(counts[segments[i]] + delta);
+      }
+    }
+    return;
+  }
+
+  const auto &presynapticMap = connected ? connectedSegmentsForPresynapticCell_ : potentialSegmentsForPresynapticCell_;
+  for(auto cell = begin; cell != end; cell++) {
+    const auto found = presynapticMap.find(*cell);
+    if( found == presynapticMap.end() ) continue;
+    for(const auto& segment : found->second) {
+      counts[segment] = static_cast<SynapseIdx>(counts[segment] + delta);
+    }
+  }
+}
+
+
+void Connections::countActiveSynapses_(
+    vector<SynapseIdx> &numActiveSynapsesForSegment,
+    const bool connected,
+    const vector<CellIdx> &activePresynapticCells,
+    const SynapseIdx delta)
+{
+  const CellIdx *active = activePresynapticCells.data();
+  const size_t numActive = activePresynapticCells.size();
+
+  // Spawning threads is only worth it with enough work for each of them.
+  const size_t minCellsPerThread = 64u;
+  const UInt numWorkers = static_cast<UInt>(std::max<size_t>(1u,
+                            std::min<size_t>(threads_.size(), numActive / minCellsPerThread)));
+  if( numWorkers == 1u ) {
+    countActiveSynapsesRange_( numActiveSynapsesForSegment.data(), connected, active, active + numActive, delta );
+    return;
+  }
+
+  // Worker 0 counts directly into the output, the others into their own shard.
+  const size_t numSegments = numActiveSynapsesForSegment.size();
+  activityShards_.resize( numWorkers - 1u );
+  threads_.parallelFor(numWorkers, [&](const UInt worker) {
+    SynapseIdx *counts = numActiveSynapsesForSegment.data();
+    if( worker > 0u ) {
+      auto &shard = activityShards_[worker - 1u];
+      shard.assign( numSegments, 0u );
+      counts = shard.data();
+    }
+    const auto range = workerRange( numActive, worker, numWorkers );
+    countActiveSynapsesRange_( counts, connected, active + range.first, active + range.second, delta );
+  });
+
+  // Reduce the shards, each worker sums a range of segments.
+  threads_.parallelFor(numWorkers, [&](const UInt worker) {
+    const auto range = workerRange( numSegments, worker, numWorkers );
+    SynapseIdx *counts = numActiveSynapsesForSegment.data();
+    for(const auto &shard : activityShards_) {
+      for(size_t segment = range.first; segment < range.second; segment++) {
+        counts[segment] = static_cast<SynapseIdx>(counts[segment] + shard[segment]);
+      }
+    }
+  });
+}
+
+
 void Connections::computeActivity(
     vector<SynapseIdx> &numActiveConnectedSynapsesForSegment,
     const vector<CellIdx> &activePresynapticCells,
     bool learn)
 {
   NTA_ASSERT(numActiveConnectedSynapsesForSegment.size() == segments_.size());
-  if(learn) iteration_++;
+  if(learn) {
+    flushEvents();
+    compactIfNeeded_( numActiveConnectedSynapsesForSegment, nullptr );
+    iteration_++;
+  }
 
   if( timeseries_ ) {
     // Before each cycle of computation move the currentUpdates to the previous
@@ -396,13 +968,7 @@ void Connections::computeActivity(
   }
 
   // Iterate through all connected synapses.
-  for (const auto& cell : activePresynapticCells) {
-    if (connectedSegmentsForPresynapticCell_.count(cell)) {
-      for(const auto& segment : connectedSegmentsForPresynapticCell_.at(cell)) {
-        ++numActiveConnectedSynapsesForSegment[segment];
-      }
-    }
-  }
+  countActiveSynapses_( numActiveConnectedSynapsesForSegment, true, activePresynapticCells );
 }
 
 void Connections::computeActivity(
@@ -412,6 +978,9 @@ void Connections::computeActivity(
     bool learn) {
   NTA_ASSERT(numActiveConnectedSynapsesForSegment.size() == segments_.size());
   NTA_ASSERT(numActivePotentialSynapsesForSegment.size() == segments_.size());
+  if(learn) {
+    compactIfNeeded_( numActiveConnectedSynapsesForSegment, &numActivePotentialSynapsesForSegment );
+  }
 
   // Iterate through all connected synapses.
   computeActivity(
@@ -423,12 +992,179 @@ void Connections::computeActivity(
   std::copy( numActiveConnectedSynapsesForSegment.begin(),
              numActiveConnectedSynapsesForSegment.end(),
              numActivePotentialSynapsesForSegment.begin());
-  for (const auto& cell : activePresynapticCells) {
-    if (potentialSegmentsForPresynapticCell_.count(cell)) {
-      for(const auto& segment : potentialSegmentsForPresynapticCell_.at(cell)) {
-        ++numActivePotentialSynapsesForSegment[segment];
+  countActiveSynapses_( numActivePotentialSynapsesForSegment, false, activePresynapticCells );
+}
+
+
+void Connections::computeActivity(
+    vector<SynapseIdx> &numActiveConnectedSynapsesForSegment,
+    vector<SynapseIdx> &numActivePotentialSynapsesForSegment,
+    const vector<CellIdx> &activePresynapticCells,
+    bool learn,
+    vector<Segment> &touchedSegments) {
+  auto &connected = numActiveConnectedSynapsesForSegment;
+  auto &potential = numActivePotentialSynapsesForSegment;
+  NTA_ASSERT(connected.size() == potential.size());
+  // All counts are zero after this, so a compaction only has to shrink them.
+  for(const auto segment : touchedSegments) {
+    connected[segment] = 0u;
+    potential[segment] = 0u;
+  }
+  touchedSegments.clear();
+  connected.resize( segments_.size(), 0u );
+  potential.resize( segments_.size(), 0u );
+
+  if( threads_.size() > 1u ) {
+    // The threaded counting shards over all segments anyway.
+    computeActivity( connected, potential, activePresynapticCells, learn );
+    for(Segment segment = 0; segment < potential.size(); segment++) {
+      if( potential[segment] != 0u ) touchedSegments.push_back( segment );
+    }
+    return;
+  }
+
+  // Same bookkeeping as computeActivity().
+  if(learn) {
+    flushEvents();
+    compactIfNeeded_( connected, &potential );
+    iteration_++;
+  }
+  if( timeseries_ ) {
+    previousUpdates_.swap( currentUpdates_ );
+    currentUpdates_.clear();
+  }
+
+  computeActivity( connected, potential, activePresynapticCells, touchedSegments );
+}
+
+
+void Connections::computeActivity(
+    vector<SynapseIdx> &numActiveConnectedSynapsesForSegment,
+    vector<SynapseIdx> &numActivePotentialSynapsesForSegment,
+    const vector<CellIdx> &activePresynapticCells,
+    vector<Segment> &touchedSegments) const {
+  auto &connected = numActiveConnectedSynapsesForSegment;
+  auto &potential = numActivePotentialSynapsesForSegment;
+  NTA_ASSERT(connected.size() == potential.size());
+  for(const auto segment : touchedSegments) {
+    connected[segment] = 0u;
+    potential[segment] = 0u;
+  }
+  touchedSegments.clear();
+  connected.resize( segments_.size(), 0u );
+  potential.resize( segments_.size(), 0u );
+
+  countTouchedSynapses_( connected, potential, true,  activePresynapticCells, touchedSegments );
+  countTouchedSynapses_( potential, connected, false, activePresynapticCells, touchedSegments );
+  for(const auto segment : touchedSegments) {
+    potential[segment] = static_cast<SynapseIdx>(potential[segment] + connected[segment]);
+  }
+}
+
+
+void Connections::countTouchedSynapses_(
+    vector<SynapseIdx> &counts,
+    const vector<SynapseIdx> &zeroCounts,
+    const bool connected,
+    const vector<CellIdx> &activePresynapticCells,
+    vector<Segment> &touchedSegments) const
+{
+  const auto count = [&](const Segment segment) {
+    if( counts[segment] == 0u && zeroCounts[segment] == 0u ) {
+      touchedSegments.push_back( segment );
+    }
+    counts[segment]++;
+  };
+
+  if( flatIndex_ ) {
+    const auto &flatMap = connected ? connectedPresynapticFlat_ : potentialPresynapticFlat_;
+    for(const auto cell : activePresynapticCells) {
+      const Synapse num = flatMap.sizeOf(cell);
+      if( num == 0 ) continue;
+      const Segment *segments = flatMap.segments.data() + flatMap.offset[cell];
+      for(Synapse i = 0; i < num; i++) {
+        count( segments[i] );
       }
     }
+    return;
+  }
+
+  const auto &presynapticMap = connected ? connectedSegmentsForPresynapticCell_ : potentialSegmentsForPresynapticCell_;
+  for(const auto cell : activePresynapticCells) {
+    const auto found = presynapticMap.find(cell);
+    if( found == presynapticMap.end() ) continue;
+    for(const auto segment : found->second) {
+      count( segment );
+    }
+  }
+}
+
+
+void Connections::updateActivity(
+    vector<SynapseIdx> &numActiveConnectedSynapsesForSegment,
+    const vector<CellIdx> &activatedPresynapticCells,
+    const vector<CellIdx> &deactivatedPresynapticCells,
+    bool learn)
+{
+  // Same bookkeeping as computeActivity, counting the newly active cells.
+  computeActivity( numActiveConnectedSynapsesForSegment, activatedPresynapticCells, learn );
+
+  // The counts wrap around, a decrement is the addition of (SynapseIdx)-1.
+  countActiveSynapses_( numActiveConnectedSynapsesForSegment, true, deactivatedPresynapticCells,
+                        static_cast<SynapseIdx>(-1) );
+}
+
+
+void Connections::computeActivityBatch(
+    vector<SynapseIdx> &numActiveConnectedSynapsesForSegment,
+    const vector<vector<CellIdx>> &activePresynapticCells) const
+{
+  const size_t numSegments = segments_.size();
+  auto &counts = numActiveConnectedSynapsesForSegment;
+  counts.assign( numSegments * activePresynapticCells.size(), 0u );
+  for(size_t input = 0; input < activePresynapticCells.size(); input++) {
+    const auto &active = activePresynapticCells[input];
+    countActiveSynapsesRange_( counts.data() + input * numSegments, true,
+                               active.data(), active.data() + active.size(), 1u );
+  }
+}
+
+
+namespace {
+// Permanence update kernels. These are plain loops over contiguous arrays
+// without branches, which the compiler auto-vectorizes (SSE/AVX, depending on
+// the target), and run as scalar code elsewhere. The clamping is done in the
+// same order as in updateSynapsePermanence, so results are identical.
+
+void addClamped(const Permanence *permanences, const Permanence *updates,
+                Permanence *out, const size_t size) {
+  for(size_t i = 0; i < size; i++) {
+    Permanence p = permanences[i] + updates[i];
+    p = std::min(p, maxPermanence);
+    p = std::max(p, minPermanence);
+    out[i] = p;
+  }
+}
+
+void addClamped(const Permanence *permanences, const Permanence delta,
+                Permanence *out, const size_t size) {
+  for(size_t i = 0; i < size; i++) {
+    Permanence p = permanences[i] + delta;
+    p = std::min(p, maxPermanence);
+    p = std::max(p, minPermanence);
+    out[i] = p;
+  }
+}
+} // end anonymous namespace
+
+
+void Connections::setPermanence_(const Synapse synapse, Permanence permanence) {
+  permanence = roundPermanence(permanence);
+  auto &synData = synapses_[synapse];
+  if( (synData.permanence >= connectedThreshold_) == (permanence >= connectedThreshold_) ) {
+    synData.permanence = permanence; //no change in dis/connected status
+  } else {
+    updateSynapsePermanence(synapse, permanence);
   }
 }
 
@@ -446,47 +1182,142 @@ void Connections::adaptSegment(const Segment segment,
     currentUpdates_.resize(  synapses_.size(), minPermanence );
   }
 
-  const auto& synapses = synapsesForSegment(segment);
-  for( size_t i = 0; i <  synapses.size(); i++) {
-      const auto synapse = synapses[i];
-      const SynapseData &synapseData = dataForSynapse(synapse);
+  // Gather the segment into contiguous arrays.
+  const auto &synapses = synapsesForSegment(segment);
+  segmentSynapses_.assign( synapses.cbegin(), synapses.cend() );
+  const size_t numSynapses = segmentSynapses_.size();
+  segmentPresynapticCells_.resize( numSynapses );
+  segmentPermanences_.resize( numSynapses );
+  segmentUpdates_.resize( numSynapses );
+  for( size_t i = 0; i < numSynapses; i++ ) {
+    const SynapseData &synapseData = synapses_[segmentSynapses_[i]];
+    segmentPresynapticCells_[i] = synapseData.presynapticCell;
+    segmentPermanences_[i]      = synapseData.permanence;
+  }
+  for( size_t i = 0; i < numSynapses; i++ ) {
+    segmentUpdates_[i] = inputArray[segmentPresynapticCells_[i]] ? increment : -decrement;
+  }
+
+  // Compute all new permanences at once, they do not depend on each other.
+  segmentAdapted_.resize( numSynapses );
+  addClamped( segmentPermanences_.data(), segmentUpdates_.data(), segmentAdapted_.data(), numSynapses );
 
-      Permanence update;
-      if( inputArray[synapseData.presynapticCell] ) {
-        update = increment;
-      } else {
-        update = -decrement;
-      }
+  for( size_t i = 0; i < numSynapses; i++ ) {
+    const auto synapse = segmentSynapses_[i];
+    const auto update  = segmentUpdates_[i];
 
     //prune permanences that reached zero
     if (pruneZeroSynapses and 
-        synapseData.permanence + update < htm::minPermanence + htm::Epsilon) { //new value will disconnect the synapse
+        segmentPermanences_[i] + update < htm::minPermanence + htm::Epsilon) { //new value will disconnect the synapse
       destroySynapse(synapse);
       prunedSyns_++; //for statistics
-      i--; // do not advance `i`, as `destroySynapse` just modified inplace the synapses_, so now a `synapses_[i]`
-      // is the "next" synapse. 
       continue;
     }
 
     //update synapse, but for TS only if changed
     if(timeseries_) {
       if( update != previousUpdates_[synapse] ) {
-        updateSynapsePermanence(synapse, synapseData.permanence + update);
+        setPermanence_(synapse, segmentAdapted_[i]);
       }
       currentUpdates_[ synapse ] = update;
     } else {
-      updateSynapsePermanence(synapse, synapseData.permanence + update);
+      setPermanence_(synapse, segmentAdapted_[i]);
     }
   }
 
   //destroy segment if it has too few synapses left -> will never be able to connect again
-  if(pruneZeroSynapses and synapses.size() < connectedThreshold_) {
+  if(pruneZeroSynapses and synapsesForSegment(segment).size() < connectedThreshold_) {
     destroySegment(segment);
     prunedSegs_++; //statistics
   }
 }
 
 
+void Connections::adaptSegments(const vector<Segment> &segments,
+                                const SDR &inputs,
+                                const Permanence increment,
+                                const Permanence decrement,
+                                const bool pruneZeroSynapses)
+{
+  // Spawning work is only worth it with enough segments for each worker.
+  const size_t minSegmentsPerThread = 8u;
+  const UInt numWorkers = static_cast<UInt>(std::max<size_t>(1u,
+                            std::min<size_t>(threads_.size(), segments.size() / minSegmentsPerThread)));
+  if( numWorkers == 1u || timeseries_ ) {
+    for(const auto segment : segments) {
+      adaptSegment(segment, inputs, increment, decrement, pruneZeroSynapses);
+    }
+    return;
+  }
+
+  const auto &inputArray = inputs.getDense(); //before the workers read it
+  adaptScratch_.resize( numWorkers );
+  threads_.parallelFor(numWorkers, [&](const UInt worker) {
+    // Each segment has its own synapses, the workers write distinct synapses.
+    auto &scratch = adaptScratch_[worker];
+    scratch.crossings.clear();
+    scratch.pruned.clear();
+    scratch.segmentEnds.clear();
+    const auto range = workerRange( segments.size(), worker, numWorkers );
+    for(size_t s = range.first; s < range.second; s++) {
+      const auto &synapses = synapsesForSegment( segments[s] );
+      const size_t numSynapses = synapses.size();
+      scratch.permanences.resize( numSynapses );
+      scratch.updates.resize( numSynapses );
+      scratch.adapted.resize( numSynapses );
+      for( size_t i = 0; i < numSynapses; i++ ) {
+        const SynapseData &synapseData = synapses_[synapses[i]];
+        scratch.permanences[i] = synapseData.permanence;
+        scratch.updates[i]     = inputArray[synapseData.presynapticCell] ? increment : -decrement;
+      }
+      addClamped( scratch.permanences.data(), scratch.updates.data(), scratch.adapted.data(), numSynapses );
+
+      for( size_t i = 0; i < numSynapses; i++ ) {
+        // Same pruning condition as adaptSegment.
+        if( pruneZeroSynapses and
+            scratch.permanences[i] + scratch.updates[i] < htm::minPermanence + htm::Epsilon ) {
+          scratch.crossings.emplace_back( synapses[i], minPermanence );
+          scratch.pruned.push_back( true );
+          continue;
+        }
+        const Permanence permanence = roundPermanence( scratch.adapted[i] );
+        auto &synapseData = synapses_[synapses[i]];
+        if( (synapseData.permanence >= connectedThreshold_) == (permanence >= connectedThreshold_) ) {
+          synapseData.permanence = permanence;
+        } else {
+          scratch.crossings.emplace_back( synapses[i], permanence );
+          scratch.pruned.push_back( false );
+        }
+      }
+      scratch.segmentEnds.push_back( scratch.crossings.size() );
+    }
+  });
+
+  // Connecting, disconnecting and pruning change the shared presynaptic
+  // index, in the same order as adaptSegment on each segment.
+  for(UInt worker = 0u; worker < numWorkers; worker++) {
+    const auto &scratch = adaptScratch_[worker];
+    const auto range = workerRange( segments.size(), worker, numWorkers );
+    size_t crossing = 0u;
+    for(size_t s = range.first; s < range.second; s++) {
+      for(; crossing < scratch.segmentEnds[s - range.first]; crossing++) {
+        const auto synapse = scratch.crossings[crossing].first;
+        if( scratch.pruned[crossing] ) {
+          destroySynapse( synapse );
+          prunedSyns_++;
+        } else {
+          updateSynapsePermanence( synapse, scratch.crossings[crossing].second );
+        }
+      }
+      if( pruneZeroSynapses and synapsesForSegment(segments[s]).size() < connectedThreshold_ ) {
+        destroySegment( segments[s] );
+        prunedSegs_++;
+      }
+    }
+  }
+}
+
+
 /**
  * Called for under-performing Segments (can have synapses pruned, etc.). After
  * the call, Segment will have at least segmentThreshold synapses connected, so
@@ -504,7 +1335,7 @@ void Connections::raisePermanencesToThreshold(
   if( segData.numConnected >= segmentThreshold )
     return;   // The segment already satisfies the requirement, done.
 
-  vector<Synapse> &synapses = segData.synapses;
+  const SynapseList &synapses = segData.synapses;
   if( synapses.empty())
     return;   // No synapses to raise permanences to, no work to do.
 
@@ -527,14 +1358,18 @@ void Connections::raisePermanencesToThreshold(
   // will be at least N synapses connected.
 
   // Threshold is ensured to be >=1 by condition at very beginning if(thresh == 0)... 
-  auto minPermSynPtr = synapses.begin() + threshold - 1;
+  // Work on a contiguous copy of the permanences, this also keeps the order of
+  // the segment's synapses intact.
+  segmentPermanences_.resize( synapses.size() );
+  for( size_t i = 0; i < synapses.size(); i++ ) {
+    segmentPermanences_[i] = synapses_[synapses[i]].permanence;
+  }
+  auto minPermPtr = segmentPermanences_.begin() + threshold - 1;
 
-  const auto permanencesGreater = [&](const Synapse &A, const Synapse &B)
-    { return synapses_[A].permanence > synapses_[B].permanence; };
   // Do a partial sort, it's faster than a full sort.
-  std::nth_element(synapses.begin(), minPermSynPtr, synapses.end(), permanencesGreater);
+  std::nth_element(segmentPermanences_.begin(), minPermPtr, segmentPermanences_.end(), std::greater<Permanence>());
 
-  const Real increment = connectedThreshold_ - synapses_[ *minPermSynPtr ].permanence;
+  const Real increment = connectedThreshold_ - *minPermPtr;
   if( increment <= 0 ) // If minPermSynPtr is already connected then ...
     return;            // Enough synapses are already connected.
 
@@ -597,10 +1432,16 @@ void Connections::synapseCompetition(
 
 
 void Connections::bumpSegment(const Segment segment, const Permanence delta) {
-  const vector<Synapse> &synapses = synapsesForSegment(segment);
-  // TODO: vectorize?
-  for( const auto syn : synapses ) {
-    updateSynapsePermanence(syn, synapses_[syn].permanence + delta);
+  const SynapseList &synapses = synapsesForSegment(segment);
+  const size_t numSynapses = synapses.size();
+  segmentPermanences_.resize( numSynapses );
+  segmentAdapted_.resize( numSynapses );
+  for( size_t i = 0; i < numSynapses; i++ ) {
+    segmentPermanences_[i] = synapses_[synapses[i]].permanence;
+  }
+  addClamped( segmentPermanences_.data(), delta, segmentAdapted_.data(), numSynapses );
+  for( size_t i = 0; i < numSynapses; i++ ) {
+    setPermanence_( synapses[i], segmentAdapted_[i] );
   }
 }
 
@@ -641,6 +1482,374 @@ void Connections::destroyMinPermanenceSynapses(
 }
 
 
+namespace {
+
+const char   SNAPSHOT_MAGIC[8]   = {'H', 'T', 'M', 'C', 'O', 'N', 'N', 'S'};
+const UInt32 SNAPSHOT_BYTE_ORDER = 0x01020304u;
+
+struct SnapshotHeader {
+  char   magic[8];
+  UInt32 version;
+  UInt32 byteOrder; //SNAPSHOT_BYTE_ORDER as written by the host
+  UInt32 numCells;
+  UInt32 numSegments;
+  UInt32 numSynapses;
+  Real32 connectedThreshold; //as used internally, see Connections::initialize
+  UInt32 iteration;
+  UInt32 numPresynapticCells; //1 + the largest presynaptic cell, 0 without synapses
+  UInt32 reserved[6];
+};
+static_assert(sizeof(SnapshotHeader) == 64u, "Snapshot header must be 64 bytes.");
+
+/**
+ * Checks what the header alone tells, before anything is read or allocated
+ * for the data which follows it.
+ */
+void checkSnapshotHeader(const SnapshotHeader &header) {
+  NTA_CHECK(std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0)
+    << "ConnectionsSnapshot: not a Connections snapshot.";
+  NTA_CHECK(header.version == ConnectionsSnapshot::VERSION)
+    << "ConnectionsSnapshot: unsupported version " << header.version
+    << ", expected " << ConnectionsSnapshot::VERSION;
+  NTA_CHECK(header.byteOrder == SNAPSHOT_BYTE_ORDER)
+    << "ConnectionsSnapshot: the snapshot is little-endian, this host is not.";
+}
+
+/**
+ * Size of the whole snapshot, header and arrays, as told by the header.
+ */
+size_t snapshotBytes(const SnapshotHeader &header) {
+  const UInt64 bytes = sizeof(header) + sizeof(UInt32) * (
+    static_cast<UInt64>(header.numCells) + 2u * static_cast<UInt64>(header.numSegments)
+    + 2u * static_cast<UInt64>(header.numSynapses));
+  NTA_CHECK(bytes <= std::numeric_limits<size_t>::max())
+    << "ConnectionsSnapshot: " << bytes << " bytes do not fit into memory.";
+  return static_cast<size_t>(bytes);
+}
+
+bool isLittleEndian() {
+  const UInt32 probe = 1u;
+  return *reinterpret_cast<const unsigned char*>(&probe) == 1u;
+}
+
+/**
+ * Writes the values pushed into it in chunks, so that saving a snapshot
+ * needs only a small constant buffer.
+ */
+template<typename T>
+class ChunkWriter {
+public:
+  explicit ChunkWriter(std::ostream &out) : out_(out) { chunk_.reserve(CHUNK); }
+  ~ChunkWriter() { flush(); }
+
+  void push(const T value) {
+    chunk_.push_back(value);
+    if( chunk_.size() == CHUNK ) flush();
+  }
+
+  void flush() {
+    out_.write(reinterpret_cast<const char*>(chunk_.data()), chunk_.size() * sizeof(T));
+    chunk_.clear();
+  }
+
+private:
+  static const size_t CHUNK = 4096u;
+  std::ostream &out_;
+  vector<T> chunk_;
+};
+
+} // end anonymous namespace
+
+
+ConnectionsSnapshot::ConnectionsSnapshot(const string &path)
+  : file_(new MappedFile(path)) {
+  parse_(file_->data(), file_->size());
+}
+
+ConnectionsSnapshot::ConnectionsSnapshot(std::istream &in) {
+  SnapshotHeader header;
+  in.read(reinterpret_cast<char*>(&header), sizeof(header));
+  NTA_CHECK(static_cast<size_t>(in.gcount()) == sizeof(header)) << "ConnectionsSnapshot: truncated header.";
+  checkSnapshotHeader(header);
+  const size_t size = snapshotBytes(header);
+
+  // The buffer grows with the data actually read, doubling, so a corrupt
+  // header cannot make it allocate much more than the stream holds.
+  const size_t MIN_CHUNK = 1u << 20;
+  buffer_.resize(sizeof(header));
+  std::memcpy(buffer_.data(), &header, sizeof(header));
+  while( buffer_.size() < size ) {
+    const size_t done  = buffer_.size();
+    const size_t chunk = std::min(size - done, std::max(done, MIN_CHUNK));
+    buffer_.resize(done + chunk);
+    in.read(buffer_.data() + done, chunk);
+    NTA_CHECK(static_cast<size_t>(in.gcount()) == chunk) << "ConnectionsSnapshot: truncated data.";
+  }
+  parse_(buffer_.data(), buffer_.size());
+}
+
+ConnectionsSnapshot::~ConnectionsSnapshot() {}
+
+void ConnectionsSnapshot::parse_(const char *data, const size_t size) {
+  NTA_CHECK(size >= sizeof(SnapshotHeader)) << "ConnectionsSnapshot: truncated header.";
+  SnapshotHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  checkSnapshotHeader(header);
+
+  numCells_    = header.numCells;
+  numSegments_ = header.numSegments;
+  numSynapses_ = header.numSynapses;
+  connectedThreshold_ = header.connectedThreshold;
+  iteration_   = header.iteration;
+  numPresynapticCells_ = header.numPresynapticCells;
+  NTA_CHECK(connectedThreshold_ >= minPermanence - htm::Epsilon && connectedThreshold_ <= maxPermanence)
+    << "ConnectionsSnapshot: connected threshold out of range: " << connectedThreshold_;
+
+  const size_t expected = snapshotBytes(header);
+  NTA_CHECK(size == expected)
+    << "ConnectionsSnapshot: size is " << size << " bytes, the header says " << expected;
+
+  const UInt32 *arrays = reinterpret_cast<const UInt32*>(data + sizeof(header));
+  cellSegmentsEnd_    = arrays;
+  segmentSynapsesEnd_ = cellSegmentsEnd_    + numCells_;
+  segmentLastUsed_    = segmentSynapsesEnd_ + numSegments_;
+  presynapticCells_   = segmentLastUsed_    + numSegments_;
+  permanences_        = reinterpret_cast<const Real32*>(presynapticCells_ + numSynapses_);
+
+  // The loaders index with these, make sure they are consistent.
+  UInt32 last = 0u;
+  for( CellIdx cell = 0; cell < numCells_; cell++ ) {
+    NTA_CHECK(cellSegmentsEnd_[cell] >= last) << "ConnectionsSnapshot: corrupt segment ranges.";
+    last = cellSegmentsEnd_[cell];
+  }
+  NTA_CHECK(last == numSegments_) << "ConnectionsSnapshot: corrupt segment ranges.";
+  last = 0u;
+  for( size_t segment = 0; segment < numSegments_; segment++ ) {
+    NTA_CHECK(segmentSynapsesEnd_[segment] >= last) << "ConnectionsSnapshot: corrupt synapse ranges.";
+    last = segmentSynapsesEnd_[segment];
+  }
+  NTA_CHECK(last == numSynapses_) << "ConnectionsSnapshot: corrupt synapse ranges.";
+
+  // The loaders size the presynaptic index by numPresynapticCells.
+  size_t numPresynapticCells = 0u;
+  for( size_t synapse = 0; synapse < numSynapses_; synapse++ ) {
+    NTA_CHECK(presynapticCells_[synapse] < numPresynapticCells_)
+      << "ConnectionsSnapshot: presynaptic cell " << presynapticCells_[synapse]
+      << " out of range, the header says " << numPresynapticCells_ << " cells.";
+    numPresynapticCells = std::max<size_t>(numPresynapticCells, presynapticCells_[synapse] + size_t(1u));
+  }
+  NTA_CHECK(numPresynapticCells == numPresynapticCells_)
+    << "ConnectionsSnapshot: the header says " << numPresynapticCells_
+    << " presynaptic cells, the synapses use " << numPresynapticCells;
+}
+
+
+void Connections::saveSnapshot(std::ostream &out) const {
+  NTA_CHECK(isLittleEndian()) << "saveSnapshot: the snapshot format is little-endian, this host is not.";
+
+  SnapshotHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  header.version            = ConnectionsSnapshot::VERSION;
+  header.byteOrder          = SNAPSHOT_BYTE_ORDER;
+  header.numCells           = static_cast<UInt32>(cells_.size());
+  header.numSegments        = static_cast<UInt32>(numSegments());
+  header.numSynapses        = static_cast<UInt32>(numSynapses());
+  header.connectedThreshold = connectedThreshold_;
+  header.iteration          = iteration_;
+  UInt32 numPresynapticCells = 0u;
+  for( const auto &cellData : cells_ ) {
+    for( const auto segment : cellData.segments ) {
+      for( const auto synapse : segments_[segment].synapses ) {
+        numPresynapticCells = std::max(numPresynapticCells, synapses_[synapse].presynapticCell + 1u);
+      }
+    }
+  }
+  header.numPresynapticCells = numPresynapticCells;
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  // Each array is a separate pass over the cells, so that nothing but a
+  // small buffer is needed.
+  {
+    ChunkWriter<UInt32> cellSegmentsEnd(out);
+    UInt32 end = 0u;
+    for( const auto &cellData : cells_ ) {
+      end += static_cast<UInt32>(cellData.segments.size());
+      cellSegmentsEnd.push(end);
+    }
+  }
+  {
+    ChunkWriter<UInt32> segmentSynapsesEnd(out);
+    UInt32 end = 0u;
+    for( const auto &cellData : cells_ ) {
+      for( const auto segment : segmentsInCreationOrder_(cellData) ) {
+        end += static_cast<UInt32>(segments_[segment].synapses.size());
+        segmentSynapsesEnd.push(end);
+      }
+    }
+  }
+  {
+    ChunkWriter<UInt32> segmentLastUsed(out);
+    for( const auto &cellData : cells_ ) {
+      for( const auto segment : segmentsInCreationOrder_(cellData) ) {
+        segmentLastUsed.push(segments_[segment].lastUsed);
+      }
+    }
+  }
+  {
+    ChunkWriter<CellIdx> presynapticCells(out);
+    for( const auto &cellData : cells_ ) {
+      for( const auto segment : segmentsInCreationOrder_(cellData) ) {
+        for( const auto synapse : segments_[segment].synapses ) {
+          presynapticCells.push(synapses_[synapse].presynapticCell);
+        }
+      }
+    }
+  }
+  {
+    ChunkWriter<Real32> permanences(out);
+    for( const auto &cellData : cells_ ) {
+      for( const auto segment : segmentsInCreationOrder_(cellData) ) {
+        for( const auto synapse : segments_[segment].synapses ) {
+          permanences.push(synapses_[synapse].permanence);
+        }
+      }
+    }
+  }
+  NTA_CHECK(out.good()) << "saveSnapshot: write failed.";
+}
+
+void Connections::saveSnapshot(const string &path) const {
+  std::ofstream out(path, std::ios_base::out | std::ios_base::binary);
+  NTA_CHECK(out.is_open()) << "saveSnapshot: can not open '" << path << "'";
+  saveSnapshot(out);
+}
+
+void Connections::loadSnapshot(const string &path) {
+  const ConnectionsSnapshot snapshot(path);
+  loadSnapshot(snapshot);
+}
+
+void Connections::loadSnapshot(const ConnectionsSnapshot &snapshot) {
+  // The snapshot holds the internal threshold, set it after initialize.
+  const Permanence threshold = std::max(minPermanence, snapshot.connectedThreshold());
+  initialize(snapshot.numCells(), threshold, timeseries_, flatIndex_);
+  connectedThreshold_ = roundPermanence(snapshot.connectedThreshold());
+  iteration_          = snapshot.iteration();
+
+  const size_t numSegments = snapshot.numSegments();
+  const size_t numSynapses = snapshot.numSynapses();
+  NTA_CHECK(numSegments < std::numeric_limits<Segment>::max() &&
+            numSynapses < std::numeric_limits<Synapse>::max())
+    << "loadSnapshot: too many segments or synapses.";
+  const UInt32  *cellSegmentsEnd    = snapshot.cellSegmentsEnd();
+  const UInt32  *segmentSynapsesEnd = snapshot.segmentSynapsesEnd();
+  const UInt32  *segmentLastUsed    = snapshot.segmentLastUsed();
+  const CellIdx *presynapticCells   = snapshot.presynapticCells();
+  const Real32  *permanences        = snapshot.permanences();
+
+  segments_.reserve(numSegments);
+  synapses_.resize(numSynapses);
+  vector<Segment> lruOrder;
+
+  Segment segment = 0u;
+  Synapse synapse = 0u;
+  for( CellIdx cell = 0; cell < snapshot.numCells(); cell++ ) {
+    CellData &cellData = cells_[cell];
+    const Segment segmentsEnd = cellSegmentsEnd[cell];
+    cellData.segments.reserve(segmentsEnd - segment);
+
+    for( ; segment < segmentsEnd; segment++ ) {
+      segments_.emplace_back(cell, nextSegmentOrdinal_++, segmentLastUsed[segment]);
+      SegmentData &segmentData = segments_.back();
+      segmentData.idxOnCell_ = static_cast<SegmentIdx>(cellData.segments.size());
+      cellData.segments.push_back(segment);
+
+      const Synapse synapsesEnd = segmentSynapsesEnd[segment];
+      segmentData.synapses.reserve(synapsesEnd - synapse);
+      for( ; synapse < synapsesEnd; synapse++ ) {
+        const Permanence permanence = permanences[synapse];
+        NTA_CHECK(permanence >= minPermanence && permanence <= maxPermanence)
+          << "loadSnapshot: permanence out of range: " << permanence;
+
+        SynapseData &synapseData    = synapses_[synapse];
+        synapseData.presynapticCell = presynapticCells[synapse];
+        synapseData.segment         = segment;
+        synapseData.id              = nextSynapseOrdinal_++;
+        synapseData.permanence      = permanence;
+        if( synapseData.permanence >= connectedThreshold_ ) {
+          segmentData.numConnected++;
+        }
+        segmentData.synapses.push_back(synapse);
+      }
+    }
+
+    // Link the LRU list in order, each insert is then O(1).
+    lruOrder.assign(cellData.segments.begin(), cellData.segments.end());
+    std::sort(lruOrder.begin(), lruOrder.end(), [&](const Segment a, const Segment b) {
+      return segments_[a].lastUsed < segments_[b].lastUsed ||
+            (segments_[a].lastUsed == segments_[b].lastUsed && a < b);
+    });
+    for( const auto s : lruOrder ) {
+      lruInsert_(s);
+    }
+  }
+
+  // The presynaptic index: count the synapses of each presynaptic cell, then
+  // fill each cell's entries at once, in the order of the synapses.
+  vector<Synapse> count[2]; //[connected]
+  count[false].assign(snapshot.numPresynapticCells(), 0u);
+  count[true ].assign(snapshot.numPresynapticCells(), 0u);
+  for( const auto &synapseData : synapses_ ) {
+    count[synapseData.permanence >= connectedThreshold_][synapseData.presynapticCell]++;
+  }
+
+  if( flatIndex_ ) {
+    potentialPresynapticFlat_.reserve(count[false]);
+    connectedPresynapticFlat_.reserve(count[true]);
+    for( Synapse syn = 0u; syn < numSynapses; syn++ ) {
+      SynapseData &synapseData = synapses_[syn];
+      auto &flatMap = synapseData.permanence >= connectedThreshold_ ? connectedPresynapticFlat_
+                                                                    : potentialPresynapticFlat_;
+      synapseData.presynapticMapIndex_ = flatMap.add(synapseData.presynapticCell, syn, synapseData.segment);
+    }
+    return;
+  }
+
+  for( const bool connected : {false, true} ) {
+    const auto &counts = count[connected];
+    auto &synapseMap = connected ? connectedSynapsesForPresynapticCell_ : potentialSynapsesForPresynapticCell_;
+    auto &segmentMap = connected ? connectedSegmentsForPresynapticCell_ : potentialSegmentsForPresynapticCell_;
+
+    vector<size_t> start(counts.size() + 1u, 0u);
+    for( size_t cell = 0; cell < counts.size(); cell++ ) {
+      start[cell + 1u] = start[cell] + counts[cell];
+    }
+    vector<Synapse> bucketed(start.back());
+    vector<size_t> next(start.begin(), start.end() - 1);
+    for( Synapse syn = 0u; syn < numSynapses; syn++ ) {
+      const SynapseData &synapseData = synapses_[syn];
+      if( (synapseData.permanence >= connectedThreshold_) == connected ) {
+        bucketed[next[synapseData.presynapticCell]++] = syn;
+      }
+    }
+
+    for( CellIdx cell = 0; cell < static_cast<CellIdx>(counts.size()); cell++ ) {
+      if( counts[cell] == 0u ) continue;
+      auto &preSynapses = synapseMap[cell];
+      auto &preSegments = segmentMap[cell];
+      preSynapses.assign(bucketed.begin() + start[cell], bucketed.begin() + start[cell + 1u]);
+      preSegments.resize(preSynapses.size());
+      for( Synapse k = 0u; k < static_cast<Synapse>(preSynapses.size()); k++ ) {
+        SynapseData &synapseData = synapses_[preSynapses[k]];
+        preSegments[k] = synapseData.segment;
+        synapseData.presynapticMapIndex_ = k;
+      }
+    }
+  }
+}
+
+
 namespace htm {
 /**
  * print statistics in human readable form
@@ -648,7 +1857,11 @@ namespace htm {
 std::ostream& operator<< (std::ostream& stream, const Connections& self)
 {
   stream << "Connections:" << std::endl;
-  const auto numPresyns = self.potentialSynapsesForPresynapticCell_.size();
+  size_t numPresyns = self.potentialSynapsesForPresynapticCell_.size();
+  if( self.flatIndex_ ) {
+    const auto &flat = self.potentialPresynapticFlat_;
+    numPresyns = flat.size.size() - std::count(flat.size.cbegin(), flat.size.cend(), 0u);
+  }
   stream << "    Inputs (" << numPresyns
          << ") ~> Outputs (" << self.cells_.size()
          << ") via Segments (" << self.numSegments() << ")" << std::endl;
@@ -664,7 +1877,7 @@ std::ostream& operator<< (std::ostream& stream, const Connections& self)
   SynapseIdx  connectedMax  = 0;
   UInt        synapsesDead      = 0;
   UInt        synapsesSaturated = 0;
-  for( const auto cellData : self.cells_ )
+  for( const auto &cellData : self.cells_ )
   {
     const UInt numSegments = (UInt) cellData.segments.size();
     segmentsMin   = std::min( segmentsMin, numSegments );
@@ -709,6 +1922,9 @@ std::ostream& operator<< (std::ostream& stream, const Connections& self)
 	 << "%) Segments pruned (" << (Real) self.prunedSegs_ / self.numSegments() << "%)" << std::endl;
   stream << "    Buffer for destroyed synapses: " << self.destroyedSynapses_.size() << " \t buffer for destr. segments: "
 	 << self.destroyedSegments_.size() << std::endl; 
+  const auto pool = SlabPool::stats(); //shared by all Connections in the process
+  stream << "    Slab pool: reserved " << pool.bytesReserved << " B, live " << pool.bytesLive
+         << " B, free " << pool.bytesFree << " B, fragmentation " << pool.fragmentation() << std::endl;
 
   return stream;
 }
@@ -729,11 +1945,14 @@ bool Connections::operator==(const Connections &other) const {
     if (cellData.segments.size() != otherCellData.segments.size()) {
       return false;
     }
+    // Compared in the order of compareSegments(), as saved.
+    const auto segments      = segmentsInCreationOrder_(cellData);
+    const auto otherSegments = other.segmentsInCreationOrder_(otherCellData);
 
-    for (SegmentIdx j = 0; j < static_cast<SegmentIdx>(cellData.segments.size()); j++) {
-      const Segment segment = cellData.segments[j];
+    for (SegmentIdx j = 0; j < static_cast<SegmentIdx>(segments.size()); j++) {
+      const Segment segment = segments[j];
       const SegmentData &segmentData = segments_[segment];
-      const Segment otherSegment = otherCellData.segments[j];
+      const Segment otherSegment = otherSegments[j];
       const SegmentData &otherSegmentData = other.segments_[otherSegment];
 
       if (segmentData.synapses.size() != otherSegmentData.synapses.size() ||
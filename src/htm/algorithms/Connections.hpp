@@ -22,8 +22,10 @@
 #ifndef NTA_CONNECTIONS_HPP
 #define NTA_CONNECTIONS_HPP
 
+#include <algorithm>
 #include <limits>
 #include <map>
+#include <memory>
 #include <unordered_map>
 #include <set>
 #include <utility>
@@ -33,19 +35,72 @@
 #include <htm/types/Types.hpp>
 #include <htm/types/Serializable.hpp>
 #include <htm/types/Sdr.hpp>
+#include <htm/utils/Parallel.hpp>
+#include <htm/utils/SlabAllocator.hpp>
 
 namespace htm {
 
+class MappedFile;
+
 //TODO instead of typedefs, use templates for proper type-checking?
 using CellIdx   = htm::ElemSparse; // CellIdx must match with ElemSparse, defined in Sdr.hpp
 using SegmentIdx= UInt16; /** Index of segment in cell. */
 using SynapseIdx= UInt16; /** Index of synapse in segment. */
 using Segment   = UInt32;    /** Index of segment's data. */
 using Synapse   = UInt32;    /** Index of synapse's data. */
-using Permanence= Real32; //TODO experiment with half aka float16
+using Permanence= Real32; //stored as 16-bit fixed point with PERMANENCE_FIXED16, see StoredPermanence
 constexpr const Permanence minPermanence = 0.0f;
 constexpr const Permanence maxPermanence = 1.0f;
 
+/** Lists of synapses on a segment, and of segments on a cell. Their memory
+ *  comes from the SlabPool, see SlabAllocator.hpp. */
+using SynapseList = std::vector<Synapse, SlabAllocator<Synapse>>;
+using SegmentList = std::vector<Segment, SlabAllocator<Segment>>;
+
+
+
+#ifdef NTA_PERMANENCE_FIXED16
+/**
+ * Storage type of a synapse's permanence: 16-bit fixed point in steps of
+ * 1/65535, selected by the cmake option PERMANENCE_FIXED16 to save memory.
+ * Converts implicitly from and to Permanence; assigned values are clamped to
+ * [minPermanence, maxPermanence] and rounded to the nearest step.
+ */
+class StoredPermanence {
+public:
+  StoredPermanence() = default;
+  StoredPermanence(const Permanence permanence) : value_(quantize(permanence)) {}
+  operator Permanence() const { return static_cast<Permanence>(value_) / STEPS; }
+
+private:
+  static constexpr Permanence STEPS = 65535.0f;
+  static UInt16 quantize(const Permanence permanence) {
+    const Permanence clamped = std::min(std::max(permanence, minPermanence), maxPermanence);
+    return static_cast<UInt16>(clamped * STEPS + 0.5f);
+  }
+  UInt16 value_ = 0u;
+};
+#else
+using StoredPermanence = Permanence;
+#endif
+
+/**
+ * Rounds a permanence to the value it will have once stored in a synapse.
+ * No-op unless built with PERMANENCE_FIXED16.
+ */
+inline Permanence roundPermanence(const Permanence permanence) {
+  return static_cast<Permanence>(StoredPermanence(permanence));
+}
+
+/**
+ * Tolerance for comparing a permanence with its stored value: one fixed point
+ * step (plus the float rounding) with PERMANENCE_FIXED16, htm::Epsilon otherwise.
+ */
+#ifdef NTA_PERMANENCE_FIXED16
+static const Permanence permanenceTolerance = 1.0f / 65535.0f + htm::Epsilon;
+#else
+static const Permanence permanenceTolerance = htm::Epsilon;
+#endif
 
 
 /**
@@ -60,27 +115,35 @@ constexpr const Permanence maxPermanence = 1.0f;
  * @param permanence
  * Permanence of synapse.
  */
-struct SynapseData: public Serializable {
+#ifdef NTA_PERMANENCE_FIXED16
+#pragma pack(push, 2) //18 bytes instead of 20
+#endif
+struct SynapseData { //not Serializable, which would add a vtable pointer to each synapse
   CellIdx presynapticCell;
-  Permanence permanence;
   Segment segment;
   Synapse presynapticMapIndex_;
   Synapse id;
+  StoredPermanence permanence;
 
   SynapseData() {}
 
-  CerealAdapter;
   template<class Archive>
   void save_ar(Archive & ar) const {
-    ar(cereal::make_nvp("perm", permanence),
+    const Permanence perm = permanence; //always saved as Real32
+    ar(cereal::make_nvp("perm", perm),
       cereal::make_nvp("presyn", presynapticCell));
   }
   template<class Archive>
   void load_ar(Archive & ar) {
-    ar( permanence, presynapticCell);
+    Permanence perm;
+    ar( perm, presynapticCell);
+    permanence = perm;
   }
 
 };
+#ifdef NTA_PERMANENCE_FIXED16
+#pragma pack(pop)
+#endif
 
 /**
  * SegmentData class used in Connections.
@@ -97,11 +160,17 @@ struct SynapseData: public Serializable {
 struct SegmentData {
   SegmentData(const CellIdx cell, Segment id, UInt32 lastUsed = 0) : cell(cell), numConnected(0), lastUsed(lastUsed), id(id) {} //default constructor
 
-  std::vector<Synapse> synapses;
+  SynapseList synapses;
   CellIdx cell; //mother cell that this segment originates from
   SynapseIdx numConnected; //number of permanences from `synapses` that are >= synPermConnected, ie connected synapses
-  UInt32 lastUsed = 0; //last used time (iteration). Used for segment pruning by "least recently used" (LRU) in `createSegment`
+  UInt32 lastUsed = 0; //last used time (iteration). Used for segment pruning by "least recently used" (LRU) in `createSegment`. Update with `Connections::touchSegment`
   Segment id; 
+
+  // Bookkeeping of Connections: position in the cell's segment list, and
+  // neighbours in the cell's LRU list (none is numeric_limits::max()).
+  SegmentIdx idxOnCell_ = 0;
+  Segment lruPrev_ = std::numeric_limits<Segment>::max();
+  Segment lruNext_ = std::numeric_limits<Segment>::max();
 };
 
 /**
@@ -116,7 +185,91 @@ struct SegmentData {
  *
  */
 struct CellData {
+  SegmentList segments;
+
+  // The cell's segments as a doubly linked list (through SegmentData) ordered
+  // by SegmentData.lastUsed, then by Segment: lruHead_ is the next one to be
+  // evicted by createSegment. Maintained by Connections.
+  Segment lruHead_ = std::numeric_limits<Segment>::max();
+  Segment lruTail_ = std::numeric_limits<Segment>::max();
+};
+
+/**
+ * FlatPresynapticMap class used in Connections.
+ *
+ * @b Description
+ * A compact (CSR-like) alternative to the hash maps from presynaptic cell to
+ * its synapses & segments. The entries of all presynaptic cells live in two
+ * contiguous parallel arrays, and each cell owns a block
+ * `[offset[cell], offset[cell] + size[cell])` of them, indexed directly by
+ * CellIdx. Each block keeps spare capacity, so appending and (swap-)removing
+ * an entry are O(1) and never move the other entries of the cell.
+ *
+ * When a block is full it is relocated to the end of the arrays; the freed
+ * space is reclaimed by a full rebuild once it dominates the live entries.
+ */
+struct FlatPresynapticMap {
+  std::vector<size_t>  offset;   //start of the cell's block in synapses/segments
+  std::vector<Synapse> size;     //number of entries used in the cell's block
+  std::vector<Synapse> capacity; //reserved length of the cell's block
+  std::vector<Synapse> synapses;
   std::vector<Segment> segments;
+  size_t               holes = 0; //entries in abandoned (relocated) blocks
+
+  void clear();
+
+  /**
+   * Append a synapse (and its segment) to the block of the presynaptic cell.
+   *
+   * @retval Index of the new entry within the cell's block.
+   */
+  Synapse add(const CellIdx cell, const Synapse synapse, const Segment segment);
+
+  /**
+   * Lay out an empty map with room for exactly count[cell] entries of each
+   * cell, so that filling it with add() does not relocate any block.
+   */
+  void reserve(const std::vector<Synapse> &count);
+
+  /**
+   * Number of entries for the presynaptic cell, 0 for unknown cells.
+   */
+  inline Synapse sizeOf(const CellIdx cell) const {
+    return cell < size.size() ? size[cell] : 0u;
+  }
+
+  /**
+   * Rebuild the arrays without holes, keeping each entry's index in its block.
+   */
+  void compact();
+};
+
+/**
+ * One change to a Connections, as delivered in batches to the event
+ * handlers subscribed with buffered = true.
+ *
+ * @param segment The segment created or destroyed, or of the synapse.
+ * @param synapse The synapse, unused for segment events.
+ * @param permanence The new permanence for UPDATE_SYNAPSE_PERMANENCE, and
+ * the initial one for CREATE_SYNAPSE.
+ */
+struct ConnectionsEvent {
+  enum Type : unsigned char {
+    CREATE_SEGMENT,
+    DESTROY_SEGMENT,
+    CREATE_SYNAPSE,
+    DESTROY_SYNAPSE,
+    UPDATE_SYNAPSE_PERMANENCE
+  };
+
+  ConnectionsEvent(const Type type, const Segment segment, const Synapse synapse = 0u,
+                   const Permanence permanence = 0.0f)
+    : type(type), segment(segment), synapse(synapse), permanence(permanence) {}
+
+  Type       type;
+  Segment    segment;
+  Synapse    synapse;
+  Permanence permanence;
 };
 
 /**
@@ -124,6 +277,12 @@ struct CellData {
  *
  * @b Description
  * This acts as a plug-in point for logging / visualizations.
+ *
+ * A handler is either called right away for each change (the on* methods
+ * below), or, if subscribed with buffered = true, only gets onEvents() with
+ * all of the changes once per step. The latter keeps virtual calls out of
+ * the learning loops, and suits consumers which only need a summary of each
+ * step (a journal, metrics).
  */
 class ConnectionsEventHandler {
 public:
@@ -144,6 +303,16 @@ public:
    */
   virtual void onCreateSynapse(Synapse synapse) {}
 
+  /**
+   * Called once after a batch of synapses is created by createSynapses().
+   * The default implementation calls onCreateSynapse() for each of them.
+   */
+  virtual void onCreateSynapses(const std::vector<Synapse> &synapses) {
+    for(const auto synapse : synapses) {
+      onCreateSynapse(synapse);
+    }
+  }
+
   /**
    * Called before a synapse is destroyed.
    */
@@ -154,6 +323,84 @@ public:
    */
   virtual void onUpdateSynapsePermanence(Synapse synapse,
                                          Permanence permanence) {}
+
+  /**
+   * Called after Connections::compact() renumbered the segments and synapses.
+   * The old handle X is now segmentMap[X] (synapseMap[X]), destroyed ones map
+   * to Connections::REMOVED_SEGMENT (REMOVED_SYNAPSE).
+   */
+  virtual void onCompact(const std::vector<Segment> &segmentMap,
+                         const std::vector<Synapse> &synapseMap) {}
+
+  /**
+   * Called with the changes since the last call, in the order they happened,
+   * for handlers subscribed with buffered = true. See
+   * Connections::flushEvents() for when this happens.
+   */
+  virtual void onEvents(const std::vector<ConnectionsEvent> &events) {}
+};
+
+/**
+ * Read-only view of a snapshot written by Connections::saveSnapshot().
+ *
+ * @b Description
+ * A snapshot is a flat, versioned, little-endian file: a 64 byte header
+ * followed by five arrays of 4 byte elements,
+ *
+ *   cellSegmentsEnd[numCells]       end of each cell's segments (prefix sums)
+ *   segmentSynapsesEnd[numSegments] end of each segment's synapses (prefix sums)
+ *   segmentLastUsed[numSegments]    iteration each segment was last used
+ *   presynapticCells[numSynapses]
+ *   permanences[numSynapses]        Real32
+ *
+ * Segments are numbered in the order of their cells, synapses in the order
+ * of their segments. The header also holds numPresynapticCells, one more
+ * than the largest presynaptic cell, which bounds the presynaptic index.
+ * Opened from a path the file is memory mapped, and the
+ * arrays are used in place without any copy; opened from a stream it is
+ * read into memory. The structure is validated on construction.
+ */
+class ConnectionsSnapshot {
+public:
+  static const UInt32 VERSION = 2u;
+
+  explicit ConnectionsSnapshot(const std::string &path);
+  explicit ConnectionsSnapshot(std::istream &in);
+  ~ConnectionsSnapshot();
+
+  ConnectionsSnapshot(const ConnectionsSnapshot &) = delete;
+  ConnectionsSnapshot &operator=(const ConnectionsSnapshot &) = delete;
+
+  CellIdx numCells() const noexcept { return numCells_; }
+  size_t numSegments() const noexcept { return numSegments_; }
+  size_t numSynapses() const noexcept { return numSynapses_; }
+  Permanence connectedThreshold() const noexcept { return connectedThreshold_; }
+  UInt32 iteration() const noexcept { return iteration_; }
+  size_t numPresynapticCells() const noexcept { return numPresynapticCells_; }
+
+  const UInt32 *cellSegmentsEnd() const noexcept { return cellSegmentsEnd_; }
+  const UInt32 *segmentSynapsesEnd() const noexcept { return segmentSynapsesEnd_; }
+  const UInt32 *segmentLastUsed() const noexcept { return segmentLastUsed_; }
+  const CellIdx *presynapticCells() const noexcept { return presynapticCells_; }
+  const Real32 *permanences() const noexcept { return permanences_; }
+
+private:
+  void parse_(const char *data, const size_t size);
+
+  std::unique_ptr<MappedFile> file_;
+  std::vector<char> buffer_;
+
+  CellIdx    numCells_    = 0u;
+  size_t     numSegments_ = 0u;
+  size_t     numSynapses_ = 0u;
+  Permanence connectedThreshold_ = 0.0f;
+  UInt32     iteration_   = 0u;
+  size_t     numPresynapticCells_ = 0u;
+  const UInt32  *cellSegmentsEnd_    = nullptr;
+  const UInt32  *segmentSynapsesEnd_ = nullptr;
+  const UInt32  *segmentLastUsed_    = nullptr;
+  const CellIdx *presynapticCells_   = nullptr;
+  const Real32  *permanences_        = nullptr;
 };
 
 /**
@@ -189,6 +436,11 @@ class Connections : public Serializable
 public:
   static const UInt16 VERSION = 2;
 
+  // Handles of destroyed segments & synapses in the maps passed to
+  // ConnectionsEventHandler::onCompact().
+  static const Segment REMOVED_SEGMENT = std::numeric_limits<Segment>::max();
+  static const Synapse REMOVED_SYNAPSE = std::numeric_limits<Synapse>::max();
+
   /**
    * Connections empty constructor.
    * (Does not call `initialize`.)
@@ -209,10 +461,17 @@ public:
    * This change allows it to work with timeseries data which moves very slowly,
    * instead of the usual HTM inputs which reliably change every cycle.  See
    * also (Kropff & Treves, 2007. http://dx.doi.org/10.2976/1.2793335).
+   *
+   * @params flatPresynapticIndex - Optional, default false. If true, the
+   * presynaptic index used by `computeActivity` is stored in flat arrays
+   * indexed directly by CellIdx (see FlatPresynapticMap) instead of hash maps.
+   * Faster for large models, at the cost of memory proportional to the
+   * highest presynaptic cell index.
    */
-  Connections(const CellIdx numCells, 
+  Connections(const CellIdx numCells,
 	      const Permanence connectedThreshold = 0.5f,
-              const bool timeseries = false);
+              const bool timeseries = false,
+              const bool flatPresynapticIndex = false);
 
   virtual ~Connections() {}
 
@@ -223,10 +482,12 @@ public:
    * @param connectedThreshold Permanence threshold for synapses connecting or
    *                           disconnecting.
    * @param timeseries         See constructor.
+   * @param flatPresynapticIndex See constructor.
    */
-  void initialize(const CellIdx numCells, 
+  void initialize(const CellIdx numCells,
 		  const Permanence connectedThreshold = 0.5f,
-                  const bool timeseries = false);
+                  const bool timeseries = false,
+                  const bool flatPresynapticIndex = false);
 
   /**
    * Creates a segment on the specified cell.
@@ -235,8 +496,10 @@ public:
    *
    * @param maxSegmetsPerCell Optional. Enforce limit on maximum number of segments that can be
    * created on a Cell. If the limit is exceeded, call `destroySegment` to remove least used segments 
-   * (ordered by LRU `SegmentData.lastUsed`). Default value is numeric_limits::max() of the data-type, 
-   * so effectively disabled. 
+   * (ordered by LRU `SegmentData.lastUsed`, ties by the lower Segment). Default value is 
+   * numeric_limits::max() of the data-type, so effectively disabled. 
+   * Finding the least recently used segment takes constant time, see `touchSegment`.
+   * The new segment counts as used in the current iteration.
    *
    * @retval Unique ID of the created segment `seg`. Use `dataForSegment(seg)` to obtain the segment's data. 
    * Use  `idxOfSegmentOnCell()` to get SegmentIdx of `seg` on this `cell`. 
@@ -258,13 +521,54 @@ public:
                         const CellIdx presynapticCell,
                         Permanence permanence);
 
+  /**
+   * Creates a synapse on the specified segment for each of the presynaptic
+   * cells. This gives the same synapses as calling createSynapse() for each
+   * cell in order, but the storage is grown once, the presynaptic index is
+   * updated in a single pass, and the event handlers are notified once with
+   * onCreateSynapses() (there are no onUpdateSynapsePermanence() events for
+   * the initial permanences).
+   *
+   * The new synapses are appended to synapsesForSegment(segment), in the
+   * order of presynapticCells.
+   *
+   * @param segment          Segment to create the synapses on.
+   * @param presynapticCells Cells to synapse on.
+   * @param permanence       Initial permanence of all the new synapses.
+   */
+  void createSynapses(const Segment segment,
+                      const std::vector<CellIdx> &presynapticCells,
+                      const Permanence permanence);
+
+  /**
+   * Creates synapses as above, with an initial permanence for each of them.
+   *
+   * @param permanences Initial permanence of each new synapse, same size as
+   * presynapticCells.
+   */
+  void createSynapses(const Segment segment,
+                      const std::vector<CellIdx> &presynapticCells,
+                      const std::vector<Permanence> &permanences);
+
   /**
    * Destroys segment.
+   * Takes constant time: the last segment of the cell is moved into the
+   * destroyed segment's place in segmentsForCell().
    *
    * @param segment Segment to destroy.
    */
   void destroySegment(const Segment segment);
 
+  /**
+   * Marks the segment as used in the current iteration(), which sets its
+   * SegmentData.lastUsed and moves it to the end of its cell's LRU order.
+   * Use this instead of writing to lastUsed directly, so the eviction in
+   * createSegment stays in order.
+   *
+   * @param segment Segment which was used.
+   */
+  void touchSegment(const Segment segment);
+
   /**
    * Destroys synapse.
    *
@@ -272,6 +576,32 @@ public:
    */
   void destroySynapse(const Synapse synapse);
 
+  /**
+   * Removes the destroyed segments and synapses from storage.
+   *
+   * Destroyed segments & synapses are normally kept as free slots for reuse,
+   * so segmentFlatListLength() never decreases. This renumbers the remaining
+   * segments and synapses densely (keeping their relative order), fixes up
+   * all of the internal indexes and notifies the event handlers with
+   * onCompact(). All Segment and Synapse handles held outside are invalidated
+   * and must be translated with the maps given to onCompact().
+   * Does nothing if there are no destroyed segments or synapses.
+   */
+  void compact();
+
+  /**
+   * Enables automatic compaction: when learning, computeActivity() calls
+   * compact() first if the destroyed segments (or synapses) make up more
+   * than deadRatio of segmentFlatListLength() (or of all synapses).
+   * In that case the output vectors of computeActivity() are compacted as
+   * well, so the caller must not hold on to segment handles across the call.
+   *
+   * @param deadRatio in [0, 1]. Default 0 disables automatic compaction.
+   * This is a runtime setting and is not serialized.
+   */
+  void setCompactionThreshold(const Real deadRatio);
+  Real getCompactionThreshold() const noexcept { return compactionThreshold_; }
+
   /**
    * Updates a synapse's permanence.
    *
@@ -288,7 +618,7 @@ public:
    *
    * @retval Segments on cell.
    */
-  const std::vector<Segment> &segmentsForCell(const CellIdx cell) const {
+  const SegmentList &segmentsForCell(const CellIdx cell) const {
     return cells_[cell].segments;
   }
 
@@ -299,7 +629,7 @@ public:
    *
    * @retval Synapses on segment.
    */
-  const std::vector<Synapse> &synapsesForSegment(const Segment segment) const {
+  const SynapseList &synapsesForSegment(const Segment segment) const {
     NTA_ASSERT(segment < segments_.size()) << "Segment out of bounds! " << segment;
     return segments_[segment].synapses;
   }
@@ -424,7 +754,8 @@ public:
    *
    * The output vectors aren't grown or cleared. They must be
    * preinitialized with the length returned by
-   * getSegmentFlatVectorLength().
+   * getSegmentFlatVectorLength(). They only shrink if automatic compaction
+   * is enabled, see setCompactionThreshold().
    *
    * @param numActiveConnectedSynapsesForSegment
    * An output vector for active connected synapse counts per segment.
@@ -437,6 +768,9 @@ public:
    *
    * @param bool learn : enable learning updates (default true)
    *
+   * If setNumThreads() was set above 1, the active cells are split among
+   * the workers, each counting into its own shard, and the shards are summed
+   * at the end. The result is identical to the single-threaded one.
    */
   void computeActivity(std::vector<SynapseIdx> &numActiveConnectedSynapsesForSegment,
                        std::vector<SynapseIdx> &numActivePotentialSynapsesForSegment,
@@ -447,6 +781,83 @@ public:
                        const std::vector<CellIdx> &activePresynapticCells,
 		       const bool learn = true);
 
+  /**
+   * Same as computeActivity(connected, potential, active, learn), in time
+   * proportional to the number of active synapses instead of the number of
+   * segments.
+   *
+   * Only the counts of the segments with an active synapse are nonzero, and
+   * those segments are listed in touchedSegments (unsorted). The vectors of
+   * the previous call are passed back in: the counts of the previously
+   * touched segments are cleared and the vectors are grown with zeros to
+   * segmentFlatListLength(). Start with all three vectors empty.
+   *
+   * @param touchedSegments
+   * In: the touched segments of the previous call. Out: the segments with an
+   * active (connected or potential) synapse.
+   */
+  void computeActivity(std::vector<SynapseIdx> &numActiveConnectedSynapsesForSegment,
+                       std::vector<SynapseIdx> &numActivePotentialSynapsesForSegment,
+                       const std::vector<CellIdx> &activePresynapticCells,
+                       const bool learn,
+                       std::vector<Segment> &touchedSegments);
+
+  /**
+   * Same as computeActivity(connected, potential, active, learn,
+   * touchedSegments) without learning, and without the bookkeeping of
+   * iterations, events and timeseries. Does not modify the Connections, so
+   * several threads can call it at once with their own vectors.
+   */
+  void computeActivity(std::vector<SynapseIdx> &numActiveConnectedSynapsesForSegment,
+                       std::vector<SynapseIdx> &numActivePotentialSynapsesForSegment,
+                       const std::vector<CellIdx> &activePresynapticCells,
+                       std::vector<Segment> &touchedSegments) const;
+
+  /**
+   * Updates the active connected synapse counts of a previous call to
+   * computeActivity() for a change of the active presynaptic cells, in time
+   * proportional to the change: the synapses of the newly active cells are
+   * counted, the synapses of the cells which are no longer active are
+   * uncounted.
+   *
+   * The counts must be those of the previously active cells, and the
+   * connected synapses must not have changed since they were computed. The
+   * learning bookkeeping is the same as computeActivity(learn).
+   *
+   * @param numActiveConnectedSynapsesForSegment
+   * The active connected synapse counts per segment, updated in place.
+   *
+   * @param activatedPresynapticCells
+   * Cells which are active now, and were not.
+   *
+   * @param deactivatedPresynapticCells
+   * Cells which were active, and are not anymore.
+   *
+   * @param bool learn : enable learning updates (default true)
+   */
+  void updateActivity(std::vector<SynapseIdx> &numActiveConnectedSynapsesForSegment,
+                      const std::vector<CellIdx> &activatedPresynapticCells,
+                      const std::vector<CellIdx> &deactivatedPresynapticCells,
+                      const bool learn = true);
+
+  /**
+   * Computes the active connected synapse counts per segment for a batch of
+   * independent inputs, without learning.
+   *
+   * Does not modify the Connections and does not use its threads (see
+   * setNumThreads), several threads can call it at once.
+   *
+   * @param numActiveConnectedSynapsesForSegment
+   * Output, resized to activePresynapticCells.size() * segmentFlatListLength().
+   * The counts of input i are at [i * segmentFlatListLength(), (i + 1) *
+   * segmentFlatListLength()).
+   *
+   * @param activePresynapticCells
+   * The active cells of each input.
+   */
+  void computeActivityBatch(std::vector<SynapseIdx> &numActiveConnectedSynapsesForSegment,
+                            const std::vector<std::vector<CellIdx>> &activePresynapticCells) const;
+
   /**
    * The primary method in charge of learning.   Adapts the permanence values of
    * the synapses based on the input SDR.  Learning is applied to a single
@@ -469,6 +880,22 @@ public:
                     const Permanence decrement,
 		    const bool pruneZeroSynapses = false);
 
+  /**
+   * Applies adaptSegment(segment, inputs, increment, decrement,
+   * pruneZeroSynapses) to each of the segments, which must be distinct.
+   *
+   * If setNumThreads() was set above 1, the segments are split among the
+   * workers, which compute the new permanences in parallel. The synapses
+   * which get connected, disconnected or pruned (and the segments left
+   * empty) are then updated in the order of the segments, so the result does
+   * not depend on the number of threads.
+   */
+  void adaptSegments(const std::vector<Segment> &segments,
+                     const SDR &inputs,
+                     const Permanence increment,
+                     const Permanence decrement,
+                     const bool pruneZeroSynapses = false);
+
   /**
    * Ensures a minimum number of connected synapses.  This raises permance
    * values until the desired number of synapses have permanences above the
@@ -549,12 +976,12 @@ public:
     std::deque<SynapseData> syndata;
     std::deque<size_t> sizes;
     sizes.push_back(cells_.size());
-    for (CellData cellData : cells_) {
-      const std::vector<Segment> &segments = cellData.segments;
+    for (const CellData &cellData : cells_) {
+      const auto segments = segmentsInCreationOrder_(cellData);
       sizes.push_back(segments.size());
       for (Segment segment : segments) {
         const SegmentData &segmentData = segments_[segment];
-        const std::vector<Synapse> &synapses = segmentData.synapses;
+        const SynapseList &synapses = segmentData.synapses;
         sizes.push_back(synapses.size());
         for (Synapse synapse : synapses) {
           const SynapseData &synapseData = synapses_[synapse];
@@ -577,7 +1004,7 @@ public:
     ar(CEREAL_NVP(syndata));
 
     CellIdx numCells = static_cast<CellIdx>(sizes.front()); sizes.pop_front();
-    initialize(numCells, connectedThreshold_);
+    initialize(numCells, connectedThreshold_, false, flatIndex_); //index layout is not part of the model, keep ours
     for (UInt cell = 0; cell < numCells; cell++) {
       size_t numSegments = sizes.front(); sizes.pop_front();
       for (SegmentIdx j = 0; j < static_cast<SegmentIdx>(numSegments); j++) {
@@ -585,7 +1012,7 @@ public:
 
         size_t numSynapses = sizes.front(); sizes.pop_front();
         for (SynapseIdx k = 0; k < static_cast<SynapseIdx>(numSynapses); k++) {
-          SynapseData& syn = syndata.front(); syndata.pop_front();
+          const SynapseData syn = syndata.front(); syndata.pop_front();
           createSynapse( segment, syn.presynapticCell, syn.permanence );
         }
       }
@@ -593,6 +1020,26 @@ public:
     ar(CEREAL_NVP(iteration_));
   }
 
+  /**
+   * Writes the connections as a flat binary snapshot, see ConnectionsSnapshot.
+   * Unlike save(), the data is streamed out without an intermediate copy.
+   * The stream must be opened with ios_base::binary.
+   */
+  void saveSnapshot(std::ostream &out) const;
+  void saveSnapshot(const std::string &path) const;
+
+  /**
+   * Replaces the contents with a snapshot written by saveSnapshot().
+   * The segments, synapses and presynaptic index are bulk-built from the
+   * arrays, instead of created one by one as in load(). Like load(), this
+   * removes the event handlers; the settings which are not part of the model
+   * (timeseries, presynaptic index layout, threads) are kept.
+   *
+   * Loading from a path memory maps the file.
+   */
+  void loadSnapshot(const ConnectionsSnapshot &snapshot);
+  void loadSnapshot(const std::string &path);
+
   /**
    * Gets the number of cells.
    *
@@ -602,6 +1049,19 @@ public:
 
   constexpr Permanence getConnectedThreshold() const noexcept { return connectedThreshold_; }
 
+  /**
+   * @retval True if the presynaptic index uses the flat layout, see constructor.
+   */
+  bool hasFlatPresynapticIndex() const noexcept { return flatIndex_; }
+
+  /**
+   * Sets the number of threads used by computeActivity() and adaptSegments().
+   * Default 1 (serial). 0 means use all hardware threads.
+   * This is a runtime setting and is not serialized.
+   */
+  void setNumThreads(const UInt numThreads);
+  UInt getNumThreads() const noexcept { return threads_.size(); }
+
   /**
    * Gets the number of segments.
    *
@@ -657,9 +1117,13 @@ public:
    * @param handler
    * An object implementing the ConnectionsEventHandler interface
    *
+   * @param buffered
+   * If true, the handler gets the changes in batches with onEvents(),
+   * instead of a call per change. onCompact() is always called directly.
+   *
    * @retval Unsubscribe token
    */
-  UInt32 subscribe(ConnectionsEventHandler *handler);
+  UInt32 subscribe(ConnectionsEventHandler *handler, const bool buffered = false);
 
   /**
    * Remove an event handler.
@@ -669,6 +1133,13 @@ public:
    */
   void unsubscribe(UInt32 token);
 
+  /**
+   * Delivers the buffered events to the buffered handlers, and clears the
+   * buffer. This happens automatically once per step, in computeActivity()
+   * with learning, and before compact() or unsubscribe().
+   */
+  void flushEvents();
+
 protected:
   /**
    * Check whether this segment still exists on its cell.
@@ -707,6 +1178,123 @@ protected:
                               std::vector<Synapse> &synapsesForPresynapticCell,
                               std::vector<Segment> &segmentsForPresynapticCell);
 
+  /**
+   * Remove a synapse from a flat presynaptic map, see
+   * removeSynapseFromPresynapticMap_.
+   *
+   * @param Synapse Index of synapse in its presynaptic cell's block.
+   *
+   * @param CellIdx presynaptic cell of the synapse.
+   *
+   * @param FlatPresynapticMap either potentialPresynapticFlat_ or
+   * connectedPresynapticFlat_, depending on whether the synapse is connected.
+   */
+  void removeSynapseFromFlatMap_(const Synapse index,
+                                 const CellIdx presynapticCell,
+                                 FlatPresynapticMap &flatMap);
+
+  /**
+   * Insert the segment into its cell's LRU list, at the position given by
+   * its lastUsed. Searches from the most recently used end, so this is
+   * constant time when lastUsed is the current iteration.
+   */
+  void lruInsert_(const Segment segment);
+
+  /**
+   * Remove the segment from its cell's LRU list.
+   */
+  void lruRemove_(const Segment segment);
+
+  /**
+   * Reports a change to the event handlers. Without any subscribers this is
+   * only a check of two empty containers.
+   */
+  inline void notify_(const ConnectionsEvent &event) {
+    if( !eventHandlers_.empty() ) {
+      dispatch_(event);
+    }
+    if( !bufferedEventHandlers_.empty() ) {
+      eventBuffer_.push_back(event);
+    }
+  }
+
+  /**
+   * Calls the matching on* method of each (unbuffered) event handler.
+   */
+  void dispatch_(const ConnectionsEvent &event);
+
+  /**
+   * Implements compact(), also returns the maps from the old to the new
+   * segment and synapse handles.
+   */
+  void compact_(std::vector<Segment> &segmentMap,
+                std::vector<Synapse> &synapseMap);
+
+  /**
+   * If automatic compaction is enabled and due, compacts and shrinks the
+   * per-segment vectors (outputs of computeActivity) to match.
+   */
+  void compactIfNeeded_(std::vector<SynapseIdx> &numActiveConnectedSynapsesForSegment,
+                        std::vector<SynapseIdx> *numActivePotentialSynapsesForSegment);
+
+  /**
+   * The segments of a cell in the order they were created (by SegmentData.id),
+   * which destroySegment() does not keep in segmentsForCell(). The savers
+   * write this order, so that loading, which creates the segments in it,
+   * keeps the order of compareSegments().
+   */
+  std::vector<Segment> segmentsInCreationOrder_(const CellData &cellData) const;
+
+  /**
+   * Shared implementation of both createSynapses() overloads. The permanence
+   * of the i-th new synapse is permanences[i * stride], so a stride of 0 uses
+   * a single permanence for all of them.
+   */
+  void createSynapses_(const Segment segment,
+                       const std::vector<CellIdx> &presynapticCells,
+                       const Permanence *permanences,
+                       const size_t stride);
+
+  /**
+   * Sets the permanence of a synapse which is already clamped to
+   * [minPermanence, maxPermanence]. Only if the synapse changes its connected
+   * state this goes through updateSynapsePermanence(), otherwise just the value
+   * is stored.
+   */
+  inline void setPermanence_(const Synapse synapse, Permanence permanence);
+
+  /**
+   * Adds the number of active connected (or potential) synapses of each
+   * segment, times delta, to numActiveSynapsesForSegment. Shared by both
+   * computeActivity() overloads and updateActivity(), splits the work among
+   * the workers of threads_.
+   */
+  void countActiveSynapses_(std::vector<SynapseIdx> &numActiveSynapsesForSegment,
+                            const bool connected,
+                            const std::vector<CellIdx> &activePresynapticCells,
+                            const SynapseIdx delta = 1u);
+
+  /**
+   * Serial kernel of the computeActivity() overload with touchedSegments:
+   * adds the active synapses to counts, appending the segments whose count
+   * was zero (in both counts and zeroCounts) to touchedSegments.
+   */
+  void countTouchedSynapses_(std::vector<SynapseIdx> &counts,
+                             const std::vector<SynapseIdx> &zeroCounts,
+                             const bool connected,
+                             const std::vector<CellIdx> &activePresynapticCells,
+                             std::vector<Segment> &touchedSegments) const;
+
+  /**
+   * Serial kernel of countActiveSynapses_ for the active cells [begin, end),
+   * using whichever presynaptic index layout is in use.
+   */
+  void countActiveSynapsesRange_(SynapseIdx *counts,
+                                 const bool connected,
+                                 const CellIdx *begin,
+                                 const CellIdx *end,
+                                 const SynapseIdx delta) const;
+
 private:
   std::vector<CellData>    cells_;
   std::vector<SegmentData> segments_;
@@ -725,6 +1313,11 @@ private:
   std::unordered_map<CellIdx, std::vector<Segment>, identity> potentialSegmentsForPresynapticCell_;
   std::unordered_map<CellIdx, std::vector<Segment>, identity> connectedSegmentsForPresynapticCell_;
 
+  // Flat layout of the same index, used instead of the maps above if flatIndex_.
+  bool flatIndex_ = false;
+  FlatPresynapticMap potentialPresynapticFlat_;
+  FlatPresynapticMap connectedPresynapticFlat_;
+
   Segment nextSegmentOrdinal_ = 0;
   Synapse nextSynapseOrdinal_ = 0;
 
@@ -738,9 +1331,36 @@ private:
   Synapse prunedSyns_ = 0; //how many synapses have been removed?
   Segment prunedSegs_ = 0;
 
+  // Contiguous (struct-of-arrays) copies of one segment's synapses, used by
+  // adaptSegment & bumpSegment so the permanence updates run over plain
+  // arrays. Scratch space only, reused between calls.
+  std::vector<Synapse>    segmentSynapses_;
+  std::vector<CellIdx>    segmentPresynapticCells_;
+  std::vector<Permanence> segmentPermanences_;
+  std::vector<Permanence> segmentUpdates_;
+  std::vector<Permanence> segmentAdapted_;
+
+  //for automatic compact()
+  Real compactionThreshold_ = 0.0f;
+
+  //for multi-threaded computeActivity and adaptSegments
+  ThreadPool threads_;
+  std::vector<std::vector<SynapseIdx>> activityShards_;
+  struct AdaptScratch {
+    std::vector<Permanence> permanences;
+    std::vector<Permanence> updates;
+    std::vector<Permanence> adapted;
+    std::vector<std::pair<Synapse, Permanence>> crossings; //connected status changes, or pruned
+    std::vector<bool> pruned;        //per crossing, destroy the synapse
+    std::vector<size_t> segmentEnds; //per segment, end of its crossings
+  };
+  std::vector<AdaptScratch> adaptScratch_;
+
   //for listeners
   UInt32 nextEventToken_;
   std::map<UInt32, ConnectionsEventHandler *> eventHandlers_;
+  std::map<UInt32, ConnectionsEventHandler *> bufferedEventHandlers_;
+  std::vector<ConnectionsEvent> eventBuffer_;
 }; // end class Connections
 
 } // end namespace htm
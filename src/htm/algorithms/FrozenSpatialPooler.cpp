@@ -0,0 +1,159 @@
+/* ---------------------------------------------------------------------
+ * HTM Community Edition of NuPIC
+ * Copyright (C) 2019, The HTM Community
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ * --------------------------------------------------------------------- */
+
+/** @file
+ * Implementation of the FrozenSpatialPooler
+ */
+
+#include <algorithm>
+
+#include <htm/algorithms/FrozenSpatialPooler.hpp>
+#include <htm/utils/BoxFilter.hpp>
+#include <htm/utils/Log.hpp>
+
+using std::vector;
+
+namespace htm {
+
+FrozenSpatialPooler::FrozenSpatialPooler()
+    : numInputs_(0u), numColumns_(0u), globalInhibition_(true),
+      localAreaDensity_(0.0f), stimulusThreshold_(0.0f), inhibitionRadius_(0u),
+      wrapAround_(false) {}
+
+
+FrozenSpatialPooler::FrozenSpatialPooler(const SpatialPooler &sp)
+    : inputDimensions_(sp.getInputDimensions()),
+      columnDimensions_(sp.getColumnDimensions()),
+      localAreaDensity_(sp.getLocalAreaDensity()),
+      stimulusThreshold_((Real)sp.getStimulusThreshold()),
+      inhibitionRadius_(sp.getInhibitionRadius()),
+      wrapAround_(sp.getWrapAround()) {
+  // Same choice as SpatialPooler::inhibitColumns_
+  globalInhibition_ = sp.getGlobalInhibition() ||
+      inhibitionRadius_ > *std::max_element(columnDimensions_.begin(), columnDimensions_.end());
+
+  const UInt numInputs  = sp.getNumInputs();
+  const UInt numColumns = sp.getNumColumns();
+  if (sp.getBoostStrength() >= htm::Epsilon) {
+    boostFactors_.resize(numColumns);
+    sp.getBoostFactors(boostFactors_.data());
+  }
+
+  // Counting sort of the connected synapses by their input bit. Each column
+  // has a single segment, with the same index.
+  const Connections &connections = sp.connections;
+  const Permanence connectedThreshold = connections.getConnectedThreshold();
+  inputStart_.assign(numInputs + 1u, 0u);
+  for (UInt column = 0; column < numColumns; column++) {
+    for (const auto synapse : connections.synapsesForSegment((Segment)column)) {
+      const auto &synapseData = connections.dataForSynapse(synapse);
+      if (synapseData.permanence >= connectedThreshold) {
+        inputStart_[synapseData.presynapticCell + 1u]++;
+      }
+    }
+  }
+  for (UInt input = 0; input < numInputs; input++) {
+    inputStart_[input + 1u] += inputStart_[input];
+  }
+  connectedColumns_.resize(inputStart_[numInputs]);
+  vector<UInt> next(inputStart_.begin(), inputStart_.end() - 1);
+  for (UInt column = 0; column < numColumns; column++) {
+    for (const auto synapse : connections.synapsesForSegment((Segment)column)) {
+      const auto &synapseData = connections.dataForSynapse(synapse);
+      if (synapseData.permanence >= connectedThreshold) {
+        connectedColumns_[next[synapseData.presynapticCell]++] = column;
+      }
+    }
+  }
+
+  initialize_();
+}
+
+
+void FrozenSpatialPooler::initialize_() {
+  numInputs_ = 1u;
+  for (const auto dim : inputDimensions_) {
+    numInputs_ *= dim;
+  }
+  numColumns_ = 1u;
+  for (const auto dim : columnDimensions_) {
+    numColumns_ *= dim;
+  }
+  NTA_CHECK(inputStart_.size() == numInputs_ + 1u && inputStart_.back() == connectedColumns_.size())
+      << "FrozenSpatialPooler: inconsistent connected synapses.";
+  NTA_CHECK(boostFactors_.empty() || boostFactors_.size() == numColumns_)
+      << "FrozenSpatialPooler: expected " << numColumns_ << " boost factors, got "
+      << boostFactors_.size();
+}
+
+
+void FrozenSpatialPooler::computeOverlaps(const SDR &input, vector<SynapseIdx> &overlaps) const {
+  NTA_CHECK(input.size == numInputs_)
+      << "FrozenSpatialPooler: expected " << numInputs_ << " inputs, got " << input.size;
+  overlaps.assign(numColumns_, 0);
+  for (const auto bit : input.getSparse()) {
+    const auto end = connectedColumns_.cbegin() + inputStart_[bit + 1u];
+    for (auto column = connectedColumns_.cbegin() + inputStart_[bit]; column != end; ++column) {
+      overlaps[*column]++;
+    }
+  }
+}
+
+
+void FrozenSpatialPooler::compute(const SDR &input, SDR &active) const {
+  active.reshape(columnDimensions_);
+  vector<SynapseIdx> overlaps;
+  computeOverlaps(input, overlaps);
+
+  vector<Real> boostedOverlaps(overlaps.begin(), overlaps.end());
+  if (!boostFactors_.empty()) {
+    for (UInt i = 0; i < numColumns_; i++) {
+      boostedOverlaps[i] = overlaps[i] * boostFactors_[i];
+    }
+  }
+
+  auto &activeVector = active.getSparse();
+  if (globalInhibition_) {
+    const UInt numDesired = (UInt)(localAreaDensity_ * numColumns_);
+    NTA_CHECK(numDesired > 0) << "Not enough columns (" << numColumns_ << ") "
+                              << "for desired density (" << localAreaDensity_ << ").";
+    SpatialPooler::inhibitColumnsGlobalSorted_(boostedOverlaps, numDesired, stimulusThreshold_,
+                                               activeVector);
+  } else {
+    const BoxFilter box(columnDimensions_, inhibitionRadius_, wrapAround_);
+    SpatialPooler::inhibitColumnsLocalBoxed_(box, boostedOverlaps, localAreaDensity_,
+                                             stimulusThreshold_, activeVector);
+  }
+  std::sort(activeVector.begin(), activeVector.end());
+  active.setSparse(activeVector);
+}
+
+
+bool FrozenSpatialPooler::operator==(const FrozenSpatialPooler &other) const {
+  return inputDimensions_   == other.inputDimensions_ &&
+         columnDimensions_  == other.columnDimensions_ &&
+         globalInhibition_  == other.globalInhibition_ &&
+         localAreaDensity_  == other.localAreaDensity_ &&
+         stimulusThreshold_ == other.stimulusThreshold_ &&
+         inhibitionRadius_  == other.inhibitionRadius_ &&
+         wrapAround_        == other.wrapAround_ &&
+         boostFactors_      == other.boostFactors_ &&
+         inputStart_        == other.inputStart_ &&
+         connectedColumns_  == other.connectedColumns_;
+}
+
+} // end namespace htm
@@ -0,0 +1,151 @@
+/* ---------------------------------------------------------------------
+ * HTM Community Edition of NuPIC
+ * Copyright (C) 2019, The HTM Community
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ * --------------------------------------------------------------------- */
+
+/** @file
+ * Definitions for the FrozenSpatialPooler, an inference only SpatialPooler.
+ */
+
+#ifndef NTA_FROZEN_SPATIAL_POOLER_HPP
+#define NTA_FROZEN_SPATIAL_POOLER_HPP
+
+#include <vector>
+
+#include <htm/algorithms/SpatialPooler.hpp>
+#include <htm/types/Types.hpp>
+#include <htm/types/Sdr.hpp>
+#include <htm/types/Serializable.hpp>
+
+namespace htm {
+
+/**
+ * A trained SpatialPooler, compiled for inference.
+ *
+ * Computes the same active columns as SpatialPooler::compute(input, false,
+ * active) did at the time of freezing, from a read-only copy of the connected
+ * synapses: for each input bit, the columns it is connected to (compressed
+ * sparse rows). The boost factors are copied, the potential pools,
+ * permanences and duty cycles are not, so the serialized FrozenSpatialPooler
+ * is much smaller than the SpatialPooler.
+ *
+ * compute() is const and does not modify any member, so a single
+ * FrozenSpatialPooler can be used from several threads at once. It only reads
+ * the sparse indices of the input (see SDR::getSparse), an input SDR can be
+ * shared by several threads too once they are up to date.
+ *
+ * Local inhibition uses the box filter engine of the SpatialPooler (see
+ * SpatialPooler::setBoxFilterInhibition), which selects the same columns.
+ *
+ * Example Usage:
+ *    SpatialPooler sp(inputDimensions, columnDimensions);
+ *    for(...) sp.compute(input, true, active); //train
+ *    FrozenSpatialPooler frozen(sp);
+ *    frozen.compute(input, active);
+ */
+class FrozenSpatialPooler : public Serializable
+{
+public:
+  /**
+   * For use when deserializing.
+   */
+  FrozenSpatialPooler();
+
+  /**
+   * Compiles the current state of the SpatialPooler. Later changes to the
+   * SpatialPooler do not affect the FrozenSpatialPooler.
+   */
+  explicit FrozenSpatialPooler(const SpatialPooler &sp);
+
+  /**
+   * Computes the active columns for the input, as
+   * SpatialPooler::compute(input, false, active).
+   *
+   * @param input: SDR with the dimensions of the inputs.
+   * @param active: SDR with the dimensions of the columns, receives the
+   *                active columns.
+   */
+  void compute(const SDR &input, SDR &active) const;
+
+  /**
+   * Computes the overlap of each column with the input, the number of its
+   * connected synapses to active input bits.
+   */
+  void computeOverlaps(const SDR &input, std::vector<SynapseIdx> &overlaps) const;
+
+  const std::vector<UInt> &getInputDimensions() const { return inputDimensions_; }
+  const std::vector<UInt> &getColumnDimensions() const { return columnDimensions_; }
+  UInt getNumInputs() const { return numInputs_; }
+  UInt getNumColumns() const { return numColumns_; }
+
+  /**
+   * @returns the number of connected synapses, over all columns.
+   */
+  size_t getNumConnectedSynapses() const { return connectedColumns_.size(); }
+
+  bool operator==(const FrozenSpatialPooler &other) const;
+  inline bool operator!=(const FrozenSpatialPooler &other) const { return !operator==(other); }
+
+  CerealAdapter;
+  template<class Archive>
+  void save_ar(Archive & ar) const
+  {
+    ar(cereal::make_nvp("inputDimensions",   inputDimensions_),
+       cereal::make_nvp("columnDimensions",  columnDimensions_),
+       cereal::make_nvp("globalInhibition",  globalInhibition_),
+       cereal::make_nvp("localAreaDensity",  localAreaDensity_),
+       cereal::make_nvp("stimulusThreshold", stimulusThreshold_),
+       cereal::make_nvp("inhibitionRadius",  inhibitionRadius_),
+       cereal::make_nvp("wrapAround",        wrapAround_),
+       cereal::make_nvp("boostFactors",      boostFactors_),
+       cereal::make_nvp("inputStart",        inputStart_),
+       cereal::make_nvp("connectedColumns",  connectedColumns_));
+  }
+
+  template<class Archive>
+  void load_ar(Archive & ar)
+  {
+    ar(inputDimensions_, columnDimensions_, globalInhibition_, localAreaDensity_,
+       stimulusThreshold_, inhibitionRadius_, wrapAround_, boostFactors_,
+       inputStart_, connectedColumns_);
+    initialize_();
+  }
+
+private:
+  // Derives numInputs_, numColumns_ and checks the sizes.
+  void initialize_();
+
+  std::vector<UInt> inputDimensions_;
+  std::vector<UInt> columnDimensions_;
+  UInt numInputs_;
+  UInt numColumns_;
+
+  bool globalInhibition_;  //global inhibition, or an inhibition radius spanning all columns
+  Real localAreaDensity_;
+  Real stimulusThreshold_;
+  UInt inhibitionRadius_;
+  bool wrapAround_;
+
+  // One per column, empty when boosting is disabled.
+  std::vector<Real> boostFactors_;
+
+  // The connected synapses of input bit i lead to the columns
+  // connectedColumns_[inputStart_[i] .. inputStart_[i + 1]).
+  std::vector<UInt> inputStart_;
+  std::vector<CellIdx> connectedColumns_;
+};
+
+} // end namespace htm
+#endif // NTA_FROZEN_SPATIAL_POOLER_HPP
@@ -25,12 +25,47 @@
 #include <cmath> //fmod
 
 #include <htm/algorithms/SpatialPooler.hpp>
+#include <htm/utils/BoxFilter.hpp>
 #include <htm/utils/Topology.hpp>
 #include <htm/utils/VectorHelpers.hpp>
 
 using namespace std;
 using namespace htm;
 
+namespace {
+// Orders the columns by decreasing overlap, and equal overlaps by decreasing
+// index for determinism.
+struct ByOverlap {
+  const vector<Real> &overlaps;
+  bool operator()(const UInt a, const UInt b) const {
+    return (overlaps[a] == overlaps[b]) ? a > b : overlaps[a] > overlaps[b];
+  }
+};
+
+// Keeps the numDesired best of the candidate columns, sorted, without those
+// below the stimulusThreshold.
+void selectWinners(const vector<Real> &overlaps, const UInt numDesired,
+                   const Real stimulusThreshold, vector<UInt> &columns) {
+  const ByOverlap compare{overlaps};
+  // Do a partial sort to divide the winners from the losers.  This sort is
+  // faster than a regular sort because it stops after it partitions the
+  // elements about the Nth element, with all elements on their correct side of
+  // the Nth element.
+  if (columns.size() > numDesired) {
+    std::nth_element(columns.begin(), columns.begin() + numDesired, columns.end(), compare);
+    // Remove the columns which lost the competition.
+    columns.resize(numDesired);
+  }
+  // Finish sorting the winner columns by their overlap.
+  std::sort(columns.begin(), columns.end(), compare);
+  // Remove sub-threshold winners
+  while( !columns.empty() &&
+         overlaps[columns.back()] < stimulusThreshold)
+      columns.pop_back();
+}
+} // end anonymous namespace
+
+
 class CoordinateConverterND {
 
 public:
@@ -189,6 +224,49 @@ bool SpatialPooler::getWrapAround() const { return wrapAround_; }
 
 void SpatialPooler::setWrapAround(bool wrapAround) { wrapAround_ = wrapAround; }
 
+bool SpatialPooler::getBoxFilterInhibition() const { return boxFilterInhibition_; }
+
+void SpatialPooler::setBoxFilterInhibition(bool boxFilters) { boxFilterInhibition_ = boxFilters; }
+
+size_t SpatialPooler::getNeighborhoodTableLimit() const {
+  return neighborhoodTableLimit_ == DEFAULT_NEIGHBORHOOD_TABLE
+       ? std::max<size_t>(connections_.numSynapses(), 1024u * (size_t)numColumns_)
+       : neighborhoodTableLimit_;
+}
+
+void SpatialPooler::setNeighborhoodTableLimit(size_t entries) {
+  neighborhoodTableLimit_ = entries;
+  // Rebuilt, or released, on the next use.
+  neighborhoodRadius_ = std::numeric_limits<UInt>::max();
+  vector<UInt>().swap(neighborhoodStart_);
+  vector<UInt>().swap(neighborhoodColumns_);
+}
+
+bool SpatialPooler::getCountingInhibition() const { return countingInhibition_; }
+
+void SpatialPooler::setCountingInhibition(bool counting) { countingInhibition_ = counting; }
+
+bool SpatialPooler::getLazyDutyCycles() const { return lazyDutyCycles_; }
+
+void SpatialPooler::setLazyDutyCycles(bool lazy) {
+  normalizeDutyCycles_();
+  lazyDutyCycles_ = lazy;
+}
+
+bool SpatialPooler::getIncrementalOverlaps() const { return incrementalOverlaps_; }
+
+void SpatialPooler::setIncrementalOverlaps(bool incremental) {
+  incrementalOverlaps_ = incremental;
+  overlapsValid_ = false;
+}
+
+UInt SpatialPooler::getNumThreads() const { return threads_.size(); }
+
+void SpatialPooler::setNumThreads(UInt numThreads) {
+  threads_.resize(numThreads);
+  connections_.setNumThreads(numThreads);
+}
+
 UInt SpatialPooler::getUpdatePeriod() const { return updatePeriod_; }
 
 void SpatialPooler::setUpdatePeriod(UInt updatePeriod) {
@@ -237,27 +315,40 @@ void SpatialPooler::setMinPctOverlapDutyCycles(Real minPctOverlapDutyCycles) {
 }
 
 void SpatialPooler::getBoostFactors(Real boostFactors[]) const { //TODO make vector
+  if (boostFactorsStale_) { //lazy duty cycles
+    vector<Real> eagerBoostFactors, overlapDutyCycles, activeDutyCycles;
+    getEagerDutyCycles_(eagerBoostFactors, overlapDutyCycles, activeDutyCycles);
+    copy(eagerBoostFactors.begin(), eagerBoostFactors.end(), boostFactors);
+    return;
+  }
   copy(boostFactors_.begin(), boostFactors_.end(), boostFactors);
 }
 
 void SpatialPooler::setBoostFactors(Real boostFactors[]) {
   boostFactors_.assign(&boostFactors[0], &boostFactors[numColumns_]);
+  boostFactorsStale_ = false;
 }
 
 void SpatialPooler::getOverlapDutyCycles(Real overlapDutyCycles[]) const {
-  copy(overlapDutyCycles_.begin(), overlapDutyCycles_.end(), overlapDutyCycles);
+  for (UInt i = 0; i < numColumns_; i++) {
+    overlapDutyCycles[i] = (Real)(overlapDutyCycles_[i] * dutyCycleScale_);
+  }
 }
 
 void SpatialPooler::setOverlapDutyCycles(const Real overlapDutyCycles[]) {
+  normalizeDutyCycles_();
   overlapDutyCycles_.assign(&overlapDutyCycles[0],
                             &overlapDutyCycles[numColumns_]);
 }
 
 void SpatialPooler::getActiveDutyCycles(Real activeDutyCycles[]) const {
-  copy(activeDutyCycles_.begin(), activeDutyCycles_.end(), activeDutyCycles);
+  for (UInt i = 0; i < numColumns_; i++) {
+    activeDutyCycles[i] = (Real)(activeDutyCycles_[i] * dutyCycleScale_);
+  }
 }
 
 void SpatialPooler::setActiveDutyCycles(const Real activeDutyCycles[]) {
+  normalizeDutyCycles_();
   activeDutyCycles_.assign(&activeDutyCycles[0],
                            &activeDutyCycles[numColumns_]);
 }
@@ -285,6 +376,8 @@ void SpatialPooler::getPotential(UInt column, UInt potential[]) const {
 void SpatialPooler::setPotential(UInt column, const UInt potential[]) {
   NTA_ASSERT(column < numColumns_);
 
+  overlapsValid_ = false;
+
   // Remove all existing synapses.
   const auto &synapses = connections_.synapsesForSegment( column );
   while( synapses.size() > 0 )
@@ -293,10 +386,15 @@ void SpatialPooler::setPotential(UInt column, const UInt potential[]) {
   // Replace with new synapse.
   vector<UInt> potentialDenseVec( potential, potential + numInputs_ );
   const auto &perm = initPermanence_( potentialDenseVec, initConnectedPct_ );
+  vector<CellIdx> presynapticCells;
+  vector<Permanence> permanences;
   for(UInt i = 0; i < numInputs_; i++) {
-    if( potential[i] )
-      connections_.createSynapse( column, i, perm[i] );
+    if( potential[i] ) {
+      presynapticCells.push_back( i );
+      permanences.push_back( perm[i] );
+    }
   }
+  connections_.createSynapses( column, presynapticCells, permanences );
 }
 
 void SpatialPooler::getPermanence(UInt column, Real permanences[]) const {
@@ -318,6 +416,7 @@ void SpatialPooler::setPermanence(UInt column, const Real permanences[]) {
   // processed check that all permanences are zeroed.
   vector<Real> check_data(permanences, permanences + numInputs_);
 #endif
+  overlapsValid_ = false;
 
   const auto synapses = connections_.synapsesForSegment( column );
   for(const auto &syn : synapses) {
@@ -432,21 +531,21 @@ void SpatialPooler::initialize(
   boostFactors_.assign(numColumns_, 1.0); //1 is neutral value for boosting
   overlaps_.resize(numColumns_);
   boostedOverlaps_.resize(numColumns_);
+  overlapsValid_ = false;
 
   inhibitionRadius_ = 0;
 
+  // Same potential pools and permanences as initMapPotential_ and
+  // initPermanence_, without their dense vectors.
+  const Topology_t topology = DefaultTopology(potentialPct_, (Real)potentialRadius_, wrapAround_);
   connections_.initialize(numColumns_, synPermConnected_);
-  for (Size i = 0; i < numColumns_; ++i) {
+  SDR cell(columnDimensions_);
+  vector<CellIdx> presynapticCells;
+  vector<Permanence> permanences;
+  for (UInt i = 0; i < numColumns_; ++i) {
     connections_.createSegment( (CellIdx)i , 1 /* max segments per cell is fixed for SP to 1 */);
-
-    // Note: initMapPotential_ & initPermanence_ return dense arrays.
-    vector<UInt> potential = initMapPotential_((UInt)i, wrapAround_);
-    vector<Real> perm = initPermanence_(potential, initConnectedPct_);
-    for(UInt presyn = 0; presyn < numInputs_; presyn++) {
-      if( potential[presyn] )
-        connections_.createSynapse( (Segment)i, presyn, perm[presyn] );
-    }
-
+    initPotentialPool_(i, topology, rng_, cell, presynapticCells, permanences);
+    connections_.createSynapses( (Segment)i, presynapticCells, permanences );
     connections_.raisePermanencesToThreshold( (Segment)i, stimulusThreshold_ );
   }
 
@@ -463,8 +562,17 @@ void SpatialPooler::compute(const SDR &input, const bool learn, SDR &active) {
   input.reshape(  inputDimensions_ );
   active.reshape( columnDimensions_ );
   updateBookeepingVars_(learn);
-  calculateOverlap_(input, overlaps_, learn);
+  if (incrementalOverlaps_) {
+    calculateOverlapIncremental_(input, learn);
+  } else {
+    calculateOverlap_(input, overlaps_, learn);
+  }
 
+  if (!learn && boostFactorsStale_) {
+    // The factors stay as they are until the next learning step, compute
+    // them once instead of from the duty cycles on every inference.
+    normalizeDutyCycles_();
+  }
   boostOverlaps_(overlaps_, boostedOverlaps_);
 
   auto &activeVector = active.getSparse();
@@ -479,6 +587,11 @@ void SpatialPooler::compute(const SDR &input, const bool learn, SDR &active) {
     adaptSynapses_(input, active);
     updateDutyCycles_(overlaps_, active);
     bumpUpWeakColumns_();
+    if (incrementalOverlaps_) {
+      // Learning connects and disconnects synapses, the overlaps kept for the
+      // next step must follow. overlaps_ are used by updateDutyCycles_ as is.
+      recordLearnedOverlaps_(input, active);
+    }
     updateBoostFactors_();
     if (isUpdateRound_()) {
       updateInhibitionRadius_();
@@ -488,13 +601,108 @@ void SpatialPooler::compute(const SDR &input, const bool learn, SDR &active) {
 }
 
 
+void SpatialPooler::computeBatch(const vector<SDR> &inputs, vector<SDR> &outputs) {
+  const UInt numInputs = (UInt)inputs.size();
+  outputs.erase(outputs.begin() + std::min<size_t>(outputs.size(), numInputs), outputs.end());
+  while (outputs.size() < numInputs) {
+    outputs.emplace_back(columnDimensions_);
+  }
+  for (UInt i = 0; i < numInputs; i++) {
+    inputs[i].reshape(inputDimensions_);
+    outputs[i].reshape(columnDimensions_);
+    inputs[i].getSparse(); //converts the inputs before the threads share them
+  }
+  if (numInputs == 0u) {
+    return;
+  }
+  normalizeDutyCycles_(); //the threads share the boost factors
+
+  const bool global = globalInhibition_ ||
+      inhibitionRadius_ > *max_element(columnDimensions_.begin(), columnDimensions_.end());
+  const UInt numDesired = (UInt)(localAreaDensity_ * numColumns_);
+  NTA_CHECK(!global || numDesired > 0) << "Not enough columns (" << numColumns_ << ") "
+                                       << "for desired density (" << localAreaDensity_ << ").";
+  const BoxFilter box(columnDimensions_, inhibitionRadius_, wrapAround_);
+  const bool boost = boostStrength_ >= htm::Epsilon;
+
+  // Each worker computes whole tiles, with its own buffers.
+  const UInt numTiles   = (numInputs + BATCH_TILE - 1u) / BATCH_TILE;
+  const UInt numWorkers = std::max(1u, std::min(threads_.size(), numTiles));
+  threads_.parallelFor(numWorkers, [&](const UInt worker) {
+    vector<vector<CellIdx>> tileInputs;
+    vector<SynapseIdx> counts;
+    vector<SynapseIdx> overlaps;
+    vector<Real> boosted(numColumns_);
+    vector<UInt> active;
+    const auto tiles = workerRange(numTiles, worker, numWorkers);
+    for (UInt tile = (UInt)tiles.first; tile < (UInt)tiles.second; tile++) {
+      const UInt first    = tile * BATCH_TILE;
+      const UInt tileSize = std::min(BATCH_TILE, numInputs - first);
+      tileInputs.resize(tileSize);
+      for (UInt i = 0; i < tileSize; i++) {
+        const auto &sparse = inputs[first + i].getSparse();
+        tileInputs[i].assign(sparse.begin(), sparse.end());
+      }
+      connections_.computeActivityBatch(counts, tileInputs);
+
+      for (UInt i = 0; i < tileSize; i++) {
+        const auto inputCounts = counts.cbegin() + (size_t)i * numColumns_;
+        overlaps.assign(inputCounts, inputCounts + numColumns_);
+        if (boost) {
+          boostOverlapsRange_(overlaps, boosted, 0u, numColumns_);
+        } else {
+          boosted.assign(overlaps.begin(), overlaps.end());
+        }
+        // The engines use the whole vector as scratch, only the winners are
+        // copied to the output.
+        if (global) {
+          inhibitColumnsGlobalSorted_(boosted, numDesired, (Real)stimulusThreshold_, active);
+        } else {
+          inhibitColumnsLocalBoxed_(box, boosted, localAreaDensity_, (Real)stimulusThreshold_, active);
+        }
+        sort(active.begin(), active.end());
+        outputs[first + i].setSparse(active.data(), (UInt)active.size());
+
+        if (first + i == numInputs - 1u) { //as after compute() of the last input
+          overlaps_        = overlaps;
+          boostedOverlaps_ = boosted;
+        }
+      }
+    }
+  });
+
+  iterationNum_ += numInputs;
+  overlapsValid_ = false;
+}
+
+
 void SpatialPooler::boostOverlaps_(const vector<SynapseIdx> &overlaps, //TODO use Eigen sparse vector here
                                    vector<Real> &boosted) const {
   if(boostStrength_ < htm::Epsilon) { //boost ~ 0.0, we can skip these computations, just copy the data
     boosted.assign(overlaps.begin(), overlaps.end());
     return;
   }
-  for (UInt i = 0; i < numColumns_; i++) {
+  forEachColumnRange_(boostFactorsStale_ ? 1024u : 16384u, [&](const UInt begin, const UInt end) {
+    boostOverlapsRange_(overlaps, boosted, begin, end);
+  });
+}
+
+
+void SpatialPooler::boostOverlapsRange_(const vector<SynapseIdx> &overlaps,
+                                        vector<Real> &boosted,
+                                        const UInt begin, const UInt end) const {
+  if (boostFactorsStale_) { //lazy duty cycles, compute the boost factors in use
+    for (UInt i = begin; i < end; i++) {
+      if (overlaps[i] == 0) {
+        boosted[i] = 0.0f;
+        continue;
+      }
+      const Real activeDutyCycle = (Real)(activeDutyCycles_[i] * dutyCycleScale_);
+      boosted[i] = overlaps[i] * exp((localAreaDensity_ - activeDutyCycle) * boostStrength_);
+    }
+    return;
+  }
+  for (UInt i = begin; i < end; i++) {
     boosted[i] = overlaps[i] * boostFactors_[i];
   }
 }
@@ -571,6 +779,60 @@ vector<Real> SpatialPooler::initPermanence_(const vector<UInt> &potential, //TOD
 }
 
 
+void SpatialPooler::initPotentialPool_(const UInt column, const Topology_t &topology,
+                                       Random &rng, SDR &cell,
+                                       vector<CellIdx> &presynaptic,
+                                       vector<Permanence> &permanences) const {
+  NTA_ASSERT(column < numColumns_);
+  cell.setSparse(vector<UInt>{column});
+  const SDR potential = topology(cell, inputDimensions_, rng);
+  NTA_CHECK(potential.size == numInputs_)
+      << "Topology returned " << potential.size << " inputs, expected " << numInputs_;
+  const auto &sparse = potential.getSparse();
+  presynaptic.assign(sparse.begin(), sparse.end());
+
+  permanences.clear();
+  for (size_t i = 0; i < presynaptic.size(); i++) {
+    if (rng.getReal64() <= initConnectedPct_) {
+      permanences.push_back(rng.realRange(synPermConnected_, maxPermanence));
+    } else {
+      permanences.push_back(rng.realRange(minPermanence, synPermConnected_));
+    }
+  }
+}
+
+
+void SpatialPooler::initializeSynapses(const Topology_t &topology) {
+  // The seeds are drawn in column order, before the columns are split among
+  // the threads.
+  vector<UInt64> seeds(numColumns_);
+  for (auto &seed : seeds) {
+    seed = (UInt64)rng_.getUInt32() + 1u; //0 would be a random seed
+  }
+
+  vector<vector<CellIdx>> presynapticCells(numColumns_);
+  vector<vector<Permanence>> permanences(numColumns_);
+  forEachColumnRange_(64u, [&](const UInt begin, const UInt end) {
+    SDR cell(columnDimensions_);
+    for (UInt column = begin; column < end; column++) {
+      Random rng(seeds[column]);
+      initPotentialPool_(column, topology, rng, cell, presynapticCells[column], permanences[column]);
+    }
+  });
+
+  connections_.initialize(numColumns_, synPermConnected_);
+  for (UInt column = 0; column < numColumns_; column++) {
+    connections_.createSegment( (CellIdx)column, 1 );
+    connections_.createSynapses( (Segment)column, presynapticCells[column], permanences[column] );
+    connections_.raisePermanencesToThreshold( (Segment)column, stimulusThreshold_ );
+    vector<CellIdx>().swap(presynapticCells[column]);
+    vector<Permanence>().swap(permanences[column]);
+  }
+  overlapsValid_ = false;
+  updateInhibitionRadius_();
+}
+
+
 void SpatialPooler::updateInhibitionRadius_() {
   if (globalInhibition_) {
     inhibitionRadius_ =
@@ -591,7 +853,76 @@ void SpatialPooler::updateInhibitionRadius_() {
 }
 
 
+void SpatialPooler::updateNeighborhoods_() const {
+  if (neighborhoodRadius_ == inhibitionRadius_ &&
+      neighborhoodWrap_ == wrapAround_ &&
+      neighborhoodDimensions_ == columnDimensions_) {
+    return;
+  }
+  neighborhoodRadius_     = inhibitionRadius_;
+  neighborhoodWrap_       = wrapAround_;
+  neighborhoodDimensions_ = columnDimensions_;
+  neighborhoodStart_.clear();
+  neighborhoodColumns_.clear();
+
+  // Upper bound of the table size, the neighborhoods are clipped at the borders.
+  size_t perColumn = 1u;
+  for (const auto dim : columnDimensions_) {
+    perColumn *= std::min<size_t>(2u * (size_t)inhibitionRadius_ + 1u, dim);
+  }
+  if (perColumn * numColumns_ > getNeighborhoodTableLimit()) {
+    return; //too large, forEachNeighbor_ walks the neighborhoods instead
+  }
+
+  neighborhoodStart_.reserve(numColumns_ + 1u);
+  neighborhoodColumns_.reserve(perColumn * numColumns_);
+  neighborhoodStart_.push_back(0u);
+  for (UInt column = 0; column < numColumns_; column++) {
+    if (wrapAround_) {
+      for (const auto neighbor : WrappingNeighborhood(column, inhibitionRadius_, columnDimensions_)) {
+        neighborhoodColumns_.push_back(neighbor);
+      }
+    } else {
+      for (const auto neighbor : Neighborhood(column, inhibitionRadius_, columnDimensions_)) {
+        neighborhoodColumns_.push_back(neighbor);
+      }
+    }
+    neighborhoodStart_.push_back((UInt)neighborhoodColumns_.size());
+  }
+}
+
+
+template<typename Visitor>
+void SpatialPooler::forEachNeighbor_(const UInt column, Visitor visit) const {
+  if (!neighborhoodStart_.empty()) {
+    const UInt end = neighborhoodStart_[column + 1u];
+    for (UInt i = neighborhoodStart_[column]; i < end; i++) {
+      visit(neighborhoodColumns_[i]);
+    }
+  } else if (wrapAround_) {
+    for (const auto neighbor : WrappingNeighborhood(column, inhibitionRadius_, columnDimensions_)) {
+      visit(neighbor);
+    }
+  } else {
+    for (const auto neighbor : Neighborhood(column, inhibitionRadius_, columnDimensions_)) {
+      visit(neighbor);
+    }
+  }
+}
+
+
+template<typename Task>
+void SpatialPooler::forEachColumnRange_(const UInt minColumns, Task task) const {
+  const UInt numWorkers = std::max(1u, std::min(threads_.size(), numColumns_ / minColumns));
+  threads_.parallelFor(numWorkers, [&](const UInt worker) {
+    const auto range = workerRange(numColumns_, worker, numWorkers);
+    task((UInt)range.first, (UInt)range.second);
+  });
+}
+
+
 void SpatialPooler::updateMinDutyCycles_() {
+  normalizeDutyCycles_();
   if (globalInhibition_ ||
       inhibitionRadius_ >=
           *max_element(columnDimensions_.begin(), columnDimensions_.end())) {
@@ -612,29 +943,38 @@ void SpatialPooler::updateMinDutyCyclesGlobal_() {
 
 
 void SpatialPooler::updateMinDutyCyclesLocal_() {
-  for (UInt i = 0; i < numColumns_; i++) {
-    Real maxActiveDuty = 0.0f;
-    Real maxOverlapDuty = 0.0f;
-    if (wrapAround_) {
-     for(auto column : WrappingNeighborhood(i, inhibitionRadius_, columnDimensions_)) {
-      maxActiveDuty = max(maxActiveDuty, activeDutyCycles_[column]);
-      maxOverlapDuty = max(maxOverlapDuty, overlapDutyCycles_[column]);
-     }
-    } else {
-     for(auto column: Neighborhood(i, inhibitionRadius_, columnDimensions_)) {
-      maxActiveDuty = max(maxActiveDuty, activeDutyCycles_[column]);
-      maxOverlapDuty = max(maxOverlapDuty, overlapDutyCycles_[column]);
-      }
+  if (boxFilterInhibition_) {
+    const BoxFilter box(columnDimensions_, inhibitionRadius_, wrapAround_);
+    box.max(overlapDutyCycles_, minOverlapDutyCycles_);
+    for (auto &duty : minOverlapDutyCycles_) {
+      duty *= minPctOverlapDutyCycles_;
     }
-
-    minOverlapDutyCycles_[i] = maxOverlapDuty * minPctOverlapDutyCycles_;
+    return;
   }
+
+  updateNeighborhoods_();
+  forEachColumnRange_(64u, [&](const UInt begin, const UInt end) {
+    for (UInt i = begin; i < end; i++) {
+      Real maxOverlapDuty = 0.0f;
+      forEachNeighbor_(i, [&](const UInt column) {
+        maxOverlapDuty = max(maxOverlapDuty, overlapDutyCycles_[column]);
+      });
+
+      minOverlapDutyCycles_[i] = maxOverlapDuty * minPctOverlapDutyCycles_;
+    }
+  });
 }
 
 
 void SpatialPooler::updateDutyCycles_(const vector<SynapseIdx> &overlaps,
                                       SDR &active) {
 
+  const UInt period = std::min(dutyCyclePeriod_, iterationNum_);
+  if (lazyDutyCycles_) {
+    updateDutyCyclesLazy_(overlaps, active, period);
+    return;
+  }
+
   // Turn the overlaps array into an SDR. Convert directly to flat-sparse to
   // avoid copies and  type convertions.
   SDR newOverlap({ numColumns_ });
@@ -645,8 +985,6 @@ void SpatialPooler::updateDutyCycles_(const vector<SynapseIdx> &overlaps,
   }
   newOverlap.setSparse( overlapsSparseVec );
 
-  const UInt period = std::min(dutyCyclePeriod_, iterationNum_);
-
   updateDutyCyclesHelper_(overlapDutyCycles_, newOverlap, period);
   updateDutyCyclesHelper_(activeDutyCycles_, active, period);
 }
@@ -669,20 +1007,18 @@ Real SpatialPooler::avgConnectedSpanForColumnND_(UInt column) const {
 
   const UInt numDimensions = (UInt)inputDimensions_.size();
 
-  vector<UInt> connectedDense( numInputs_, 0 );
-  getConnectedSynapses( column, connectedDense.data() );
-
   vector<UInt> maxCoord(numDimensions, 0);
   vector<UInt> minCoord(numDimensions, *max_element(inputDimensions_.begin(),
                                                     inputDimensions_.end()));
   const CoordinateConverterND conv(inputDimensions_);
   bool all_zero = true;
-  for(UInt i = 0; i < numInputs_; i++) {
-    if( connectedDense[i] == 0 )
+  vector<UInt> columnCoord;
+  for( const auto &syn : connections_.synapsesForSegment( column ) ) {
+    const auto &synData = connections_.dataForSynapse( syn );
+    if( synData.permanence < synPermConnected_ - htm::Epsilon ) //as getConnectedSynapses
       continue;
     all_zero = false;
-    vector<UInt> columnCoord;
-    conv.toCoord(i, columnCoord);
+    conv.toCoord(synData.presynapticCell, columnCoord);
     for (size_t j = 0; j < columnCoord.size(); j++) {
       maxCoord[j] = max(maxCoord[j], columnCoord[j]); //FIXME this computation may be flawed
       minCoord[j] = min(minCoord[j], columnCoord[j]);
@@ -701,6 +1037,13 @@ Real SpatialPooler::avgConnectedSpanForColumnND_(UInt column) const {
 
 void SpatialPooler::adaptSynapses_(const SDR &input,
                                    const SDR &active) {
+  if (threads_.size() > 1u) {
+    connections_.adaptSegments(active.getSparse(), input, synPermActiveInc_, synPermInactiveDec_);
+    for(const auto &column : active.getSparse()) {
+      connections_.raisePermanencesToThreshold( column, stimulusThreshold_ );
+    }
+    return;
+  }
   for(const auto &column : active.getSparse()) {
     connections_.adaptSegment(column, input, synPermActiveInc_, synPermInactiveDec_);
     connections_.raisePermanencesToThreshold( column, stimulusThreshold_ );
@@ -709,11 +1052,37 @@ void SpatialPooler::adaptSynapses_(const SDR &input,
 
 
 void SpatialPooler::bumpUpWeakColumns_() {
+  const Real scale = (Real)dutyCycleScale_;
+  bumpedColumns_.clear();
   for (UInt i = 0; i < numColumns_; i++) {
-    if (overlapDutyCycles_[i] >= minOverlapDutyCycles_[i]) {
+    if (overlapDutyCycles_[i] * scale >= minOverlapDutyCycles_[i]) {
       continue;
     }
     connections_.bumpSegment( i, synPermBelowStimulusInc_ );
+    bumpedColumns_.push_back(i);
+  }
+}
+
+
+void SpatialPooler::recordLearnedOverlaps_(const SDR &input, const SDR &active) {
+  const auto &dense = input.getDense();
+  const Permanence threshold = connections_.getConnectedThreshold();
+  const auto recount = [&](const UInt column) {
+    SynapseIdx overlap = 0u;
+    for (const auto syn : connections_.synapsesForSegment(column)) {
+      const auto &synData = connections_.dataForSynapse(syn);
+      if (dense[synData.presynapticCell] && synData.permanence >= threshold) {
+        overlap++;
+      }
+    }
+    learnedOverlaps_.emplace_back(column, overlap);
+  };
+  // Only the adapted and the bumped up columns have learned.
+  for (const auto column : active.getSparse()) {
+    recount(column);
+  }
+  for (const auto column : bumpedColumns_) {
+    recount(column);
   }
 }
 
@@ -741,9 +1110,13 @@ void SpatialPooler::updateDutyCyclesHelper_(vector<Real> &dutyCycles,
 
 
 void SpatialPooler::updateBoostFactors_() {
-  if (globalInhibition_) {
+  if (globalInhibition_ && lazyDutyCycles_) {
+    // Computed when used, see boostOverlaps_() and normalizeDutyCycles_()
+    boostFactorsStale_ = boostFactorsStale_ || boostStrength_ >= htm::Epsilon;
+  } else if (globalInhibition_) {
     updateBoostFactorsGlobal_();
   } else {
+    normalizeDutyCycles_();
     updateBoostFactorsLocal_();
   }
 }
@@ -762,31 +1135,99 @@ void applyBoosting_(const UInt i,
 void SpatialPooler::updateBoostFactorsGlobal_() {
   const Real targetDensity = localAreaDensity_;
   
-  for (UInt i = 0; i < numColumns_; ++i) { 
-    applyBoosting_(i, targetDensity, activeDutyCycles_, boostStrength_, boostFactors_);
-  }
+  forEachColumnRange_(1024u, [&](const UInt begin, const UInt end) {
+    for (UInt i = begin; i < end; ++i) {
+      applyBoosting_(i, targetDensity, activeDutyCycles_, boostStrength_, boostFactors_);
+    }
+  });
 }
 
 
 void SpatialPooler::updateBoostFactorsLocal_() {
-  for (UInt i = 0; i < numColumns_; ++i) {
-    UInt numNeighbors = 0u;
-    Real localActivityDensity = 0.0f;
-
-    if (wrapAround_) {
-      for(auto neighbor: WrappingNeighborhood(i, inhibitionRadius_, columnDimensions_)) {
-        localActivityDensity += activeDutyCycles_[neighbor];
-        numNeighbors += 1;
+  if (boxFilterInhibition_) {
+    const BoxFilter box(columnDimensions_, inhibitionRadius_, wrapAround_);
+    vector<Real> localActivity;
+    box.sum(activeDutyCycles_, localActivity);
+    forEachColumnRange_(1024u, [&](const UInt begin, const UInt end) {
+      for (UInt i = begin; i < end; ++i) {
+        const Real targetDensity = localActivity[i] / box.volume(i);
+        applyBoosting_(i, targetDensity, activeDutyCycles_, boostStrength_, boostFactors_);
       }
-    } else {
-      for(auto neighbor: Neighborhood(i, inhibitionRadius_, columnDimensions_)) {
+    });
+    return;
+  }
+
+  updateNeighborhoods_();
+  forEachColumnRange_(64u, [&](const UInt begin, const UInt end) {
+    for (UInt i = begin; i < end; ++i) {
+      UInt numNeighbors = 0u;
+      Real localActivityDensity = 0.0f;
+
+      forEachNeighbor_(i, [&](const UInt neighbor) {
         localActivityDensity += activeDutyCycles_[neighbor];
         numNeighbors += 1;
-      }
+      });
+
+      const Real targetDensity = localActivityDensity / numNeighbors;
+      applyBoosting_(i, targetDensity, activeDutyCycles_, boostStrength_, boostFactors_);
     }
+  });
+}
+
 
-    const Real targetDensity = localActivityDensity / numNeighbors;
-    applyBoosting_(i, targetDensity, activeDutyCycles_, boostStrength_, boostFactors_);
+void SpatialPooler::updateDutyCyclesLazy_(const vector<SynapseIdx> &overlaps,
+                                          const SDR &active,
+                                          const UInt period) {
+  NTA_ASSERT(period > 0);
+  // The stored duty cycles grow as 1 / dutyCycleScale_, apply the decay
+  // before they could overflow (and right away for a period of 1).
+  const Real64 decay = (period - 1) / static_cast<Real64>(period);
+  dutyCycleScale_ *= decay;
+  if (dutyCycleScale_ < 1.0e-30) {
+    normalizeDutyCycles_();
+  }
+
+  const Real increment = (Real)(1.0 / (period * dutyCycleScale_));
+  for (UInt i = 0; i < numColumns_; i++) {
+    if (overlaps[i] != 0) {
+      overlapDutyCycles_[i] += increment;
+    }
+  }
+  for (const auto idx : active.getSparse()) {
+    activeDutyCycles_[idx] += increment;
+  }
+}
+
+
+void SpatialPooler::normalizeDutyCycles_() {
+  if (dutyCycleScale_ != 1.0) {
+    for (auto &duty : overlapDutyCycles_) {
+      duty = (Real)(duty * dutyCycleScale_);
+    }
+    for (auto &duty : activeDutyCycles_) {
+      duty = (Real)(duty * dutyCycleScale_);
+    }
+    dutyCycleScale_ = 1.0;
+  }
+  if (boostFactorsStale_) {
+    updateBoostFactorsGlobal_();
+    boostFactorsStale_ = false;
+  }
+}
+
+
+void SpatialPooler::getEagerDutyCycles_(vector<Real> &boostFactors,
+                                        vector<Real> &overlapDutyCycles,
+                                        vector<Real> &activeDutyCycles) const {
+  overlapDutyCycles.resize(numColumns_);
+  activeDutyCycles.resize(numColumns_);
+  getOverlapDutyCycles(overlapDutyCycles.data());
+  getActiveDutyCycles(activeDutyCycles.data());
+  boostFactors = boostFactors_;
+  if (boostFactorsStale_) {
+    for (UInt i = 0; i < numColumns_; ++i) {
+      applyBoosting_(i, localAreaDensity_, activeDutyCycles, boostStrength_, boostFactors);
+    }
   }
 }
 
@@ -807,6 +1248,42 @@ void SpatialPooler::calculateOverlap_(const SDR &input,
 }
 
 
+void SpatialPooler::calculateOverlapIncremental_(const SDR &input, const bool learn) {
+  const auto &sparse = input.getSparse();
+  currentInput_.assign(sparse.begin(), sparse.end());
+  if (!std::is_sorted(currentInput_.begin(), currentInput_.end())) {
+    std::sort(currentInput_.begin(), currentInput_.end());
+  }
+
+  bool update = overlapsValid_ && overlaps_.size() == numColumns_;
+  if (update) {
+    activatedInputs_.clear();
+    deactivatedInputs_.clear();
+    std::set_difference(currentInput_.begin(), currentInput_.end(),
+                        overlapsInput_.begin(), overlapsInput_.end(),
+                        std::back_inserter(activatedInputs_));
+    std::set_difference(overlapsInput_.begin(), overlapsInput_.end(),
+                        currentInput_.begin(), currentInput_.end(),
+                        std::back_inserter(deactivatedInputs_));
+    // Counting the whole input is cheaper than a larger change.
+    update = activatedInputs_.size() + deactivatedInputs_.size() < currentInput_.size();
+  }
+
+  if (update) {
+    // The overlaps with the previous input of the columns which learned since.
+    for (const auto &learned : learnedOverlaps_) {
+      overlaps_[learned.first] = learned.second;
+    }
+    connections_.updateActivity(overlaps_, activatedInputs_, deactivatedInputs_, learn);
+  } else {
+    calculateOverlap_(input, overlaps_, learn);
+  }
+  learnedOverlaps_.clear();
+  overlapsInput_.swap(currentInput_);
+  overlapsValid_ = true;
+}
+
+
 void SpatialPooler::inhibitColumns_(const vector<Real> &overlaps,
                                     vector<CellIdx> &activeColumns) const {
   const Real density = localAreaDensity_;
@@ -831,29 +1308,130 @@ void SpatialPooler::inhibitColumnsGlobal_(const vector<Real> &overlaps,
   const UInt numDesired = (UInt)(density * numColumns_);
   NTA_CHECK(numDesired > 0) << "Not enough columns (" << numColumns_ << ") "
                             << "for desired density (" << density << ").";
+  if (countingInhibition_) {
+    inhibitColumnsGlobalCounting_(overlaps, numDesired, activeColumns);
+  } else if (threads_.size() > 1u) {
+    inhibitColumnsGlobalParallel_(overlaps, numDesired, activeColumns);
+  } else {
+    inhibitColumnsGlobalSorted_(overlaps, numDesired, (Real)stimulusThreshold_, activeColumns);
+  }
+}
+
+
+void SpatialPooler::inhibitColumnsGlobalSorted_(const vector<Real> &overlaps,
+                                                const UInt numDesired,
+                                                const Real stimulusThreshold,
+                                                vector<UInt> &activeColumns) {
+  const UInt numColumns = (UInt)overlaps.size();
+  NTA_ASSERT(numDesired <= numColumns);
   // Sort the columns by the amount of overlap.  First make a list of all of the
   // column indexes.
-  activeColumns.reserve(numColumns_);
-  for(UInt i = 0; i < numColumns_; i++)
+  activeColumns.clear();
+  activeColumns.reserve(numColumns);
+  for(UInt i = 0; i < numColumns; i++)
     activeColumns.push_back(i);
-  // Compare the column indexes by their overlap.
-  auto compare = [&overlaps](const UInt &a, const UInt &b) -> bool
-    {return (overlaps[a] == overlaps[b]) ? a > b : overlaps[a] > overlaps[b];};  //for determinism if overlaps match (tieBreaker does not solve that),
-  //otherwise we'd return just `return overlaps[a] > overlaps[b]`. 
+  selectWinners(overlaps, numDesired, stimulusThreshold, activeColumns);
+}
+
+
+void SpatialPooler::inhibitColumnsGlobalParallel_(const vector<Real> &overlaps,
+                                                  const UInt numDesired,
+                                                  vector<UInt> &activeColumns) const {
+  const ByOverlap compare{overlaps};
+  const UInt numWorkers = std::max(1u, std::min(threads_.size(), numColumns_ / 2048u));
+  inhibitionCandidates_.resize(numWorkers);
+  threads_.parallelFor(numWorkers, [&](const UInt worker) {
+    auto &candidates = inhibitionCandidates_[worker];
+    const auto range = workerRange(numColumns_, worker, numWorkers);
+    candidates.clear();
+    for (UInt i = (UInt)range.first; i < (UInt)range.second; i++) {
+      candidates.push_back(i);
+    }
+    if (candidates.size() > numDesired) {
+      std::nth_element(candidates.begin(), candidates.begin() + numDesired, candidates.end(), compare);
+      candidates.resize(numDesired);
+    }
+  });
 
-  // Do a partial sort to divide the winners from the losers.  This sort is
-  // faster than a regular sort because it stops after it partitions the
-  // elements about the Nth element, with all elements on their correct side of
-  // the Nth element.
-  std::nth_element(
-    activeColumns.begin(),
-    activeColumns.begin() + numDesired,
-    activeColumns.end(),
-    compare);
-  // Remove the columns which lost the competition.
+  activeColumns.clear();
+  for (UInt worker = 0u; worker < numWorkers; worker++) {
+    const auto &candidates = inhibitionCandidates_[worker];
+    activeColumns.insert(activeColumns.end(), candidates.begin(), candidates.end());
+  }
+  selectWinners(overlaps, numDesired, (Real)stimulusThreshold_, activeColumns);
+}
+
+
+void SpatialPooler::inhibitColumnsGlobalCounting_(const vector<Real> &overlaps,
+                                                  const UInt numDesired,
+                                                  vector<UInt> &activeColumns) const {
+  NTA_ASSERT(overlaps.size() == numColumns_);
+  const UInt numBuckets = numColumns_;
+
+  // Any non-decreasing mapping of the overlaps to the buckets selects the same
+  // winners. Integer overlaps get one bucket per value whenever they fit.
+  Real lo = overlaps[0], hi = overlaps[0];
+  for (const Real overlap : overlaps) {
+    lo = std::min(lo, overlap);
+    hi = std::max(hi, overlap);
+  }
+  const Real top   = (Real)(numBuckets - 1u);
+  const Real range = hi - lo;
+  const Real scale = range <= top ? 1.0f : top / range;
+
+  // Two passes, the first one vectorizes.
+  inhibitionBuckets_.resize(numColumns_);
+  for (UInt i = 0; i < numColumns_; i++) {
+    inhibitionBuckets_[i] = (UInt)std::min(top, (overlaps[i] - lo) * scale);
+  }
+  inhibitionCounts_.assign(numBuckets, 0u);
+  for (const UInt bucket : inhibitionBuckets_) {
+    inhibitionCounts_[bucket]++;
+  }
+
+  // Going down from the top bucket, the boundary bucket is where the
+  // histogram reaches numDesired columns.
+  UInt boundary = numBuckets - 1u;
+  UInt numAbove = 0u;
+  while (numAbove + inhibitionCounts_[boundary] < numDesired) {
+    numAbove += inhibitionCounts_[boundary--];
+  }
+
+  // Counting sort of the columns in the buckets from the top to the boundary.
+  // Columns are placed by decreasing index, which is the order of equal
+  // overlaps, so buckets with a single overlap value are already sorted.
+  UInt offset = 0u;
+  for (UInt bucket = numBuckets; bucket-- > boundary;) {
+    const UInt count = inhibitionCounts_[bucket];
+    inhibitionCounts_[bucket] = offset;
+    offset += count;
+  }
+  activeColumns.resize(offset);
+  for (UInt i = numColumns_; i-- > 0u;) {
+    const UInt bucket = inhibitionBuckets_[i];
+    if (bucket >= boundary) {
+      activeColumns[inhibitionCounts_[bucket]++] = i;
+    }
+  }
+
+  auto compare = [&overlaps](const UInt &a, const UInt &b) -> bool
+    {return (overlaps[a] == overlaps[b]) ? a > b : overlaps[a] > overlaps[b];};
+  const auto winnersEnd = activeColumns.begin() + numDesired;
+  auto first = activeColumns.begin();
+  for (UInt bucket = numBuckets; bucket-- > boundary;) {
+    const auto last = activeColumns.begin() + inhibitionCounts_[bucket];
+    if (!std::is_sorted(first, last, compare)) {
+      if (bucket == boundary) {
+        std::nth_element(first, winnersEnd, last, compare);
+        std::sort(first, winnersEnd, compare);
+      } else {
+        std::sort(first, last, compare);
+      }
+    }
+    first = last;
+  }
   activeColumns.resize(numDesired);
-  // Finish sorting the winner columns by their overlap.
-  std::sort(activeColumns.begin(), activeColumns.end(), compare);
+
   // Remove sub-threshold winners
   while( !activeColumns.empty() &&
          overlaps[activeColumns.back()] < stimulusThreshold_)
@@ -864,12 +1442,22 @@ void SpatialPooler::inhibitColumnsGlobal_(const vector<Real> &overlaps,
 void SpatialPooler::inhibitColumnsLocal_(const vector<Real> &overlaps,
                                          Real density,
                                          vector<UInt> &activeColumns) const {
+  if (boxFilterInhibition_) {
+    const BoxFilter box(columnDimensions_, inhibitionRadius_, wrapAround_);
+    inhibitColumnsLocalBoxed_(box, overlaps, density, (Real)stimulusThreshold_, activeColumns);
+    return;
+  }
+  if (threads_.size() > 1u) {
+    inhibitColumnsLocalParallel_(overlaps, density, activeColumns);
+    return;
+  }
   activeColumns.clear();
 
   // Tie-breaking: when overlaps are equal, columns that have already been
   // selected are treated as "bigger".
   vector<bool> activeColumnsDense(numColumns_, false);
 
+  updateNeighborhoods_();
   for (UInt column = 0; column < numColumns_; column++) {
     if (overlaps[column] < stimulusThreshold_) {
       continue;
@@ -877,44 +1465,144 @@ void SpatialPooler::inhibitColumnsLocal_(const vector<Real> &overlaps,
 
     UInt numNeighbors = 0;
     UInt numBigger = 0;
+    forEachNeighbor_(column, [&](const UInt neighbor) {
+      if (neighbor == column) {
+        return;
+      }
+      numNeighbors++;
+
+      const Real difference = overlaps[neighbor] - overlaps[column];
+      if (difference > 0 || (difference == 0 && activeColumnsDense[neighbor])) {
+        numBigger++;
+      }
+    });
+
+    const UInt numActive = (UInt)(0.5f + (density * (numNeighbors + 1)));
+    if (numBigger < numActive) {
+      activeColumns.push_back(column);
+      activeColumnsDense[column] = true;
+    }
+  }
+}
+
 
+void SpatialPooler::inhibitColumnsLocalParallel_(const vector<Real> &overlaps,
+                                                 const Real density,
+                                                 vector<UInt> &activeColumns) const {
+  // In inhibitColumnsLocal_ a neighbor with an equal overlap counts as bigger
+  // only if it was selected, which can only be the case for a lower index.
+  const Byte INACTIVE = 0, ACTIVE = 1, TIED = 2;
+  inhibitionStates_.resize(numColumns_);
+  inhibitionMargins_.resize(numColumns_);
 
-      if (wrapAround_) {
-        for(auto neighbor: WrappingNeighborhood(column, inhibitionRadius_,columnDimensions_)) { //TODO if we don't change inh radius (changes only every isUpdateRound()),
-		// then these values can be cached -> faster local inh
-          if (neighbor == column) {
-            continue;
-          }
-          numNeighbors++;
+  updateNeighborhoods_();
+  forEachColumnRange_(64u, [&](const UInt begin, const UInt end) {
+    for (UInt column = begin; column < end; column++) {
+      if (overlaps[column] < stimulusThreshold_) {
+        inhibitionStates_[column] = INACTIVE;
+        continue;
+      }
+
+      UInt numNeighbors = 0;
+      UInt numBigger = 0;
+      UInt numTied = 0; //equal overlap, lower index
+      forEachNeighbor_(column, [&](const UInt neighbor) {
+        if (neighbor == column) {
+          return;
+        }
+        numNeighbors++;
+
+        const Real difference = overlaps[neighbor] - overlaps[column];
+        if (difference > 0) {
+          numBigger++;
+        } else if (difference == 0 && neighbor < column) {
+          numTied++;
+        }
+      });
 
-          const Real difference = overlaps[neighbor] - overlaps[column];
-          if (difference > 0 || (difference == 0 && activeColumnsDense[neighbor])) {
-            numBigger++;
-          }
-	}
+      const UInt numActive = (UInt)(0.5f + (density * (numNeighbors + 1)));
+      if (numBigger >= numActive) {
+        inhibitionStates_[column] = INACTIVE;
+      } else if (numBigger + numTied < numActive) {
+        inhibitionStates_[column] = ACTIVE;
       } else {
-        for(auto neighbor: Neighborhood(column, inhibitionRadius_, columnDimensions_)) {
-          if (neighbor == column) {
-            continue;
-          }
-          numNeighbors++;
-
-          const Real difference = overlaps[neighbor] - overlaps[column];
-          if (difference > 0 || (difference == 0 && activeColumnsDense[neighbor])) {
-            numBigger++;
-          }
-	}
+        inhibitionStates_[column]  = TIED;
+        inhibitionMargins_[column] = numActive - numBigger;
       }
+    }
+  });
 
+  // The tied columns depend on the selection of the lower tied neighbors,
+  // which is final when they are visited in order.
+  activeColumns.clear();
+  for (UInt column = 0; column < numColumns_; column++) {
+    if (inhibitionStates_[column] == TIED) {
+      UInt numSelected = 0;
+      forEachNeighbor_(column, [&](const UInt neighbor) {
+        if (neighbor < column && overlaps[neighbor] - overlaps[column] == 0 &&
+            inhibitionStates_[neighbor] == ACTIVE) {
+          numSelected++;
+        }
+      });
+      inhibitionStates_[column] = numSelected < inhibitionMargins_[column] ? ACTIVE : INACTIVE;
+    }
+    if (inhibitionStates_[column] == ACTIVE) {
+      activeColumns.push_back(column);
+    }
+  }
+}
+
+
+void SpatialPooler::inhibitColumnsLocalBoxed_(const BoxFilter &box,
+                                              const vector<Real> &overlaps,
+                                              const Real density,
+                                              const Real stimulusThreshold,
+                                              vector<UInt> &activeColumns) {
+  activeColumns.clear();
+  const UInt numColumns = (UInt)overlaps.size();
+
+  // Visit the candidates by decreasing overlap, and equal overlaps by
+  // increasing index. The counter then holds exactly the neighbors which
+  // inhibitColumnsLocal_ counts as bigger: those with a larger overlap, and
+  // those with an equal overlap which were selected before.
+  vector<UInt> candidates;
+  for (UInt column = 0; column < numColumns; column++) {
+    if (overlaps[column] >= stimulusThreshold) {
+      candidates.push_back(column);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(), [&overlaps](const UInt a, const UInt b) {
+    return overlaps[a] == overlaps[b] ? a < b : overlaps[a] > overlaps[b];
+  });
+
+  BoxFilter::Counter bigger(box);
+  vector<bool> activeColumnsDense(numColumns, false);
+  for (size_t first = 0; first < candidates.size();) {
+    size_t last = first;
+    while (last < candidates.size() && overlaps[candidates[last]] == overlaps[candidates[first]]) {
+      const UInt column = candidates[last++];
+      const UInt numNeighbors = box.volume(column) - 1u;
       const UInt numActive = (UInt)(0.5f + (density * (numNeighbors + 1)));
-      if (numBigger < numActive) {
+      if (bigger.count(column) < numActive) {
         activeColumns.push_back(column);
         activeColumnsDense[column] = true;
+        bigger.add(column);
       }
+    }
+    for (size_t i = first; i < last; i++) { //the rest of the group is bigger for what follows
+      if (!activeColumnsDense[candidates[i]]) {
+        bigger.add(candidates[i]);
+      }
+    }
+    first = last;
   }
+  std::sort(activeColumns.begin(), activeColumns.end());
 }
 
 
+const size_t SpatialPooler::DEFAULT_NEIGHBORHOOD_TABLE;
+const UInt SpatialPooler::BATCH_TILE;
+
 bool SpatialPooler::isUpdateRound_() const {
   return (iterationNum_ % updatePeriod_) == 0;
 }
@@ -1008,9 +1696,12 @@ bool SpatialPooler::operator==(const SpatialPooler& o) const{
   // compare vectors.
   if (inputDimensions_      != o.inputDimensions_) return false;
   if (columnDimensions_     != o.columnDimensions_) return false;
-  if (boostFactors_         != o.boostFactors_) return false;
-  if (overlapDutyCycles_    != o.overlapDutyCycles_) return false;
-  if (activeDutyCycles_     != o.activeDutyCycles_) return false;
+  vector<Real> boost1, overlapDuty1, activeDuty1, boost2, overlapDuty2, activeDuty2;
+  getEagerDutyCycles_(boost1, overlapDuty1, activeDuty1);
+  o.getEagerDutyCycles_(boost2, overlapDuty2, activeDuty2);
+  if (boost1               != boost2) return false;
+  if (overlapDuty1         != overlapDuty2) return false;
+  if (activeDuty1          != activeDuty2) return false;
   if (minOverlapDutyCycles_ != o.minOverlapDutyCycles_) return false;
 
   // compare connections
@@ -29,10 +29,14 @@
 #include <htm/types/Types.hpp>
 #include <htm/types/Serializable.hpp>
 #include <htm/types/Sdr.hpp>
+#include <htm/utils/Parallel.hpp>
+#include <htm/utils/Topology.hpp>
 
 
 namespace htm {
 
+class BoxFilter;
+
 using namespace std;
 
 /**
@@ -209,6 +213,23 @@ public:
              UInt dutyCyclePeriod = 1000u, Real boostStrength = 0.0f,
              Int seed = 1, UInt spVerbosity = 0u, bool wrapAround = true);
 
+  /**
+  Replaces the potential pools and the permanences of all columns with new
+  ones: the potential pool of each column is drawn from the topology, and
+  its permanences are initialized as in initialize(). initialize() uses
+  DefaultTopology(potentialPct, potentialRadius, wrapAround).
+
+  The work is proportional to the number of synapses, not to the number of
+  inputs, provided the topology is (see htm/utils/Topology.hpp). Columns are
+  initialized in parallel with setNumThreads above 1. Each column draws from
+  its own random generator, seeded from the SpatialPooler's one, so the
+  results do not depend on the number of threads. The topology must be safe
+  to call from several threads at once.
+
+  @param topology Returns the potential pool of a column.
+   */
+  void initializeSynapses(const Topology_t &topology);
+
 
   /**
   This is the main workshorse method of the SpatialPooler class. This
@@ -237,6 +258,32 @@ public:
   virtual void compute(const SDR &input, const bool learn, SDR &active);
 
 
+  /**
+  Computes the active columns of a batch of inputs, without learning. The
+  outputs are those of compute(input, false, active) for each input, in
+  order, and the SpatialPooler is left as after these calls (see
+  getOverlaps, getIterationNum).
+
+  The inputs are processed in tiles of BATCH_TILE inputs (see
+  Connections::computeActivityBatch), the tiles are split among the threads
+  (see setNumThreads).
+
+  Local inhibition always uses the box filter engine, which selects the
+  same columns (see setBoxFilterInhibition).
+
+  @param inputs SDRs with the dimensions of the inputs.
+
+  @param outputs Resized to the number of inputs, receives the active
+        columns of each input.
+   */
+  void computeBatch(const std::vector<SDR> &inputs, std::vector<SDR> &outputs);
+
+  /**
+  Number of inputs of computeBatch per tile, the unit of work of a thread.
+   */
+  static const UInt BATCH_TILE = 16u;
+
+
   /**
    * Get the version number of this spatial pooler.
 
@@ -277,9 +324,17 @@ public:
        CEREAL_NVP(synPermConnected_),
        CEREAL_NVP(minPctOverlapDutyCycles_),
        CEREAL_NVP(wrapAround_));
-    ar(CEREAL_NVP(boostFactors_));
-    ar(CEREAL_NVP(overlapDutyCycles_));
-    ar(CEREAL_NVP(activeDutyCycles_));
+    if (dutyCycleScale_ == 1.0 && !boostFactorsStale_) {
+      ar(CEREAL_NVP(boostFactors_));
+      ar(CEREAL_NVP(overlapDutyCycles_));
+      ar(CEREAL_NVP(activeDutyCycles_));
+    } else { //lazy duty cycles, see setLazyDutyCycles()
+      vector<Real> boostFactors, overlapDutyCycles, activeDutyCycles;
+      getEagerDutyCycles_(boostFactors, overlapDutyCycles, activeDutyCycles);
+      ar(cereal::make_nvp("boostFactors_", boostFactors));
+      ar(cereal::make_nvp("overlapDutyCycles_", overlapDutyCycles));
+      ar(cereal::make_nvp("activeDutyCycles_", activeDutyCycles));
+    }
     ar(CEREAL_NVP(minOverlapDutyCycles_));
     ar(CEREAL_NVP(connections_));
     ar(CEREAL_NVP(rng_));
@@ -320,6 +375,9 @@ public:
     // initialize ephemeral members
     overlaps_.resize(numColumns_);
     boostedOverlaps_.resize(numColumns_);
+    dutyCycleScale_ = 1.0;
+    boostFactorsStale_ = false;
+    overlapsValid_ = false;
   }
 
   /**
@@ -519,6 +577,130 @@ public:
   */
   void setWrapAround(bool wrapAround);
 
+  /**
+  Selects the engine for local inhibition (inhibition, min duty cycles and
+  boost factors). By default each column's neighborhood is visited, at a
+  cost of O(columns * (2 * inhibitionRadius + 1)^dimensions). With box
+  filters (see BoxFilter) the cost does not depend on the radius, which
+  pays off for 2-D and 3-D column grids with a large inhibition radius.
+
+  Both engines select the same active columns, including the tie-break:
+  a neighbor with an equal overlap counts as bigger only if it has a lower
+  index and was selected. The min overlap duty cycles are identical, the
+  local activity densities used for the boost factors are summed in a
+  different order (in double precision) and may differ in rounding.
+
+  This is a runtime setting and is not serialized. Default false.
+
+  @param boxFilters boolean value
+  */
+  void setBoxFilterInhibition(bool boxFilters);
+  bool getBoxFilterInhibition() const;
+
+  /**
+  Limits the table of the local inhibition neighborhoods, which the default
+  local inhibition engine caches instead of walking the neighborhood of each
+  column every step. The table takes 4 bytes per column and neighbor, up to
+  numColumns * (2 * inhibitionRadius + 1)^dimensions entries, plus 4 bytes
+  per column, and is rebuilt on the first use after the inhibition radius
+  changed. If it would need more entries than the limit, it is not kept and
+  the neighborhoods are walked. 0 disables the table.
+
+  By default the limit follows the size of the model: 1024 entries (4 KB)
+  per column, or the number of synapses if that is larger. This covers
+  inhibition radii up to 511 on 1-D and up to 15 on 2-D column grids.
+  This is a runtime setting and is not serialized.
+
+  @param entries maximum number of entries of the table
+  */
+  void setNeighborhoodTableLimit(size_t entries);
+  size_t getNeighborhoodTableLimit() const;
+
+  /**
+  Selects how global inhibition picks the winning columns. By default the
+  columns are partially sorted (nth_element). With counting selection the
+  overlaps are first counted into a histogram of numColumns buckets, which
+  finds the winners in linear time without allocating; only the columns in
+  the bucket at the boundary, and buckets holding distinct overlaps, need
+  to be compared. Overlaps without boosting are small integers and fall
+  into one bucket per value.
+
+  Both modes select the same columns in the same order, including the
+  tie-break on equal overlaps (the column with the higher index wins).
+
+  This is a runtime setting and is not serialized. Default false.
+
+  @param counting boolean value
+  */
+  void setCountingInhibition(bool counting);
+  bool getCountingInhibition() const;
+
+  /**
+  Selects how the duty cycles are updated while learning. By default every
+  overlap and active duty cycle decays on every step, and the boost factors
+  of all columns are recomputed. With lazy duty cycles the decay is kept as
+  a scale common to all the duty cycles, so each step only touches the
+  columns with an overlap or an activation. With global inhibition the
+  boost factors are then computed only for the columns with an overlap.
+  The duty cycles are rescaled on update rounds (see setUpdatePeriod),
+  whenever they are read, and by the first compute without learning, so
+  inference uses the stored boost factors.
+
+  The duty cycles may differ from the eager updates in rounding. Local
+  inhibition reads all the duty cycles on every step, so with it only the
+  decay is saved.
+
+  This is a runtime setting and is not serialized; the serialized duty cycles
+  and boost factors are always the rescaled values. Default false.
+
+  @param lazy boolean value
+  */
+  void setLazyDutyCycles(bool lazy);
+  bool getLazyDutyCycles() const;
+
+  /**
+  Selects how the overlaps are computed. By default every step zeroes the
+  overlaps and counts the connected synapses of all the active inputs. With
+  incremental overlaps the previous input and its overlaps are kept, and
+  only the input bits which turned on or off since are applied, through the
+  presynaptic index of the connections (see Connections::updateActivity).
+  This pays off for streams where consecutive inputs differ in a few bits.
+
+  Learning connects and disconnects synapses of the active columns and of
+  the bumped up weak columns; learning recounts the overlaps of these
+  columns, which replace the kept ones on the next step.
+  Any other change to the synapses (setPermanence, setPotential, loading)
+  discards the kept overlaps, the next step then counts all the inputs.
+  The overlaps are always identical to the default ones.
+
+  This is a runtime setting and is not serialized. Default false.
+
+  @param incremental boolean value
+  */
+  void setIncrementalOverlaps(bool incremental);
+  bool getIncrementalOverlaps() const;
+
+  /**
+  Sets the number of threads used by compute(). The loops over the columns
+  (boosting, inhibition, boost factors, min duty cycles) are split into
+  contiguous ranges of columns, one per worker, and the active columns are
+  adapted in parallel (see Connections::adaptSegments). The overlaps are
+  counted with the same number of threads (see Connections::setNumThreads).
+  The workers are kept in a pool, they wait between the calls.
+
+  The results are identical for any number of threads. Local inhibition
+  decides the ties between neighbors in order, in a serial pass over the
+  tied columns only. The box filter engine (setBoxFilterInhibition) and the
+  counting selection (setCountingInhibition) run on one thread.
+
+  This is a runtime setting and is not serialized. Default 1 (serial), 0
+  means use all hardware threads.
+
+  @param numThreads integer number of threads
+  */
+  void setNumThreads(UInt numThreads);
+  UInt getNumThreads() const;
+
   /**
   Returns the update period.
 
@@ -754,6 +936,9 @@ public:
 
 
   void boostOverlaps_(const vector<SynapseIdx> &overlaps, vector<Real> &boostedOverlaps) const;
+  // Serial kernel of boostOverlaps_ for the columns [begin, end).
+  void boostOverlapsRange_(const vector<SynapseIdx> &overlaps, vector<Real> &boostedOverlaps,
+                           const UInt begin, const UInt end) const;
 
   /**
     Maps a column to its respective input index, keeping to the topology of
@@ -850,6 +1035,17 @@ public:
   */
   vector<Real> initPermanence_(const vector<UInt> &potential, Real connectedPct);
 
+  /**
+    Draws the potential pool of a column from the topology, and its initial
+    permanences as initPermanence_ does.
+
+    @param cell         Scratch SDR with the column dimensions.
+    @param presynaptic  Receives the potential pool, sorted.
+    @param permanences  Receives the permanences of the potential pool.
+  */
+  void initPotentialPool_(UInt column, const Topology_t &topology, Random &rng, SDR &cell,
+                          vector<CellIdx> &presynaptic, vector<Permanence> &permanences) const;
+
   void clip_(vector<Real> &perm) const;
 
   void raisePermanencesToThreshold_(vector<Real> &perm,
@@ -876,6 +1072,15 @@ public:
      input bits which are turned on.
   */
   void calculateOverlap_(const SDR &input, vector<SynapseIdx> &overlap, const bool learn = true);
+
+  /**
+      Updates overlaps_ for the input from the overlaps of the previous
+      input, see setIncrementalOverlaps(), and the overlaps recounted by
+      learning since. Falls back to calculateOverlap_ when
+      there are no valid previous overlaps, or when the change is larger
+      than the input.
+  */
+  void calculateOverlapIncremental_(const SDR &input, const bool learn);
   void calculateOverlapPct_(const vector<SynapseIdx> &overlaps, vector<Real> &overlapPct) const;
 
   /**
@@ -919,6 +1124,30 @@ public:
   void inhibitColumnsGlobal_(const vector<Real> &overlaps, Real density,
                              vector<UInt> &activeColumns) const;
 
+  /**
+  Implements inhibitColumnsGlobal_ with a partial sort: the numDesired
+  columns with the largest overlaps, by decreasing overlap, without those
+  below the stimulusThreshold.
+  */
+  static void inhibitColumnsGlobalSorted_(const vector<Real> &overlaps, UInt numDesired,
+                                          Real stimulusThreshold,
+                                          vector<UInt> &activeColumns);
+
+  /**
+  Implements inhibitColumnsGlobal_ with a histogram of the overlaps, see
+  setCountingInhibition().
+  */
+  void inhibitColumnsGlobalCounting_(const vector<Real> &overlaps, UInt numDesired,
+                                     vector<UInt> &activeColumns) const;
+
+  /**
+  Implements inhibitColumnsGlobal_ on the workers of threads_: each worker
+  keeps the numDesired best columns of its range, the winners are among
+  them. Selects the same columns as inhibitColumnsGlobalSorted_.
+  */
+  void inhibitColumnsGlobalParallel_(const vector<Real> &overlaps, UInt numDesired,
+                                     vector<UInt> &activeColumns) const;
+
   /**
      Performs local inhibition.
 
@@ -948,6 +1177,25 @@ public:
   void inhibitColumnsLocal_(const vector<Real> &overlaps, Real density,
                             vector<UInt> &activeColumns) const;
 
+  /**
+  Implements inhibitColumnsLocal_ with box filters, see
+  setBoxFilterInhibition(). Visits the columns by decreasing overlap,
+  and counts the bigger ones in each neighborhood with a BoxFilter::Counter.
+  */
+  static void inhibitColumnsLocalBoxed_(const BoxFilter &box,
+                                        const vector<Real> &overlaps, Real density,
+                                        Real stimulusThreshold,
+                                        vector<UInt> &activeColumns);
+
+  /**
+  Implements inhibitColumnsLocal_ on the workers of threads_. Most columns
+  are decided by their neighbors with a bigger overlap alone. Only the
+  columns whose outcome depends on the selection of tied neighbors are left
+  to a serial pass, in order, and the same columns are selected.
+  */
+  void inhibitColumnsLocalParallel_(const vector<Real> &overlaps, Real density,
+                                    vector<UInt> &activeColumns) const;
+
   /**
       The primary method in charge of learning.
 
@@ -975,6 +1223,12 @@ public:
   */
   void bumpUpWeakColumns_();
 
+  /**
+      Recounts the overlaps with the input of the columns changed by learning,
+      the active and the bumped up ones, for calculateOverlapIncremental_.
+  */
+  void recordLearnedOverlaps_(const SDR &input, const SDR &active);
+
   /**
       Update the inhibition radius. The inhibition radius is a meausre of the
       square (or hypersquare) of columns that each a column is "connected to"
@@ -1078,6 +1332,28 @@ public:
   */
   void updateDutyCycles_(const vector<SynapseIdx> &overlaps, SDR &active);
 
+  /**
+  Implements updateDutyCycles_ with lazy duty cycles, see
+  setLazyDutyCycles(): the decay only changes dutyCycleScale_.
+  */
+  void updateDutyCyclesLazy_(const vector<SynapseIdx> &overlaps, const SDR &active,
+                             const UInt period);
+
+  /**
+  Applies dutyCycleScale_ to the duty cycles, and computes the boost factors
+  if they are stale. Afterwards the members hold the same values as with
+  eager updates.
+  */
+  void normalizeDutyCycles_();
+
+  /**
+  The duty cycles and boost factors with eager updates, computed without
+  modifying the spatial pooler.
+  */
+  void getEagerDutyCycles_(vector<Real> &boostFactors,
+                           vector<Real> &overlapDutyCycles,
+                           vector<Real> &activeDutyCycles) const;
+
   /**
     Update the boost factors for all columns. The boost factors are used to
     increase the overlap of inactive columns to improve their chances of
@@ -1140,6 +1416,32 @@ public:
   */
   bool isUpdateRound_() const;
 
+  /**
+  Builds the cached table of the columns within inhibitionRadius_ of each
+  column, unless it is up to date. The table only changes with the
+  inhibition radius (updated every updatePeriod_ rounds), wrapAround_ and
+  the column dimensions. If it would be larger than
+  getNeighborhoodTableLimit() entries it is not built, and the
+  neighborhoods are walked each time.
+  */
+  void updateNeighborhoods_() const;
+
+  /**
+  Calls visit(neighbor) for each column in the inhibition neighborhood of
+  column, itself included, in the order of the (Wrapping)Neighborhood.
+  Call updateNeighborhoods_() first.
+  */
+  template<typename Visitor>
+  void forEachNeighbor_(const UInt column, Visitor visit) const;
+
+  /**
+  Calls task(begin, end) for contiguous ranges of columns which cover all
+  the columns, on the workers of threads_, with at least minColumns columns
+  per worker.
+  */
+  template<typename Task>
+  void forEachColumnRange_(const UInt minColumns, Task task) const;
+
   //-------------------------------------------------------------------
   // Debugging helpers
   //-------------------------------------------------------------------
@@ -1180,6 +1482,11 @@ protected:
   UInt spVerbosity_;
   bool wrapAround_;
   UInt updatePeriod_;
+  bool boxFilterInhibition_ = false; //runtime setting, not serialized
+  bool countingInhibition_ = false;  //runtime setting, not serialized
+  bool lazyDutyCycles_ = false;      //runtime setting, not serialized
+  bool incrementalOverlaps_ = false; //runtime setting, not serialized
+  mutable ThreadPool threads_;       //runtime setting, not serialized
 
   Real synPermInactiveDec_;
   Real synPermActiveInc_;
@@ -1189,6 +1496,11 @@ protected:
   vector<Real> boostFactors_;
   vector<Real> overlapDutyCycles_;
   vector<Real> activeDutyCycles_;
+  // Lazy duty cycles, see setLazyDutyCycles(): the duty cycles are the
+  // values above times dutyCycleScale_, and if boostFactorsStale_ the global
+  // boost factors must be computed from the active duty cycles.
+  Real64 dutyCycleScale_ = 1.0;
+  bool boostFactorsStale_ = false;
   vector<Real> minOverlapDutyCycles_;
   vector<Real> minActiveDutyCycles_;
 
@@ -1204,6 +1516,36 @@ protected:
   vector<SynapseIdx> overlaps_;
   vector<Real> boostedOverlaps_;
 
+  // Incremental overlaps, see setIncrementalOverlaps(). If overlapsValid_,
+  // overlaps_ are the overlaps of overlapsInput_ (sorted sparse indices)
+  // before learning. learnedOverlaps_ are (column, overlap) of the columns
+  // which learned since, with the same input. Not serialized.
+  bool overlapsValid_ = false;
+  vector<CellIdx> overlapsInput_;
+  vector<std::pair<UInt, SynapseIdx>> learnedOverlaps_;
+  vector<UInt> bumpedColumns_;        //scratch
+  vector<CellIdx> currentInput_;      //scratch
+  vector<CellIdx> activatedInputs_;   //scratch
+  vector<CellIdx> deactivatedInputs_; //scratch
+
+  // Cache of the local inhibition neighborhoods, see updateNeighborhoods_().
+  // Derived from the parameters above, not serialized.
+  static const size_t DEFAULT_NEIGHBORHOOD_TABLE = std::numeric_limits<size_t>::max(); //follows the model size
+  size_t neighborhoodTableLimit_ = DEFAULT_NEIGHBORHOOD_TABLE; //runtime setting, not serialized
+  mutable vector<UInt> neighborhoodStart_;   //numColumns_ + 1 offsets into neighborhoodColumns_
+  mutable vector<UInt> neighborhoodColumns_;
+  mutable UInt neighborhoodRadius_ = std::numeric_limits<UInt>::max();
+  mutable bool neighborhoodWrap_ = false;
+  mutable vector<UInt> neighborhoodDimensions_;
+
+  // Scratch space of inhibitColumnsGlobalCounting_(), not serialized.
+  mutable vector<UInt> inhibitionBuckets_; //bucket of each column
+  mutable vector<UInt> inhibitionCounts_;  //histogram of the buckets
+  // Scratch space of the multi-threaded inhibition, not serialized.
+  mutable vector<vector<UInt>> inhibitionCandidates_; //per worker
+  mutable vector<Byte> inhibitionStates_;   //per column
+  mutable vector<UInt> inhibitionMargins_;  //per column
+
 
   UInt version_;
   Random rng_;
@@ -41,7 +41,6 @@
 #include <htm/algorithms/TemporalMemory.hpp>
 
 #include <htm/utils/GroupBy.hpp>
-#include <htm/algorithms/Anomaly.hpp>
 
 using namespace std;
 using namespace htm;
@@ -127,7 +126,8 @@ void TemporalMemory::initialize(
 
   // Initialize member variables
   connections = Connections(static_cast<CellIdx>(numberOfColumns() * cellsPerColumn_), connectedPermanence_);
-  rng_ = Random(seed);
+  connections.setNumThreads(threads_.size());
+  state_.rng = Random(seed);
 
   maxSegmentsPerCell_ = maxSegmentsPerCell;
   maxSynapsesPerSegment_ = maxSynapsesPerSegment;
@@ -136,7 +136,8 @@ void TemporalMemory::initialize(
 }
 
 ///*
-static CellIdx getLeastUsedCell(Random &rng, 
+template <class RandomGenerator>
+static CellIdx getLeastUsedCell(RandomGenerator &rng, 
 		                const UInt column, //TODO remove static methods, use private instead
                                 const Connections &connections,
                                 const UInt cellsPerColumn) {
@@ -145,6 +146,7 @@ static CellIdx getLeastUsedCell(Random &rng,
 
   size_t minNumSegments = std::numeric_limits<CellIdx>::max();
   UInt32 numTiedCells = 0u;
+  CellIdx firstTiedCell = start;
   //for all cells in a mini-column
   for (CellIdx cell = start; cell < end; cell++) {
     const size_t numSegments = connections.numSegments(cell);
@@ -152,6 +154,7 @@ static CellIdx getLeastUsedCell(Random &rng,
     if (numSegments < minNumSegments) {
       minNumSegments = numSegments;
       numTiedCells = 1u;
+      firstTiedCell = cell;
     //..and how many of the cells have only these min segments? number of weakest
     } else if (numSegments == minNumSegments) {
       numTiedCells++;
@@ -161,7 +164,7 @@ static CellIdx getLeastUsedCell(Random &rng,
   //randomly select one of the tie-d cells from the losers
   const UInt32 tieWinnerIndex = rng.getUInt32(numTiedCells);
   UInt32 tieIndex = 0;
-  for (CellIdx cell = start; cell < end; cell++) {
+  for (CellIdx cell = firstTiedCell; cell < end; cell++) { //no tie-d cells before the first one
     if (connections.numSegments(cell) == minNumSegments) {
       if (tieIndex == tieWinnerIndex) {
         return cell;
@@ -181,13 +184,14 @@ static void growSynapses(Connections &connections,
                          const SynapseIdx nDesiredNewSynapses,
                          const vector<CellIdx> &prevWinnerCells,
                          const Permanence initialPermanence,
-                         const SynapseIdx maxSynapsesPerSegment) {
+                         const SynapseIdx maxSynapsesPerSegment,
+                         vector<CellIdx> &candidates) { //scratch buffer
   // It's possible to optimize this, swapping candidates to the end as
   // they're used. But this is awkward to mimic in other
   // implementations, especially because it requires iterating over
   // the existing synapses in a particular order.
 
-  vector<CellIdx> candidates(prevWinnerCells.begin(), prevWinnerCells.end());
+  candidates.assign(prevWinnerCells.begin(), prevWinnerCells.end());
   NTA_ASSERT(std::is_sorted(candidates.begin(), candidates.end()));
 
   // Skip cells that are already synapsed on by this segment
@@ -219,12 +223,68 @@ static void growSynapses(Connections &connections,
   // Recalculate in case we weren't able to destroy as many synapses as needed.
   const size_t nActualWithMax = std::min(nActual, static_cast<size_t>(maxSynapsesPerSegment) - connections.numSynapses(segment));
 
-  // Pick nActual cells randomly.
-  for (const auto syn : rng.sample(candidates, nActualWithMax)) {
-    connections.createSynapse(segment, syn, initialPermanence); //TODO createSynapse consider creating a vector of new synapses at once?
+  // Pick nActual cells randomly, as rng.sample(candidates, nActualWithMax)
+  // but in place.
+  if (nActualWithMax == 0u) return;
+  rng.shuffle(candidates.begin(), candidates.end());
+  candidates.resize(nActualWithMax);
+  connections.createSynapses(segment, candidates, initialPermanence);
+}
+
+// The active and winner cells of a predicted column: the cells with an
+// active segment.
+static void predictedColumnCells(vector<CellIdx> &activeCells,
+                                 vector<CellIdx> &winnerCells,
+                                 const Connections &connections,
+                                 vector<Segment>::const_iterator columnActiveSegmentsBegin,
+                                 vector<Segment>::const_iterator columnActiveSegmentsEnd) {
+  for (auto activeSegment = columnActiveSegmentsBegin;
+       activeSegment != columnActiveSegmentsEnd; activeSegment++) {
+    const CellIdx cell = connections.cellForSegment(*activeSegment);
+    // This cell might have multiple active segments.
+    if (activeSegment == columnActiveSegmentsBegin || cell != activeCells.back()) {
+      activeCells.push_back(cell);
+      winnerCells.push_back(cell);
+    }
   }
 }
 
+// The active cells of a bursting column, all of its cells, and its winner
+// cell: the cell of the best matching segment, or else the least used cell.
+// Returns the best matching segment, or columnMatchingSegmentsEnd.
+template <class RandomGenerator>
+static vector<Segment>::const_iterator
+burstColumnCells(vector<CellIdx> &activeCells,
+                 vector<CellIdx> &winnerCells,
+                 const Connections &connections,
+                 RandomGenerator &rng,
+                 const UInt column,
+                 vector<Segment>::const_iterator columnMatchingSegmentsBegin,
+                 vector<Segment>::const_iterator columnMatchingSegmentsEnd,
+                 const vector<SynapseIdx> &numActivePotentialSynapsesForSegment,
+                 const CellIdx cellsPerColumn) {
+  const CellIdx start = column * cellsPerColumn;
+  const CellIdx end = start + cellsPerColumn;
+  for (CellIdx cell = start; cell < end; cell++) {
+    activeCells.push_back(cell);
+  }
+
+  const auto bestMatchingSegment =
+      std::max_element(columnMatchingSegmentsBegin, columnMatchingSegmentsEnd,
+                       [&](Segment a, Segment b) {
+                         return (numActivePotentialSynapsesForSegment[a] <
+                                 numActivePotentialSynapsesForSegment[b]);
+                       });
+
+  const CellIdx winnerCell =
+      (bestMatchingSegment != columnMatchingSegmentsEnd)
+          ? connections.cellForSegment(*bestMatchingSegment)
+          : getLeastUsedCell(rng, column, connections, cellsPerColumn);
+
+  winnerCells.push_back(winnerCell);
+  return bestMatchingSegment;
+}
+
 static void activatePredictedColumn(
     vector<CellIdx> &activeCells, 
     vector<CellIdx> &winnerCells,
@@ -240,31 +300,27 @@ static void activatePredictedColumn(
     const Permanence permanenceIncrement, 
     const Permanence permanenceDecrement,
     const SynapseIdx maxSynapsesPerSegment, 
-    const bool learn) {
-  auto activeSegment = columnActiveSegmentsBegin;
-  do {
-    const CellIdx cell = connections.cellForSegment(*activeSegment);
-    activeCells.push_back(cell);
-    winnerCells.push_back(cell);
+    const bool learn,
+    vector<CellIdx> &candidates) {
+  predictedColumnCells(activeCells, winnerCells, connections,
+                       columnActiveSegmentsBegin, columnActiveSegmentsEnd);
 
-    // This cell might have multiple active segments.
-    do {
-      if (learn) { 
-        connections.adaptSegment(*activeSegment, prevActiveCells,
-                     permanenceIncrement, permanenceDecrement, true);
-
-        const Int32 nGrowDesired =
-            static_cast<Int32>(maxNewSynapseCount) -
-            numActivePotentialSynapsesForSegment[*activeSegment];
-        if (nGrowDesired > 0) {
-          growSynapses(connections, rng, *activeSegment, nGrowDesired,
-                       prevWinnerCells, initialPermanence,
-                       maxSynapsesPerSegment);
-        }
+  if (learn) {
+    for (auto activeSegment = columnActiveSegmentsBegin;
+         activeSegment != columnActiveSegmentsEnd; activeSegment++) {
+      connections.adaptSegment(*activeSegment, prevActiveCells,
+                   permanenceIncrement, permanenceDecrement, true);
+
+      const Int32 nGrowDesired =
+          static_cast<Int32>(maxNewSynapseCount) -
+          numActivePotentialSynapsesForSegment[*activeSegment];
+      if (nGrowDesired > 0) {
+        growSynapses(connections, rng, *activeSegment, nGrowDesired,
+                     prevWinnerCells, initialPermanence,
+                     maxSynapsesPerSegment, candidates);
       }
-    } while (++activeSegment != columnActiveSegmentsEnd &&
-             connections.cellForSegment(*activeSegment) == cell);
-  } while (activeSegment != columnActiveSegmentsEnd);
+    }
+  }
 }
 
 
@@ -286,27 +342,13 @@ burstColumn(vector<CellIdx> &activeCells,
             const Permanence permanenceDecrement, 
             const SegmentIdx maxSegmentsPerCell,
             const SynapseIdx maxSynapsesPerSegment, 
-            const bool learn) {
-  // Calculate the active cells.
-  const CellIdx start = column * cellsPerColumn;
-  const CellIdx end = start + cellsPerColumn;
-  for (CellIdx cell = start; cell < end; cell++) {
-    activeCells.push_back(cell);
-  }
-
-  const auto bestMatchingSegment =
-      std::max_element(columnMatchingSegmentsBegin, columnMatchingSegmentsEnd,
-                       [&](Segment a, Segment b) {
-                         return (numActivePotentialSynapsesForSegment[a] <
-                                 numActivePotentialSynapsesForSegment[b]);
-                       });
-
-  const CellIdx winnerCell =
-      (bestMatchingSegment != columnMatchingSegmentsEnd)
-          ? connections.cellForSegment(*bestMatchingSegment)
-          : getLeastUsedCell(rng, column, connections, cellsPerColumn); //TODO replace (with random?) this is extremely costly, removing makes TM 6x faster!
-
-  winnerCells.push_back(winnerCell);
+            const bool learn,
+            vector<CellIdx> &candidates) {
+  const auto bestMatchingSegment = burstColumnCells(
+      activeCells, winnerCells, connections, rng, column,
+      columnMatchingSegmentsBegin, columnMatchingSegmentsEnd,
+      numActivePotentialSynapsesForSegment, cellsPerColumn);
+  const CellIdx winnerCell = winnerCells.back();
 
   // Learn.
   if (learn) {
@@ -320,7 +362,8 @@ burstColumn(vector<CellIdx> &activeCells,
           numActivePotentialSynapsesForSegment[*bestMatchingSegment];
       if (nGrowDesired > 0) {
         growSynapses(connections, rng, *bestMatchingSegment, nGrowDesired,
-                     prevWinnerCells, initialPermanence, maxSynapsesPerSegment);
+                     prevWinnerCells, initialPermanence, maxSynapsesPerSegment,
+                     candidates);
       }
     } else {
       // No matching segments.
@@ -334,7 +377,7 @@ burstColumn(vector<CellIdx> &activeCells,
             connections.createSegment(winnerCell, maxSegmentsPerCell);
 
         growSynapses(connections, rng, segment, nGrowExact, prevWinnerCells,
-                     initialPermanence, maxSynapsesPerSegment);
+                     initialPermanence, maxSynapsesPerSegment, candidates);
         NTA_ASSERT(connections.numSynapses(segment) == nGrowExact);
       }
     }
@@ -356,7 +399,20 @@ static void punishPredictedColumn(
   }
 }
 
-void TemporalMemory::activateCells(const SDR &activeColumns, const bool learn) {
+// The raw anomaly score, as computeRawAnomalyScore(): the fraction of the
+// active columns which were not predicted. The column loops of activateCells
+// count the predicted ones, the columns with an active segment.
+static Real rawAnomalyScore(const size_t numActiveColumns,
+                            const size_t numPredictedActiveColumns) {
+  if (numActiveColumns == 0u) {
+    return static_cast<Real>(0);
+  }
+  return static_cast<Real>(numActiveColumns - numPredictedActiveColumns) /
+         static_cast<Real>(numActiveColumns);
+}
+
+
+void TemporalMemory::checkColumns_(const SDR &activeColumns) const {
     NTA_CHECK(columnDimensions_.size() > 0) << "TM constructed using the default TM() constructor, which may only be used for serialization. "
 	    << "Use TM constructor where you provide at least column dimensions, eg: TM tm({32});";
 
@@ -366,13 +422,32 @@ void TemporalMemory::activateCells(const SDR &activeColumns, const bool learn) {
     for(size_t i=0; i< columnDimensions_.size(); i++) {
       NTA_CHECK(static_cast<size_t>(activeColumns.dimensions[i]) == static_cast<size_t>(columnDimensions_[i])) << "Dimensions must be the same.";
     }
+}
+
+
+void TemporalMemory::activateCells(const SDR &activeColumns, const bool learn) {
+    checkColumns_(activeColumns);
     auto &sparse = activeColumns.getSparse();
 
-  SDR prevActiveCells({static_cast<CellIdx>(numberOfCells() + externalPredictiveInputs_)});
-  prevActiveCells.setSparse(activeCells_);
-  activeCells_.clear();
+  // The previous cells swap buffers with the current ones, which keeps the
+  // capacity of both.
+  const UInt numPrevCells = static_cast<UInt>(numberOfCells() + externalPredictiveInputs_);
+  if (prevActiveCells_.dimensions.size() != 1u || prevActiveCells_.size != numPrevCells) {
+    prevActiveCells_.initialize({numPrevCells});
+  }
+  const SDR &prevActiveCells = prevActiveCells_;
+  prevActiveCells_.setSparse(state_.activeCells);
+  state_.activeCells.clear();
+
+  prevWinnerCells_.swap(state_.winnerCells);
+  state_.winnerCells.clear();
+  const vector<CellIdx> &prevWinnerCells = prevWinnerCells_;
 
-  const vector<CellIdx> prevWinnerCells = std::move(winnerCells_);
+  if (parallelLearning_) {
+    activateCellsParallel_(sparse, prevActiveCells, prevWinnerCells, learn);
+    state_.segmentsValid = false;
+    return;
+  }
 
   //maps segment S to a new segment that is at start of a column where
   //S belongs. 
@@ -390,10 +465,11 @@ void TemporalMemory::activateCells(const SDR &activeColumns, const bool learn) {
   };
   const auto identity = [](const ElemSparse a) {return a;}; //TODO use std::identity when c++20
 
+  size_t numPredictedColumns = 0u;
   for (auto &&columnData : groupBy( //group by columns, and convert activeSegments & matchingSegments to cols. 
            sparse, identity,
-           activeSegments_,   toColumns,
-           matchingSegments_, toColumns)) {
+           state_.activeSegments,   toColumns,
+           state_.matchingSegments, toColumns)) {
 
     Segment column; //we say "column", but it's the first segment of n-segments/cells that belong to the column
     vector<Segment>::const_iterator activeColumnsBegin, activeColumnsEnd, 
@@ -413,23 +489,25 @@ void TemporalMemory::activateCells(const SDR &activeColumns, const bool learn) {
     if (isActiveColumn) { //current active column...
       if (columnActiveSegmentsBegin != columnActiveSegmentsEnd) {
 	//...was also predicted -> learn :o)
+        numPredictedColumns++;
         activatePredictedColumn(
-            activeCells_, winnerCells_, connections, rng_,
+            state_.activeCells, state_.winnerCells, connections, state_.rng,
             columnActiveSegmentsBegin, columnActiveSegmentsEnd,
             prevActiveCells, prevWinnerCells,
-            numActivePotentialSynapsesForSegment_, maxNewSynapseCount_,
+            state_.numActivePotentialSynapsesForSegment, maxNewSynapseCount_,
             initialPermanence_, permanenceIncrement_, permanenceDecrement_,
-            maxSynapsesPerSegment_, learn);
+            maxSynapsesPerSegment_, learn, candidates_);
       } else {
 	//...has not been predicted -> 
-        burstColumn(activeCells_, winnerCells_, connections, rng_,
+        burstColumn(state_.activeCells, state_.winnerCells, connections, state_.rng,
                     column,
                     columnMatchingSegmentsBegin, columnMatchingSegmentsEnd,
                     prevActiveCells, prevWinnerCells,
-                    numActivePotentialSynapsesForSegment_,
+                    state_.numActivePotentialSynapsesForSegment,
                     cellsPerColumn_, maxNewSynapseCount_, initialPermanence_,
                     permanenceIncrement_, permanenceDecrement_,
-                    maxSegmentsPerCell_, maxSynapsesPerSegment_, learn);
+                    maxSegmentsPerCell_, maxSynapsesPerSegment_, learn,
+                    candidates_);
       }
 
     } else { // predicted but not active column -> unlearn
@@ -440,7 +518,242 @@ void TemporalMemory::activateCells(const SDR &activeColumns, const bool learn) {
       }
     } //else: not predicted & not active -> no activity -> does not show up at all
   }
-  segmentsValid_ = false;
+  state_.anomaly = rawAnomalyScore(sparse.size(), numPredictedColumns);
+  state_.segmentsValid = false;
+}
+
+
+// The random stream of a column in one step of parallel learning, and of
+// its stream-th substream: splitmix64, a counter based generator, so the
+// streams are cheap to create and do not depend on the order in which the
+// columns are visited.
+class ColumnStream {
+public:
+  ColumnStream(const UInt32 stepSeed, const UInt column, const UInt stream)
+      : state_(((UInt64)stepSeed << 32u) | column) {
+    // The substreams of a column start next to each other, far apart from
+    // where the others are after any realistic number of draws.
+    state_ = next_() + stream;
+  }
+
+  UInt32 getUInt32(const UInt32 max) {
+    NTA_ASSERT(max > 0u);
+    return static_cast<UInt32>((next_() >> 32u) % max);
+  }
+
+  // n distinct elements of the population, at random.
+  vector<CellIdx> sample(vector<CellIdx> population, const size_t n) {
+    NTA_ASSERT(n <= population.size());
+    for (size_t i = 0; i < n; i++) {
+      std::swap(population[i], population[i + getUInt32(static_cast<UInt32>(population.size() - i))]);
+    }
+    population.resize(n);
+    return population;
+  }
+
+private:
+  UInt64 next_() {
+    UInt64 z = (state_ += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30u)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27u)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31u);
+  }
+
+  UInt64 state_;
+};
+
+// The read only part of growSynapses: chooses the presynaptic cells of the
+// new synapses, and the number of synapses to destroy before creating them.
+// A new segment (segment is nullptr) has no synapses yet.
+static void chooseNewSynapses(vector<CellIdx> &growCells,
+                              Int &overrun,
+                              const Connections &connections,
+                              ColumnStream &rng,
+                              const Segment *segment,
+                              const SynapseIdx nDesiredNewSynapses,
+                              const vector<CellIdx> &prevWinnerCells,
+                              const SynapseIdx maxSynapsesPerSegment) {
+  vector<CellIdx> candidates(prevWinnerCells.begin(), prevWinnerCells.end());
+  size_t numSynapses = 0u;
+  size_t numDestroyable = 0u; //synapses which destroyMinPermanenceSynapses may destroy
+  if (segment != nullptr) {
+    for (const Synapse& synapse : connections.synapsesForSegment(*segment)) {
+      const CellIdx presynapticCell = connections.dataForSynapse(synapse).presynapticCell;
+      const auto already = std::lower_bound(candidates.cbegin(), candidates.cend(), presynapticCell);
+      if (already != candidates.cend() && *already == presynapticCell) {
+        candidates.erase(already);
+      } else if (!std::binary_search(prevWinnerCells.cbegin(), prevWinnerCells.cend(), presynapticCell)) {
+        numDestroyable++;
+      }
+    }
+    numSynapses = connections.numSynapses(*segment);
+  }
+
+  const size_t nActual = std::min(static_cast<size_t>(nDesiredNewSynapses), candidates.size());
+  overrun = static_cast<Int>(numSynapses + nActual - maxSynapsesPerSegment);
+  if (overrun > 0) {
+    numSynapses -= std::min(static_cast<size_t>(overrun), numDestroyable);
+  }
+  const size_t nActualWithMax = std::min(nActual, static_cast<size_t>(maxSynapsesPerSegment) - numSynapses);
+  growCells = rng.sample(std::move(candidates), nActualWithMax);
+}
+
+
+void TemporalMemory::activateCellsParallel_(const vector<CellIdx> &activeColumns,
+                                            const SDR &prevActiveCells,
+                                            const vector<CellIdx> &prevWinnerCells,
+                                            const bool learn) {
+  // The columns with activity, in order, as in activateCells.
+  using SegmentIter = vector<Segment>::const_iterator;
+  struct ColumnData {
+    UInt column;
+    bool isActive;
+    SegmentIter activeBegin, activeEnd, matchingBegin, matchingEnd;
+  };
+  vector<ColumnData> columns;
+  size_t numPredictedColumns = 0u;
+  const auto toColumns = [&](const Segment segment) {
+    return connections.cellForSegment(segment) / cellsPerColumn_;
+  };
+  const auto identity = [](const ElemSparse a) {return a;};
+  for (auto &&columnData : groupBy(activeColumns,     identity,
+                                   state_.activeSegments,   toColumns,
+                                   state_.matchingSegments, toColumns)) {
+    ColumnData data;
+    vector<CellIdx>::const_iterator activeColumnsBegin, activeColumnsEnd;
+    std::tie(data.column, activeColumnsBegin, activeColumnsEnd,
+             data.activeBegin, data.activeEnd,
+             data.matchingBegin, data.matchingEnd) = columnData;
+    data.isActive = activeColumnsBegin != activeColumnsEnd;
+    if (data.isActive && data.activeBegin != data.activeEnd) {
+      numPredictedColumns++;
+    }
+    columns.push_back(data);
+  }
+  state_.anomaly = rawAnomalyScore(activeColumns.size(), numPredictedColumns);
+
+  const UInt32 stepSeed = state_.rng.getUInt32();
+  const size_t minColumnsPerThread = 8u;
+  const UInt numWorkers = static_cast<UInt>(std::max<size_t>(1u,
+                            std::min<size_t>(threads_.size(), columns.size() / minColumnsPerThread)));
+  columnWorkers_.resize(numWorkers);
+
+  // Choose the active and winner cells, and the segments to learn on. Only
+  // reads the connections.
+  threads_.parallelFor(numWorkers, [&](const UInt worker) {
+    auto &out = columnWorkers_[worker];
+    out.activeCells.clear();
+    out.winnerCells.clear();
+    out.learning.clear();
+    size_t columnLearning = 0u; //first learning segment of the current column
+    const auto addLearning = [&](const Segment segment, const CellIdx cell,
+                                 const bool newSegment, const bool punish, const Int32 numGrow) {
+      LearningSegment learning;
+      learning.segment    = segment;
+      learning.cell       = cell;
+      learning.newSegment = newSegment;
+      learning.punish     = punish;
+      learning.numGrow    = static_cast<SynapseIdx>(std::max<Int32>(numGrow, 0));
+      learning.stream     = static_cast<UInt>(out.learning.size() - columnLearning) + 1u;
+      learning.overrun    = 0;
+      out.learning.push_back(std::move(learning));
+    };
+
+    const auto range = workerRange(columns.size(), worker, numWorkers);
+    for (size_t i = range.first; i < range.second; i++) {
+      const auto &data = columns[i];
+      columnLearning = out.learning.size();
+      if (data.isActive && data.activeBegin != data.activeEnd) {
+        // Predicted: as activatePredictedColumn.
+        predictedColumnCells(out.activeCells, out.winnerCells, connections,
+                             data.activeBegin, data.activeEnd);
+        if (learn) {
+          for (auto activeSegment = data.activeBegin; activeSegment != data.activeEnd; activeSegment++) {
+            addLearning(*activeSegment, connections.cellForSegment(*activeSegment), false, false,
+                        static_cast<Int32>(maxNewSynapseCount_) -
+                        state_.numActivePotentialSynapsesForSegment[*activeSegment]);
+          }
+        }
+
+      } else if (data.isActive) {
+        // Bursting: as burstColumn.
+        ColumnStream rng(stepSeed, data.column, 0u);
+        const auto bestMatchingSegment = burstColumnCells(
+            out.activeCells, out.winnerCells, connections, rng, data.column,
+            data.matchingBegin, data.matchingEnd,
+            state_.numActivePotentialSynapsesForSegment, cellsPerColumn_);
+        const CellIdx winnerCell = out.winnerCells.back();
+
+        if (learn) {
+          if (bestMatchingSegment != data.matchingEnd) {
+            addLearning(*bestMatchingSegment, winnerCell, false, false,
+                        static_cast<Int32>(maxNewSynapseCount_) -
+                        state_.numActivePotentialSynapsesForSegment[*bestMatchingSegment]);
+          } else {
+            const UInt32 nGrowExact = std::min((UInt32)maxNewSynapseCount_, (UInt32)prevWinnerCells.size());
+            if (nGrowExact > 0) {
+              addLearning(0u, winnerCell, true, false, static_cast<Int32>(nGrowExact));
+            }
+          }
+        }
+
+      } else if (learn && predictedSegmentDecrement_ > 0.0) {
+        // Predicted but not active: as punishPredictedColumn.
+        for (auto matchingSegment = data.matchingBegin; matchingSegment != data.matchingEnd; matchingSegment++) {
+          addLearning(*matchingSegment, connections.cellForSegment(*matchingSegment),
+                      false, true, 0);
+        }
+      }
+    }
+  });
+
+  vector<Segment> adaptSegments, punishSegments;
+  for (const auto &out : columnWorkers_) {
+    state_.activeCells.insert(state_.activeCells.end(), out.activeCells.begin(), out.activeCells.end());
+    state_.winnerCells.insert(state_.winnerCells.end(), out.winnerCells.begin(), out.winnerCells.end());
+    for (const auto &learning : out.learning) {
+      if (learning.newSegment) continue;
+      (learning.punish ? punishSegments : adaptSegments).push_back(learning.segment);
+    }
+  }
+  if (!learn) {
+    return;
+  }
+
+  // Adapt the permanences, the segments are distinct.
+  connections.adaptSegments(adaptSegments, prevActiveCells,
+                            permanenceIncrement_, permanenceDecrement_, true);
+  connections.adaptSegments(punishSegments, prevActiveCells,
+                            -predictedSegmentDecrement_, 0.0, true);
+
+  // Choose the new synapses, from the adapted segments.
+  threads_.parallelFor(numWorkers, [&](const UInt worker) {
+    for (auto &learning : columnWorkers_[worker].learning) {
+      if (learning.numGrow == 0u) continue;
+      if (!learning.newSegment && connections.synapsesForSegment(learning.segment).empty()) {
+        learning.numGrow = 0u; //pruned away by adaptSegments
+        continue;
+      }
+      ColumnStream rng(stepSeed, learning.cell / cellsPerColumn_, learning.stream);
+      chooseNewSynapses(learning.growCells, learning.overrun, connections, rng,
+                        learning.newSegment ? nullptr : &learning.segment,
+                        learning.numGrow, prevWinnerCells, maxSynapsesPerSegment_);
+    }
+  });
+
+  // Create the segments and synapses, in the order of the columns.
+  for (const auto &out : columnWorkers_) {
+    for (const auto &learning : out.learning) {
+      if (learning.numGrow == 0u) continue;
+      Segment segment = learning.segment;
+      if (learning.newSegment) {
+        segment = connections.createSegment(learning.cell, maxSegmentsPerCell_);
+      } else if (learning.overrun > 0) {
+        connections.destroyMinPermanenceSynapses(segment, learning.overrun, prevWinnerCells);
+      }
+      connections.createSynapses(segment, learning.growCells, initialPermanence_);
+    }
+  }
 }
 
 
@@ -466,53 +779,67 @@ void TemporalMemory::activateDendrites(const bool learn,
     }
 
 
-  if( segmentsValid_ )
+  if( state_.segmentsValid )
     return;
 
   for(const auto &active : externalPredictiveInputsActive.getSparse()) {
       NTA_ASSERT( active < externalPredictiveInputs_ );
-      activeCells_.push_back( static_cast<CellIdx>(active + numberOfCells()) ); 
+      state_.activeCells.push_back( static_cast<CellIdx>(active + numberOfCells()) ); 
   }
   for(const auto &winner : externalPredictiveInputsWinners.getSparse()) {
       NTA_ASSERT( winner < externalPredictiveInputs_ );
-      winnerCells_.push_back( static_cast<CellIdx>(winner + numberOfCells()) );
+      state_.winnerCells.push_back( static_cast<CellIdx>(winner + numberOfCells()) );
   }
 
-  const size_t length = connections.segmentFlatListLength();
-
-  numActiveConnectedSynapsesForSegment_.assign(length, 0);
-  numActivePotentialSynapsesForSegment_.assign(length, 0);
-  connections.computeActivity(numActiveConnectedSynapsesForSegment_,
-                              numActivePotentialSynapsesForSegment_,
-                              activeCells_,
-			      learn);
-
-  // Active segments, connected synapses.
-  activeSegments_.clear();
-  for (Segment segment = 0; segment < numActiveConnectedSynapsesForSegment_.size(); segment++) {
-    if (numActiveConnectedSynapsesForSegment_[segment] >= activationThreshold_) { //TODO move to SegmentData.numConnected?
-      activeSegments_.push_back(segment);
-    }
+  if (state_.numActiveConnectedSynapsesForSegment.size() > connections.segmentFlatListLength()) {
+    // Connections::compact() renumbered the segments, start over.
+    state_.numActiveConnectedSynapsesForSegment.clear();
+    state_.numActivePotentialSynapsesForSegment.clear();
+    state_.touchedSegments.clear();
   }
-  const auto compareSegments = [&](const Segment a, const Segment b) { return connections.compareSegments(a, b); };
-  std::sort( activeSegments_.begin(), activeSegments_.end(), compareSegments); //SDR requires sorted when constructed from activeSegments_
+  connections.computeActivity(state_.numActiveConnectedSynapsesForSegment,
+                              state_.numActivePotentialSynapsesForSegment,
+                              state_.activeCells,
+			      learn,
+                              state_.touchedSegments);
+
+  selectSegments_(state_);
   // Update segment bookkeeping.
   if (learn) {
-    for (const auto segment : activeSegments_) {
-      connections.dataForSegment(segment).lastUsed = connections.iteration(); //TODO the destroySegments based on LRU is expensive. Better random? or "energy" based on sum permanences?
+    for (const auto segment : state_.activeSegments) {
+      connections.touchSegment(segment);
     }
   }
+}
 
-  // Matching segments, potential synapses.
-  matchingSegments_.clear();
-  for (Segment segment = 0; segment < numActivePotentialSynapsesForSegment_.size(); segment++) {
-    if (numActivePotentialSynapsesForSegment_[segment] >= minThreshold_) {
-      matchingSegments_.push_back(segment);
+
+void TemporalMemory::selectSegments_(TMState &state) const {
+  // Only the touched segments have active synapses, all segments reach a
+  // threshold of zero.
+  const auto compareSegments = [&](const Segment a, const Segment b) { return connections.compareSegments(a, b); };
+  const auto selectSegments = [&](const vector<SynapseIdx> &counts, const SynapseIdx threshold,
+                                  vector<Segment> &selected) {
+    selected.clear();
+    if (threshold == 0u) {
+      for (Segment segment = 0; segment < counts.size(); segment++) {
+        selected.push_back(segment);
+      }
+    } else {
+      for (const auto segment : state.touchedSegments) {
+        if (counts[segment] >= threshold) {
+          selected.push_back(segment);
+        }
+      }
     }
-  }
-  std::sort( matchingSegments_.begin(), matchingSegments_.end(), compareSegments);
+    std::sort( selected.begin(), selected.end(), compareSegments); //SDR requires sorted when constructed from activeSegments
+  };
+
+  // Active segments, connected synapses.
+  selectSegments(state.numActiveConnectedSynapsesForSegment, activationThreshold_, state.activeSegments); //TODO move to SegmentData.numConnected?
+  // Matching segments, potential synapses.
+  selectSegments(state.numActivePotentialSynapsesForSegment, minThreshold_, state.matchingSegments);
 
-  segmentsValid_ = true;
+  state.segmentsValid = true;
 }
 
 
@@ -523,29 +850,98 @@ void TemporalMemory::compute(const SDR &activeColumns,
 {
   activateDendrites(learn, externalPredictiveInputsActive, externalPredictiveInputsWinners);
 
-  // Update Anomaly Metric.  The anomaly is the percent of active columns that
-  // were not predicted.
-  anomaly_ = computeRawAnomalyScore(
-                activeColumns,
-                cellsToColumns( getPredictiveCells() ));
+  // Also updates the Anomaly Metric, the percent of active columns that were
+  // not predicted.
   // TODO: Update mean & standard deviation of anomaly here.
-
   activateCells(activeColumns, learn);
 }
 
 void TemporalMemory::compute(const SDR &activeColumns, const bool learn) {
-  SDR externalPredictiveInputsActive({ externalPredictiveInputs_ });
-  SDR externalPredictiveInputsWinners({ externalPredictiveInputs_ });
-  compute( activeColumns, learn, externalPredictiveInputsActive, externalPredictiveInputsWinners );
+  if (noExternalInputs_.dimensions.size() != 1u || noExternalInputs_.size != externalPredictiveInputs_) {
+    noExternalInputs_.initialize({ externalPredictiveInputs_ });
+  }
+  compute( activeColumns, learn, noExternalInputs_, noExternalInputs_ );
 }
 
 void TemporalMemory::reset(void) {
-  activeCells_.clear();
-  winnerCells_.clear();
-  activeSegments_.clear();
-  matchingSegments_.clear();
-  segmentsValid_ = false;
-  anomaly_ = -1.0f;
+  state_.reset();
+}
+
+
+TMState TemporalMemory::createState() const {
+  TMState state;
+  state.rng = state_.rng;
+  return state;
+}
+
+
+void TemporalMemory::compute(TMState &state, const SDR &activeColumns) const {
+  checkColumns_(activeColumns);
+  NTA_CHECK(externalPredictiveInputs_ == 0u)
+    << "TM.compute(state) does not support external predictive inputs.";
+
+  // As activateDendrites(false).
+  const auto activateDendrites = [&]() {
+    connections.computeActivity(state.numActiveConnectedSynapsesForSegment,
+                                state.numActivePotentialSynapsesForSegment,
+                                state.activeCells,
+                                state.touchedSegments);
+    selectSegments_(state);
+  };
+  if (!state.segmentsValid) {
+    activateDendrites();
+  }
+
+
+  // As activateCells(activeColumns, false).
+  state.activeCells.clear();
+  state.winnerCells.clear();
+  const UInt32 stepSeed = parallelLearning_ ? state.rng.getUInt32() : 0u;
+
+  const auto toColumns = [&](const Segment segment) {
+    return connections.cellForSegment(segment) / cellsPerColumn_;
+  };
+  const auto identity = [](const ElemSparse a) {return a;};
+  size_t numPredictedColumns = 0u;
+  for (auto &&columnData : groupBy(activeColumns.getSparse(), identity,
+                                   state.activeSegments,      toColumns,
+                                   state.matchingSegments,    toColumns)) {
+    UInt column;
+    vector<CellIdx>::const_iterator activeColumnsBegin, activeColumnsEnd;
+    vector<Segment>::const_iterator activeBegin, activeEnd, matchingBegin, matchingEnd;
+    std::tie(column, activeColumnsBegin, activeColumnsEnd,
+             activeBegin, activeEnd, matchingBegin, matchingEnd) = columnData;
+    if (activeColumnsBegin == activeColumnsEnd) {
+      continue; //predicted but not active, there is no learning to undo
+    }
+    if (activeBegin != activeEnd) {
+      numPredictedColumns++;
+      predictedColumnCells(state.activeCells, state.winnerCells, connections,
+                           activeBegin, activeEnd);
+    } else if (parallelLearning_) {
+      ColumnStream rng(stepSeed, column, 0u);
+      burstColumnCells(state.activeCells, state.winnerCells, connections, rng, column,
+                       matchingBegin, matchingEnd,
+                       state.numActivePotentialSynapsesForSegment, cellsPerColumn_);
+    } else {
+      burstColumnCells(state.activeCells, state.winnerCells, connections, state.rng, column,
+                       matchingBegin, matchingEnd,
+                       state.numActivePotentialSynapsesForSegment, cellsPerColumn_);
+    }
+  }
+  state.anomaly = rawAnomalyScore(activeColumns.getSparse().size(), numPredictedColumns);
+  // The predictions for the next input.
+  activateDendrites();
+}
+
+
+void TMState::reset() {
+  activeCells.clear();
+  winnerCells.clear();
+  activeSegments.clear();
+  matchingSegments.clear();
+  segmentsValid = false;
+  anomaly = -1.0f;
 }
 
 // ==============================
@@ -593,7 +989,7 @@ vector<CellIdx> TemporalMemory::cellsForColumn(CellIdx column) {
   return cellsInColumn;
 }
 
-vector<CellIdx> TemporalMemory::getActiveCells() const { return activeCells_; }
+vector<CellIdx> TemporalMemory::getActiveCells() const { return state_.activeCells; }
 
 void TemporalMemory::getActiveCells(SDR &activeCells) const
 {
@@ -603,8 +999,18 @@ void TemporalMemory::getActiveCells(SDR &activeCells) const
 
 
 SDR TemporalMemory::getPredictiveCells() const {
+  return getPredictiveCells_(state_);
+}
+
 
-  NTA_CHECK( segmentsValid_ )
+SDR TemporalMemory::getPredictiveCells(const TMState &state) const {
+  return getPredictiveCells_(state);
+}
+
+
+SDR TemporalMemory::getPredictiveCells_(const TMState &state) const {
+
+  NTA_CHECK( state.segmentsValid )
     << "Call TM.activateDendrites() before TM.getPredictiveCells()!";
 
   auto correctDims = getColumnDimensions();
@@ -613,10 +1019,10 @@ SDR TemporalMemory::getPredictiveCells() const {
 
   auto& predictiveCells = predictive.getSparse();
 
-  for (auto segment = activeSegments_.cbegin(); segment != activeSegments_.cend();
+  for (auto segment = state.activeSegments.cbegin(); segment != state.activeSegments.cend();
        segment++) {
     const CellIdx cell = connections.cellForSegment(*segment);
-    if (segment == activeSegments_.begin() || cell != predictiveCells.back()) {
+    if (segment == state.activeSegments.begin() || cell != predictiveCells.back()) {
       predictiveCells.push_back(cell);
     }
   }
@@ -626,7 +1032,7 @@ SDR TemporalMemory::getPredictiveCells() const {
 }
 
 
-vector<CellIdx> TemporalMemory::getWinnerCells() const { return winnerCells_; }
+vector<CellIdx> TemporalMemory::getWinnerCells() const { return state_.winnerCells; }
 
 void TemporalMemory::getWinnerCells(SDR &winnerCells) const
 {
@@ -636,18 +1042,18 @@ void TemporalMemory::getWinnerCells(SDR &winnerCells) const
 
 vector<Segment> TemporalMemory::getActiveSegments() const
 {
-  NTA_CHECK( segmentsValid_ )
+  NTA_CHECK( state_.segmentsValid )
     << "Call TM.activateDendrites() before TM.getActiveSegments()!";
 
-  return activeSegments_;
+  return state_.activeSegments;
 }
 
 vector<Segment> TemporalMemory::getMatchingSegments() const
 {
-  NTA_CHECK( segmentsValid_ )
+  NTA_CHECK( state_.segmentsValid )
     << "Call TM.activateDendrites() before TM.getActiveSegments()!";
 
-  return matchingSegments_;
+  return state_.matchingSegments;
 }
 
 
@@ -724,6 +1130,17 @@ SynapseIdx TemporalMemory::getMaxSynapsesPerSegment() const {
   return maxSynapsesPerSegment_;
 }
 
+bool TemporalMemory::getParallelLearning() const { return parallelLearning_; }
+
+void TemporalMemory::setParallelLearning(bool parallel) { parallelLearning_ = parallel; }
+
+UInt TemporalMemory::getNumThreads() const { return threads_.size(); }
+
+void TemporalMemory::setNumThreads(UInt numThreads) {
+  threads_.resize(numThreads);
+  connections.setNumThreads(numThreads);
+}
+
 UInt TemporalMemory::version() const { return TM_VERSION; }
 
 
@@ -732,8 +1149,14 @@ getComparableSegmentSet(const Connections &connections,
                         const vector<Segment> &segments) {
   set<pair<CellIdx, SynapseIdx>> segmentSet;
   for (Segment segment : segments) {
-    segmentSet.emplace(connections.cellForSegment(segment),
-                       connections.idxOnCellForSegment(segment));
+    // The index in the order of compareSegments(), which save and load keep,
+    // unlike idxOnCellForSegment() after a segment was destroyed.
+    const CellIdx cell = connections.cellForSegment(segment);
+    SynapseIdx idx = 0;
+    for (const Segment other : connections.segmentsForCell(cell)) {
+      if (connections.compareSegments(other, segment)) idx++;
+    }
+    segmentSet.emplace(cell, idx);
   }
   return segmentSet;
 }
@@ -750,11 +1173,11 @@ bool TemporalMemory::operator==(const TemporalMemory &other) const {
       permanenceIncrement_ != other.permanenceIncrement_ ||
       permanenceDecrement_ != other.permanenceDecrement_ ||
       predictedSegmentDecrement_ != other.predictedSegmentDecrement_ ||
-      activeCells_ != other.activeCells_ ||
-      winnerCells_ != other.winnerCells_ ||
+      state_.activeCells != other.state_.activeCells ||
+      state_.winnerCells != other.state_.winnerCells ||
       maxSegmentsPerCell_ != other.maxSegmentsPerCell_ ||
       maxSynapsesPerSegment_ != other.maxSynapsesPerSegment_ ||
-      anomaly_ != other.anomaly_ ) {
+      state_.anomaly != other.state_.anomaly ) {
     return false;
   }
 
@@ -762,10 +1185,10 @@ bool TemporalMemory::operator==(const TemporalMemory &other) const {
     return false;
   }
 
-  if (getComparableSegmentSet(connections, activeSegments_) !=
-          getComparableSegmentSet(other.connections, other.activeSegments_) ||
-      getComparableSegmentSet(connections, matchingSegments_) !=
-          getComparableSegmentSet(other.connections, other.matchingSegments_)) {
+  if (getComparableSegmentSet(connections, state_.activeSegments) !=
+          getComparableSegmentSet(other.connections, other.state_.activeSegments) ||
+      getComparableSegmentSet(connections, state_.matchingSegments) !=
+          getComparableSegmentSet(other.connections, other.state_.matchingSegments)) {
     return false;
   }
 
@@ -26,6 +26,7 @@
 #include <htm/types/Types.hpp>
 #include <htm/types/Sdr.hpp>
 #include <htm/types/Serializable.hpp>
+#include <htm/utils/Parallel.hpp>
 #include <htm/utils/Random.hpp>
 #include <vector>
 
@@ -35,6 +36,47 @@ namespace htm {
 using namespace std;
 using namespace htm;
 
+class TemporalMemory;
+
+/**
+ * The dynamic state of a TemporalMemory for one input stream: the active and
+ * winner cells, the active and matching segments with their synapse counts,
+ * the anomaly and the random generator. The TemporalMemory keeps its own
+ * state, more states let one trained model run on several streams, see
+ * TemporalMemory::compute(TMState &, const SDR &).
+ *
+ * Its size is a few counters per segment, the model (connections) is much
+ * larger. A state belongs to the model which created it.
+ */
+class TMState
+{
+public:
+  /**
+   * Forgets the active cells, as TemporalMemory::reset().
+   */
+  void reset();
+
+  const vector<CellIdx> &getActiveCells() const { return activeCells; }
+  const vector<CellIdx> &getWinnerCells() const { return winnerCells; }
+  Real getAnomaly() const { return anomaly; }
+
+private:
+  friend class TemporalMemory;
+
+  vector<CellIdx> activeCells;
+  vector<CellIdx> winnerCells;
+  bool segmentsValid = false;
+  vector<Segment> activeSegments;
+  vector<Segment> matchingSegments;
+  // Per segment, see Connections::computeActivity. Only the touchedSegments
+  // have nonzero counts.
+  vector<SynapseIdx> numActiveConnectedSynapsesForSegment;
+  vector<SynapseIdx> numActivePotentialSynapsesForSegment;
+  vector<Segment> touchedSegments;
+  Real anomaly = -1.0f;
+  Random rng;
+};
+
 /**
  * Temporal Memory implementation in C++.
  *
@@ -181,7 +223,7 @@ public:
 
   /**
    * Calculate the active cells, using the current active columns and
-   * dendrite segments. Grow and reinforce synapses.
+   * dendrite segments. Grow and reinforce synapses. Updates the anomaly.
    *
    * @param activeColumns
    * A sorted list of active column indices.
@@ -254,6 +296,36 @@ public:
   virtual void compute(const SDR &activeColumns, 
                        const bool learn = true);
 
+  /**
+   * Creates a state for compute(TMState &, const SDR &), as this TM after
+   * reset(), with a copy of its random generator.
+   */
+  TMState createState() const;
+
+  /**
+   * Performs one time step of inference, on the state of one input stream
+   * instead of the state of this TM: same as compute(activeColumns, false)
+   * of a copy of this TM with that state. Afterwards the state has the
+   * active segments for the next input, see getPredictiveCells(state).
+   *
+   * Does not modify the TM, several threads can call it at once with
+   * different states. External predictive inputs are not supported.
+   *
+   * @param state
+   * Created by createState() of this TM, which must not learn or change
+   * while the state is in use.
+   *
+   * @param activeColumns
+   * Sorted SDR of active columns.
+   */
+  void compute(TMState &state, const SDR &activeColumns) const;
+
+  /**
+   * @return SDR with the predictive cells of the state, as
+   * getPredictiveCells().
+   */
+  SDR getPredictiveCells(const TMState &state) const;
+
   // ==============================
   //  Helper functions
   // ==============================
@@ -419,6 +491,36 @@ public:
    */
   SynapseIdx getMaxSynapsesPerSegment() const;
 
+  /**
+   * Enables parallel learning: activateCells() splits the active and
+   * predicted columns into contiguous ranges, one per thread (see
+   * setNumThreads).
+   *
+   * Instead of drawing from the shared random generator in the order of the
+   * columns, each column draws from its own stream, seeded from the column
+   * and one number drawn per step. The workers only read the connections:
+   * they choose the winner cells and the new synapses. The permanences are
+   * adapted with Connections::adaptSegments(), and the new segments and
+   * synapses are created afterwards, in the order of the columns. So the
+   * results depend on this setting, but not on the number of threads.
+   *
+   * This is a runtime setting and is not serialized. Default false, which
+   * keeps the results of the serial algorithm.
+   */
+  void setParallelLearning(bool parallel);
+  bool getParallelLearning() const;
+
+  /**
+   * Sets the number of threads of activateCells() with parallel learning
+   * (see setParallelLearning), and of the connections (see
+   * Connections::setNumThreads). The results do not depend on it.
+   *
+   * This is a runtime setting and is not serialized. Default 1 (serial), 0
+   * means use all hardware threads.
+   */
+  void setNumThreads(UInt numThreads);
+  UInt getNumThreads() const;
+
   /**
    * Save (serialize) / Load (deserialize) the current state of the spatial pooler
    * to the specified stream.
@@ -462,41 +564,41 @@ public:
        CEREAL_NVP(externalPredictiveInputs_),
        CEREAL_NVP(maxSegmentsPerCell_),
        CEREAL_NVP(maxSynapsesPerSegment_),
-       CEREAL_NVP(rng_),
+       cereal::make_nvp("rng_", state_.rng),
        CEREAL_NVP(columnDimensions_),
-       CEREAL_NVP(activeCells_),
-       CEREAL_NVP(winnerCells_),
-       CEREAL_NVP(segmentsValid_),
-       CEREAL_NVP(anomaly_),
+       cereal::make_nvp("activeCells_", state_.activeCells),
+       cereal::make_nvp("winnerCells_", state_.winnerCells),
+       cereal::make_nvp("segmentsValid_", state_.segmentsValid),
+       cereal::make_nvp("anomaly_", state_.anomaly),
        CEREAL_NVP(connections));
 
-    cereal::size_type numActiveSegments = activeSegments_.size();
+    cereal::size_type numActiveSegments = state_.activeSegments.size();
     ar( cereal::make_size_tag(numActiveSegments));
-    for (Segment segment : activeSegments_) {
+    for (Segment segment : state_.activeSegments) {
       struct container_ar c;
       c.cell = connections.cellForSegment(segment);
-      const vector<Segment> &segments = connections.segmentsForCell(c.cell);
+      const SegmentList &segments = connections.segmentsForCell(c.cell);
 
       c.idx = (SegmentIdx)std::distance(
                           segments.begin(), 
                           std::find(segments.begin(), 
                           segments.end(), segment));
-      c.syn = numActiveConnectedSynapsesForSegment_[segment];
+      c.syn = state_.numActiveConnectedSynapsesForSegment[segment];
       ar(c); // to keep iteration counts correct, only serialize one item per iteration.
     }
 
-    cereal::size_type numMatchingSegments = matchingSegments_.size();
+    cereal::size_type numMatchingSegments = state_.matchingSegments.size();
     ar(cereal::make_size_tag(numMatchingSegments));
-    for (Segment segment : matchingSegments_) {
+    for (Segment segment : state_.matchingSegments) {
       struct container_ar c;
       c.cell = connections.cellForSegment(segment);
-      const vector<Segment> &segments = connections.segmentsForCell(c.cell);
+      const SegmentList &segments = connections.segmentsForCell(c.cell);
 
       c.idx = (SegmentIdx)std::distance(
                           segments.begin(), 
                           std::find(segments.begin(), 
                           segments.end(), segment));
-      c.syn = numActivePotentialSynapsesForSegment_[segment];
+      c.syn = state_.numActivePotentialSynapsesForSegment[segment];
       ar(c);
     }
 
@@ -517,37 +619,39 @@ public:
        CEREAL_NVP(externalPredictiveInputs_),
        CEREAL_NVP(maxSegmentsPerCell_),
        CEREAL_NVP(maxSynapsesPerSegment_),
-       CEREAL_NVP(rng_),
+       cereal::make_nvp("rng_", state_.rng),
        CEREAL_NVP(columnDimensions_),
-       CEREAL_NVP(activeCells_),
-       CEREAL_NVP(winnerCells_),
-       CEREAL_NVP(segmentsValid_),
-       CEREAL_NVP(anomaly_),
+       cereal::make_nvp("activeCells_", state_.activeCells),
+       cereal::make_nvp("winnerCells_", state_.winnerCells),
+       cereal::make_nvp("segmentsValid_", state_.segmentsValid),
+       cereal::make_nvp("anomaly_", state_.anomaly),
        CEREAL_NVP(connections));
 
-    numActiveConnectedSynapsesForSegment_.assign(connections.segmentFlatListLength(), 0);
+    state_.numActiveConnectedSynapsesForSegment.assign(connections.segmentFlatListLength(), 0);
     cereal::size_type numActiveSegments;
     ar(cereal::make_size_tag(numActiveSegments));
-    activeSegments_.resize(static_cast<size_t>(numActiveSegments));
+    state_.activeSegments.resize(static_cast<size_t>(numActiveSegments));
     for (size_t i = 0; i < static_cast<size_t>(numActiveSegments); i++) {
       struct container_ar c;
       ar(c);  
       Segment segment = connections.getSegment(c.cell, c.idx);
-      activeSegments_[i] = segment;
-      numActiveConnectedSynapsesForSegment_[segment] = c.syn;
+      state_.activeSegments[i] = segment;
+      state_.numActiveConnectedSynapsesForSegment[segment] = c.syn;
     }
 
-    numActivePotentialSynapsesForSegment_.assign(connections.segmentFlatListLength(), 0);
+    state_.numActivePotentialSynapsesForSegment.assign(connections.segmentFlatListLength(), 0);
     cereal::size_type numMatchingSegments;
     ar(cereal::make_size_tag(numMatchingSegments));
-    matchingSegments_.resize(static_cast<size_t>(numMatchingSegments));
+    state_.matchingSegments.resize(static_cast<size_t>(numMatchingSegments));
     for (size_t i = 0; i < static_cast<size_t>(numMatchingSegments); i++) {
       struct container_ar c;
       ar(c);
       Segment segment = connections.getSegment(c.cell, c.idx);
-      matchingSegments_[i] = segment;
-      numActivePotentialSynapsesForSegment_[segment] = c.syn;
+      state_.matchingSegments[i] = segment;
+      state_.numActivePotentialSynapsesForSegment[segment] = c.syn;
     }
+    state_.touchedSegments = state_.matchingSegments;
+    state_.touchedSegments.insert(state_.touchedSegments.end(), state_.activeSegments.begin(), state_.activeSegments.end());
   }
 
 
@@ -617,17 +721,60 @@ protected:
   SynapseIdx maxSynapsesPerSegment_;
 
 private:
-  vector<CellIdx> activeCells_;
-  vector<CellIdx> winnerCells_;
-  bool segmentsValid_;
-  vector<Segment> activeSegments_;
-  vector<Segment> matchingSegments_;
-  vector<SynapseIdx> numActiveConnectedSynapsesForSegment_;
-  vector<SynapseIdx> numActivePotentialSynapsesForSegment_;
+  /**
+   * activateCells() with parallel learning, see setParallelLearning().
+   */
+  void activateCellsParallel_(const vector<CellIdx> &activeColumns,
+                              const SDR &prevActiveCells,
+                              const vector<CellIdx> &prevWinnerCells,
+                              const bool learn);
 
-  Real anomaly_;
+  /**
+   * Checks the dimensions of the active columns.
+   */
+  void checkColumns_(const SDR &activeColumns) const;
 
-  Random rng_;
+  /**
+   * Finds the active and matching segments of the state, from its synapse
+   * counts.
+   */
+  void selectSegments_(TMState &state) const;
+
+  /**
+   * Implements getPredictiveCells().
+   */
+  SDR getPredictiveCells_(const TMState &state) const;
+
+  TMState state_;
+
+  // Scratch buffers of compute(), reused so that a step does not allocate.
+  // Not serialized. The SDRs start as placeholders of size zero, a default
+  // constructed SDR can not be copied.
+  SDR noExternalInputs_ {vector<UInt>{0u}};
+  SDR prevActiveCells_ {vector<UInt>{0u}};
+  vector<CellIdx> prevWinnerCells_;
+  vector<CellIdx> candidates_; //see growSynapses
+
+  // Parallel learning, runtime settings, not serialized.
+  bool parallelLearning_ = false;
+  ThreadPool threads_;
+  // A segment to adapt and grow synapses on, or a new segment.
+  struct LearningSegment {
+    Segment segment;
+    CellIdx cell;
+    bool newSegment;        //on cell
+    bool punish;            //adapt with predictedSegmentDecrement_
+    SynapseIdx numGrow;     //desired new synapses
+    UInt stream;            //the substream of the column which chooses them
+    Int overrun;            //synapses to destroy first
+    vector<CellIdx> growCells;
+  };
+  struct ColumnWorker {
+    vector<CellIdx> activeCells;
+    vector<CellIdx> winnerCells;
+    vector<LearningSegment> learning;
+  };
+  vector<ColumnWorker> columnWorkers_;
 
 public:
   Connections connections;
@@ -636,10 +783,10 @@ public:
    *  anomaly score computed for the current inputs
    *  (auto-updates after each call to TM::compute())
    *
-   *  @return a float value from computeRawAnomalyScore()
+   *  @return a float value, the same as computeRawAnomalyScore()
    *  from Anomaly.hpp
    */
-  const Real &anomaly = anomaly_;
+  const Real &anomaly = state_.anomaly;
 };
 
 } // namespace htm
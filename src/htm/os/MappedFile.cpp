@@ -0,0 +1,106 @@
+/* ---------------------------------------------------------------------
+ * HTM Community Edition of NuPIC
+ * Copyright (C) 2019, The HTM Community
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ * --------------------------------------------------------------------- */
+
+/** @file
+ * Implementation of the MappedFile class
+ */
+
+#include <htm/os/MappedFile.hpp>
+#include <htm/os/OS.hpp>
+#include <htm/utils/Log.hpp>
+
+#if defined(NTA_OS_WINDOWS)
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace htm {
+
+#if defined(NTA_OS_WINDOWS)
+
+MappedFile::MappedFile(const std::string &path) : path_(path) {
+  HANDLE file = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    NTA_THROW << "MappedFile: can not open '" << path << "': " << OS::getErrorMessage();
+  }
+  LARGE_INTEGER size;
+  if (!::GetFileSizeEx(file, &size)) {
+    ::CloseHandle(file);
+    NTA_THROW << "MappedFile: can not get the size of '" << path << "': " << OS::getErrorMessage();
+  }
+  size_ = static_cast<size_t>(size.QuadPart);
+  file_ = file;
+  if (size_ == 0u) return; //an empty file can not be mapped, nothing to read anyway
+
+  HANDLE mapping = ::CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping == NULL) {
+    ::CloseHandle(file);
+    NTA_THROW << "MappedFile: can not map '" << path << "': " << OS::getErrorMessage();
+  }
+  mapping_ = mapping;
+  data_ = static_cast<const char *>(::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  if (data_ == nullptr) {
+    ::CloseHandle(mapping);
+    ::CloseHandle(file);
+    NTA_THROW << "MappedFile: can not map '" << path << "': " << OS::getErrorMessage();
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) ::UnmapViewOfFile(data_);
+  if (mapping_ != nullptr) ::CloseHandle(static_cast<HANDLE>(mapping_));
+  if (file_ != nullptr) ::CloseHandle(static_cast<HANDLE>(file_));
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &path) : path_(path) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    NTA_THROW << "MappedFile: can not open '" << path << "': " << OS::getErrorMessage();
+  }
+  struct stat info;
+  if (::fstat(fd, &info) != 0) {
+    ::close(fd);
+    NTA_THROW << "MappedFile: can not get the size of '" << path << "': " << OS::getErrorMessage();
+  }
+  size_ = static_cast<size_t>(info.st_size);
+  if (size_ > 0u) { //an empty file can not be mapped, nothing to read anyway
+    void *addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      ::close(fd);
+      NTA_THROW << "MappedFile: can not map '" << path << "': " << OS::getErrorMessage();
+    }
+    data_ = static_cast<const char *>(addr);
+  }
+  ::close(fd); //the mapping stays valid
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    ::munmap(const_cast<char *>(data_), size_);
+  }
+}
+
+#endif
+
+} // namespace htm
@@ -0,0 +1,64 @@
+/* ---------------------------------------------------------------------
+ * HTM Community Edition of NuPIC
+ * Copyright (C) 2019, The HTM Community
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ * --------------------------------------------------------------------- */
+
+/** @file
+ * MappedFile interface
+ */
+
+#ifndef NTA_MAPPED_FILE_HPP
+#define NTA_MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace htm {
+
+/**
+ * @Responsibility
+ * Read-only memory mapping of a whole file.
+ *
+ * @Description
+ * The contents of the file are available through data() for the lifetime
+ * of the object, and are paged in by the OS on first access. The mapping
+ * starts at a page boundary, so it is suitably aligned for any type.
+ * Throws if the file can not be opened or mapped.
+ */
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+  const std::string &path() const { return path_; }
+
+private:
+  std::string path_;
+  const char *data_ = nullptr;
+  size_t size_ = 0u;
+#if defined(NTA_OS_WINDOWS)
+  void *file_    = nullptr;
+  void *mapping_ = nullptr;
+#endif
+};
+
+} // namespace htm
+
+#endif // NTA_MAPPED_FILE_HPP
@@ -0,0 +1,228 @@
+/* ---------------------------------------------------------------------
+ * HTM Community Edition of NuPIC
+ * Copyright (C) 2019, The HTM Community
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ * ---------------------------------------------------------------------- */
+
+/** @file
+ * Implementation of the BoxFilter
+ */
+
+#include <algorithm>
+
+#include <htm/utils/BoxFilter.hpp>
+#include <htm/utils/Log.hpp>
+
+using std::vector;
+
+namespace htm {
+
+BoxFilter::BoxFilter(const vector<UInt> &dimensions, const UInt radius, const bool wrapAround)
+    : dimensions_(dimensions), strides_(dimensions.size()), radius_(radius),
+      wrapAround_(wrapAround), size_(1u) {
+  NTA_CHECK(!dimensions_.empty()) << "BoxFilter: no dimensions.";
+  for (size_t dim = dimensions_.size(); dim-- > 0;) {
+    NTA_CHECK(dimensions_[dim] > 0u) << "BoxFilter: empty dimension " << dim;
+    strides_[dim] = size_;
+    size_ *= dimensions_[dim];
+  }
+}
+
+
+Int64 BoxFilter::first_(const size_t dim, const UInt x) const {
+  const Int64 first = (Int64)x - (Int64)radius_;
+  return wrapAround_ ? first : std::max<Int64>(first, 0);
+}
+
+
+UInt BoxFilter::length_(const size_t dim, const UInt x) const {
+  const UInt64 n    = dimensions_[dim];
+  const UInt64 full = 2u * (UInt64)radius_ + 1u;
+  if (wrapAround_) {
+    return (UInt)std::min(full, n);
+  }
+  const UInt64 last = std::min<UInt64>(n - 1u, (UInt64)x + radius_);
+  return (UInt)(last + 1u - (UInt64)first_(dim, x));
+}
+
+
+void BoxFilter::toCoordinates_(UInt index, vector<UInt> &coords) const {
+  coords.resize(dimensions_.size());
+  for (size_t dim = dimensions_.size(); dim-- > 0;) {
+    coords[dim] = index % dimensions_[dim];
+    index /= dimensions_[dim];
+  }
+}
+
+
+UInt BoxFilter::volume(UInt index) const {
+  NTA_ASSERT(index < size_);
+  UInt volume = 1u;
+  for (size_t dim = dimensions_.size(); dim-- > 0;) {
+    volume *= length_(dim, index % dimensions_[dim]);
+    index /= dimensions_[dim];
+  }
+  return volume;
+}
+
+
+void BoxFilter::sum(const vector<Real> &in, vector<Real> &out) const {
+  NTA_CHECK(in.size() == size_) << "BoxFilter: expected " << size_ << " values, got " << in.size();
+  vector<Real64> current(in.begin(), in.end());
+  vector<Real64> next(size_);
+  vector<Real64> prefix;
+
+  // One dimension at a time: the box sum is the sum over the lines of the
+  // sums along the lines.
+  for (size_t dim = 0; dim < dimensions_.size(); dim++) {
+    const UInt   n      = dimensions_[dim];
+    const size_t stride = strides_[dim];
+    prefix.resize(n + 1u);
+    for (size_t outer = 0; outer < size_; outer += n * stride) {
+      for (size_t inner = 0; inner < stride; inner++) {
+        const size_t base = outer + inner;
+        prefix[0] = 0.0;
+        for (UInt x = 0; x < n; x++) {
+          prefix[x + 1u] = prefix[x] + current[base + x * stride];
+        }
+        for (UInt x = 0; x < n; x++) {
+          const Int64 first = first_(dim, x);
+          const UInt  start = (UInt)(((first % n) + n) % n);
+          const UInt  end   = start + length_(dim, x);
+          next[base + x * stride] = end <= n
+            ? prefix[end] - prefix[start]
+            : (prefix[n] - prefix[start]) + prefix[end - n];
+        }
+      }
+    }
+    current.swap(next);
+  }
+
+  out.resize(size_);
+  for (size_t i = 0; i < size_; i++) {
+    out[i] = (Real)current[i];
+  }
+}
+
+
+void BoxFilter::max(const vector<Real> &in, vector<Real> &out) const {
+  NTA_CHECK(in.size() == size_) << "BoxFilter: expected " << size_ << " values, got " << in.size();
+  vector<Real> current(in);
+  vector<Real> next(size_);
+  vector<Real> line;
+  vector<Int64> window; //monotone queue of positions, decreasing values
+
+  for (size_t dim = 0; dim < dimensions_.size(); dim++) {
+    const UInt   n      = dimensions_[dim];
+    const size_t stride = strides_[dim];
+    line.resize(n);
+    window.resize(2u * (size_t)n + 1u);
+    for (size_t outer = 0; outer < size_; outer += n * stride) {
+      for (size_t inner = 0; inner < stride; inner++) {
+        const size_t base = outer + inner;
+        for (UInt x = 0; x < n; x++) {
+          line[x] = current[base + x * stride];
+        }
+        // Both ends of the box only move forward with x, so each position
+        // enters and leaves the queue once.
+        auto value = [&](const Int64 position) { return line[(size_t)(((position % n) + n) % n)]; };
+        size_t head = 0u, tail = 0u;
+        Int64 nextPosition = first_(dim, 0u);
+        for (UInt x = 0; x < n; x++) {
+          const Int64 first = first_(dim, x);
+          const Int64 end   = first + length_(dim, x);
+          for (; nextPosition < end; nextPosition++) {
+            const Real v = value(nextPosition);
+            while (tail > head && value(window[tail - 1u]) <= v) {
+              tail--;
+            }
+            window[tail++] = nextPosition;
+          }
+          while (window[head] < first) {
+            head++;
+          }
+          next[base + x * stride] = value(window[head]);
+        }
+      }
+    }
+    current.swap(next);
+  }
+  out.swap(current);
+}
+
+
+BoxFilter::Counter::Counter(const BoxFilter &box)
+    : box_(box), tree_(box.size_, 0u) {}
+
+
+void BoxFilter::Counter::clear() {
+  std::fill(tree_.begin(), tree_.end(), 0u);
+}
+
+
+void BoxFilter::Counter::add(const UInt index) {
+  NTA_ASSERT(index < box_.size_);
+  box_.toCoordinates_(index, coords_);
+  add_(0u, 0u, coords_);
+}
+
+
+UInt BoxFilter::Counter::count(const UInt index) const {
+  NTA_ASSERT(index < box_.size_);
+  box_.toCoordinates_(index, coords_);
+  return sum_(0u, 0u, coords_);
+}
+
+
+// The tree is a Fenwick tree along each dimension, nested in the order of
+// the dimensions; base is the flat position of the enclosing nodes.
+void BoxFilter::Counter::add_(const size_t dim, const size_t base, const vector<UInt> &coords) {
+  if (dim == coords.size()) {
+    tree_[base]++;
+    return;
+  }
+  const UInt n = box_.dimensions_[dim];
+  for (UInt i = coords[dim] + 1u; i <= n; i += i & (0u - i)) {
+    add_(dim + 1u, base * n + (i - 1u), coords);
+  }
+}
+
+
+UInt BoxFilter::Counter::sum_(const size_t dim, const size_t base, const vector<UInt> &coords) const {
+  if (dim == coords.size()) {
+    return tree_[base];
+  }
+  const UInt  n     = box_.dimensions_[dim];
+  const Int64 first = box_.first_(dim, coords[dim]);
+  const UInt  start = (UInt)(((first % n) + n) % n);
+  const UInt  end   = start + box_.length_(dim, coords[dim]);
+  if (end <= n) {
+    return prefix_(dim, base, end, coords) - prefix_(dim, base, start, coords);
+  }
+  return prefix_(dim, base, n, coords) - prefix_(dim, base, start, coords)
+       + prefix_(dim, base, end - n, coords);
+}
+
+
+UInt BoxFilter::Counter::prefix_(const size_t dim, const size_t base, const UInt end,
+                                 const vector<UInt> &coords) const {
+  const UInt n = box_.dimensions_[dim];
+  UInt total = 0u;
+  for (UInt i = end; i > 0u; i -= i & (0u - i)) {
+    total += sum_(dim + 1u, base * n + (i - 1u), coords);
+  }
+  return total;
+}
+
+} // end namespace htm
@@ -0,0 +1,117 @@
+/* ---------------------------------------------------------------------
+ * HTM Community Edition of NuPIC
+ * Copyright (C) 2019, The HTM Community
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ * ---------------------------------------------------------------------- */
+
+/** @file
+ * Box filters over N-dimensional grids
+ */
+
+#ifndef NTA_BOX_FILTER_HPP
+#define NTA_BOX_FILTER_HPP
+
+#include <vector>
+
+#include <htm/types/Types.hpp>
+
+namespace htm {
+
+/**
+ * Sums, maxima and counts over the box of all points within a radius of each
+ * point of an N-dimensional grid, at a cost which does not depend on the
+ * radius.
+ *
+ * The box of a point is the same set of points as visited by
+ * Neighborhood(point, radius, dimensions), or by WrappingNeighborhood if
+ * wrapAround is set: along each dimension it covers the coordinates within
+ * the radius, clipped at the borders, or taken modulo the dimension (each
+ * coordinate at most once) when wrapping.
+ *
+ * Points are flat indices into the grid, in the layout of
+ * coordinatesFromIndex() (the last dimension is the fastest changing).
+ *
+ * Example Usage:
+ *    BoxFilter box({64u, 64u}, 5u, false);
+ *    box.sum(values, sums); // sums[i] = sum of values over the box of i
+ *    box.max(values, maxs); // maxs[i] = max of values over the box of i
+ */
+class BoxFilter {
+public:
+  BoxFilter(const std::vector<UInt> &dimensions, const UInt radius, const bool wrapAround);
+
+  /**
+   * Number of points in the box of point @param index, itself included.
+   */
+  UInt volume(const UInt index) const;
+
+  /**
+   * out[i] = sum of in over the box of i. The sums are accumulated in double
+   * precision, separately along each dimension (prefix sums).
+   */
+  void sum(const std::vector<Real> &in, std::vector<Real> &out) const;
+
+  /**
+   * out[i] = max of in over the box of i. Separable sliding window maxima.
+   */
+  void max(const std::vector<Real> &in, std::vector<Real> &out) const;
+
+  /**
+   * A set of grid points, which counts its members within the box of any
+   * point. Both operations take O(log(dimension)) per dimension (an
+   * N-dimensional Fenwick tree).
+   */
+  class Counter {
+  public:
+    explicit Counter(const BoxFilter &box);
+
+    /** Adds the point to the set, a point may be added several times. */
+    void add(const UInt index);
+
+    /** Number of points of the set in the box of @param index. */
+    UInt count(const UInt index) const;
+
+    /** Empties the set. */
+    void clear();
+
+  private:
+    void add_(const size_t dim, const size_t base, const std::vector<UInt> &coords);
+    UInt sum_(const size_t dim, const size_t base, const std::vector<UInt> &coords) const;
+    UInt prefix_(const size_t dim, const size_t base, const UInt end,
+                 const std::vector<UInt> &coords) const;
+
+    const BoxFilter &box_;
+    std::vector<UInt> tree_;
+    mutable std::vector<UInt> coords_;
+  };
+
+private:
+  /**
+   * The box of coordinate x along dimension dim is [first, first + length),
+   * modulo the dimension when wrapping (first may then be negative).
+   */
+  Int64 first_(const size_t dim, const UInt x) const;
+  UInt length_(const size_t dim, const UInt x) const;
+
+  void toCoordinates_(UInt index, std::vector<UInt> &coords) const;
+
+  std::vector<UInt> dimensions_;
+  std::vector<size_t> strides_;
+  UInt radius_;
+  bool wrapAround_;
+  size_t size_;
+};
+
+} // end namespace htm
+#endif // NTA_BOX_FILTER_HPP
@@ -0,0 +1,132 @@
+/* ---------------------------------------------------------------------
+ * HTM Community Edition of NuPIC
+ * Copyright (C) 2019, The HTM Community
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ * ---------------------------------------------------------------------- */
+
+/** @file
+ * Implementation of the ThreadPool
+ */
+
+#include <htm/utils/Parallel.hpp>
+
+namespace htm {
+
+ThreadPool::ThreadPool(const UInt numThreads) {
+  resize(numThreads);
+}
+
+
+ThreadPool::ThreadPool(const ThreadPool &other) {
+  resize(other.numThreads_);
+}
+
+
+ThreadPool &ThreadPool::operator=(const ThreadPool &other) {
+  if (this != &other) {
+    resize(other.numThreads_);
+  }
+  return *this;
+}
+
+
+ThreadPool::~ThreadPool() {
+  stop_();
+}
+
+
+void ThreadPool::resize(const UInt numThreads) {
+  const UInt size = numThreads == 0u ? hardwareThreads() : numThreads;
+  if (size == numThreads_ && threads_.size() + 1u == size) {
+    return;
+  }
+  stop_();
+  numThreads_ = size;
+  stopping_ = false;
+  threads_.reserve(size - 1u);
+  for (UInt worker = 1u; worker < size; worker++) {
+    threads_.emplace_back(&ThreadPool::work_, this, worker, step_);
+  }
+}
+
+
+void ThreadPool::stop_() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  start_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+}
+
+
+void ThreadPool::run_(const UInt numWorkers, const std::function<void(UInt)> &task) {
+  errors_.assign(numWorkers, nullptr);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_       = &task;
+    numWorkers_ = numWorkers;
+    pending_    = numWorkers - 1u;
+    step_++;
+  }
+  start_.notify_all();
+
+  try {
+    task(0u);
+  } catch (...) {
+    errors_[0] = std::current_exception();
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return pending_ == 0u; });
+    task_ = nullptr;
+  }
+  for (const auto &error : errors_) {
+    if (error) std::rethrow_exception(error);
+  }
+}
+
+
+void ThreadPool::work_(const UInt worker, UInt64 seen) {
+  for (;;) {
+    const std::function<void(UInt)> *task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_.wait(lock, [&]() { return stopping_ || step_ != seen; });
+      if (stopping_) {
+        return;
+      }
+      seen = step_;
+      if (worker >= numWorkers_) {
+        continue; //not needed for this step
+      }
+      task = task_;
+    }
+    try {
+      (*task)(worker);
+    } catch (...) {
+      errors_[worker] = std::current_exception();
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_--;
+    }
+    done_.notify_one();
+  }
+}
+
+} // end namespace htm
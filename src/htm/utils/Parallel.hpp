@@ -0,0 +1,159 @@
+/* ---------------------------------------------------------------------
+ * HTM Community Edition of NuPIC
+ * Copyright (C) 2019, The HTM Community
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ * ---------------------------------------------------------------------- */
+
+#ifndef NTA_PARALLEL_HPP
+#define NTA_PARALLEL_HPP
+
+#include <algorithm> // min
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility> // pair
+#include <vector>
+
+#include <htm/types/Types.hpp>
+
+namespace htm {
+/** @file
+ * Minimal fork-join helpers used by the algorithms' optional multi-threaded
+ * code paths.
+ *
+ * The algorithms stay deterministic: work is split into fixed, contiguous
+ * ranges which depend only on the problem size and the number of workers,
+ * never on the scheduling of the threads.
+ */
+
+/**
+ * Returns the number of hardware threads, at least 1.
+ */
+inline UInt hardwareThreads() {
+  const auto n = std::thread::hardware_concurrency();
+  return n == 0u ? 1u : static_cast<UInt>(n);
+}
+
+/**
+ * Returns the half-open range [begin, end) of worker @param worker when
+ * @param size items are split into @param numWorkers contiguous parts.
+ */
+inline std::pair<size_t, size_t> workerRange(const size_t size, const UInt worker,
+                                             const UInt numWorkers) {
+  return std::make_pair(size * worker / numWorkers, size * (worker + 1u) / numWorkers);
+}
+
+/**
+ * Calls task(worker) for each worker in [0, numWorkers), and waits until all
+ * of them have finished. Worker 0 runs on the calling thread.
+ * The first exception thrown by any of the tasks is re-thrown here.
+ */
+template <typename Task>
+void parallelFor(const UInt numWorkers, const Task &task) {
+  if (numWorkers <= 1u) {
+    task(0u);
+    return;
+  }
+  std::vector<std::exception_ptr> errors(numWorkers);
+  std::vector<std::thread> threads;
+  threads.reserve(numWorkers - 1u);
+  for (UInt worker = 1u; worker < numWorkers; worker++) {
+    threads.emplace_back([&task, &errors, worker]() {
+      try {
+        task(worker);
+      } catch (...) {
+        errors[worker] = std::current_exception();
+      }
+    });
+  }
+  try {
+    task(0u);
+  } catch (...) {
+    errors[0] = std::current_exception();
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (const auto &error : errors) {
+    if (error) std::rethrow_exception(error);
+  }
+}
+
+/**
+ * A fixed set of worker threads for repeated fork-join steps, which avoids
+ * starting new threads on every call of parallelFor.
+ *
+ * A pool of size N runs tasks on the calling thread (worker 0) and on N - 1
+ * threads of its own, which wait while there is no work. A pool of size 1 has
+ * no threads and runs all tasks on the calling thread.
+ *
+ * Copies of a pool start their own threads, so objects holding a pool stay
+ * copyable and their copies do not share threads. A pool is not reentrant: a
+ * task must not call parallelFor on the pool that runs it, and a pool must
+ * only be used from one thread at a time.
+ */
+class ThreadPool {
+public:
+  /**
+   * @param numThreads: the size of the pool, 0 for hardwareThreads().
+   */
+  explicit ThreadPool(UInt numThreads = 1u);
+  ThreadPool(const ThreadPool &other);
+  ThreadPool &operator=(const ThreadPool &other);
+  ~ThreadPool();
+
+  /**
+   * Changes the size of the pool, 0 for hardwareThreads().
+   */
+  void resize(UInt numThreads);
+  UInt size() const noexcept { return numThreads_; }
+
+  /**
+   * Calls task(worker) for each worker in [0, numWorkers), and waits until
+   * all of them have finished. numWorkers is capped at size(). Worker 0 runs
+   * on the calling thread. The first exception thrown by any of the tasks is
+   * re-thrown here.
+   */
+  template <typename Task>
+  void parallelFor(const UInt numWorkers, const Task &task) {
+    if (numWorkers <= 1u || numThreads_ <= 1u) {
+      task(0u);
+      return;
+    }
+    run_(std::min(numWorkers, numThreads_), std::function<void(UInt)>(std::cref(task)));
+  }
+
+private:
+  void run_(UInt numWorkers, const std::function<void(UInt)> &task);
+  void work_(UInt worker, UInt64 seen); //seen: the last step before starting
+  void stop_();
+
+  UInt numThreads_ = 1u;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+  // The current step, guarded by mutex_.
+  const std::function<void(UInt)> *task_ = nullptr;
+  UInt numWorkers_ = 0u;
+  UInt pending_ = 0u;
+  UInt64 step_ = 0u;
+  bool stopping_ = false;
+  std::vector<std::exception_ptr> errors_;
+};
+
+} // end namespace htm
+#endif // NTA_PARALLEL_HPP
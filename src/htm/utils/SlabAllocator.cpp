@@ -0,0 +1,244 @@
+/* ---------------------------------------------------------------------
+ * HTM Community Edition of NuPIC
+ * Copyright (C) 2019, The HTM Community
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ * ---------------------------------------------------------------------- */
+
+/** @file
+ * Implementation of the SlabPool
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#if defined(NTA_OS_WINDOWS)
+#include <malloc.h> //_aligned_malloc
+#endif
+
+#include <htm/utils/SlabAllocator.hpp>
+
+namespace htm {
+
+const size_t SlabPool::MIN_BLOCK;
+const size_t SlabPool::MAX_BLOCK;
+const size_t SlabPool::SLAB_BYTES;
+const size_t SlabPool::NUM_POOLS;
+
+std::atomic<size_t> SlabPool::largeBytes_(0u);
+std::atomic<size_t> SlabPool::numLarge_(0u);
+
+namespace {
+// The blocks of a slab follow its header, keeping their alignment.
+template <typename Header> constexpr size_t headerBytes() {
+  return (sizeof(Header) + SlabPool::MIN_BLOCK - 1u) / SlabPool::MIN_BLOCK * SlabPool::MIN_BLOCK;
+}
+
+void *allocateAligned(const size_t bytes) {
+#if defined(NTA_OS_WINDOWS)
+  void *ptr = _aligned_malloc(bytes, bytes);
+#else
+  void *ptr = nullptr;
+  if (posix_memalign(&ptr, bytes, bytes) != 0) ptr = nullptr;
+#endif
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void freeAligned(void *ptr) noexcept {
+#if defined(NTA_OS_WINDOWS)
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif
+}
+} // end anonymous namespace
+
+
+SlabPool *SlabPool::pools() {
+  // Intentionally never destroyed: containers in static objects may still
+  // return their memory during program exit.
+  static SlabPool *pools = new SlabPool[NUM_POOLS];
+  return pools;
+}
+
+
+SlabPool &SlabPool::forThisThread() {
+  static std::atomic<size_t> nextPool(0u);
+  thread_local SlabPool &pool = pools()[nextPool++ % NUM_POOLS];
+  return pool;
+}
+
+
+size_t SlabPool::sizeClass(const size_t bytes) {
+  size_t cls = 0u;
+  for (size_t block = MIN_BLOCK; block < bytes; block *= 2u) {
+    cls++;
+  }
+  return cls;
+}
+
+
+SlabPool::Slab *SlabPool::slabOf(void *block) {
+  return reinterpret_cast<Slab*>(reinterpret_cast<std::uintptr_t>(block) & ~(SLAB_BYTES - 1u));
+}
+
+
+void SlabPool::unlink(Slab *slab) {
+  if (slab->prev != nullptr) {
+    slab->prev->next = slab->next;
+  } else {
+    available_[slab->cls] = slab->next;
+  }
+  if (slab->next != nullptr) {
+    slab->next->prev = slab->prev;
+  }
+  slab->prev = slab->next = nullptr;
+}
+
+
+void SlabPool::releaseSlab(Slab *slab) {
+  auto &pool = *slab->pool;
+  const size_t block = MIN_BLOCK << slab->cls;
+  pool.unlink(slab);
+  pool.stats_.bytesReserved -= SLAB_BYTES;
+  pool.stats_.bytesFree     -= (SLAB_BYTES - headerBytes<Slab>()) / block * block;
+  pool.stats_.numSlabs--;
+  freeAligned(slab);
+}
+
+
+void *SlabPool::allocate(const size_t bytes) {
+  if (bytes == 0u) return nullptr;
+
+  if (bytes > MAX_BLOCK) {
+    void *ptr = ::operator new(bytes);
+    largeBytes_ += bytes;
+    numLarge_++;
+    return ptr;
+  }
+
+  auto &pool = forThisThread();
+  const size_t cls   = sizeClass(bytes);
+  const size_t block = MIN_BLOCK << cls;
+  std::lock_guard<std::mutex> lock(pool.mutex_);
+
+  Slab *slab = pool.available_[cls];
+  if (slab == nullptr) { //reserve a new slab, cut it into blocks
+    char *memory = static_cast<char*>(allocateAligned(SLAB_BYTES));
+    slab = reinterpret_cast<Slab*>(memory);
+    slab->pool    = &pool;
+    slab->prev    = nullptr;
+    slab->next    = nullptr;
+    slab->free    = nullptr;
+    slab->cls     = cls;
+    slab->numLive = 0u;
+    const size_t numBlocks = (SLAB_BYTES - headerBytes<Slab>()) / block;
+    for (size_t i = numBlocks; i > 0u; i--) {
+      auto free = reinterpret_cast<FreeBlock*>(memory + headerBytes<Slab>() + (i - 1u) * block);
+      free->next = slab->free;
+      slab->free = free;
+    }
+    pool.available_[cls] = slab;
+    pool.stats_.bytesReserved += SLAB_BYTES;
+    pool.stats_.bytesFree     += numBlocks * block;
+    pool.stats_.numSlabs++;
+  }
+
+  FreeBlock *free = slab->free;
+  slab->free = free->next;
+  if (slab->numLive++ == 0u && pool.spare_[cls] == slab) {
+    pool.spare_[cls] = nullptr;
+  }
+  if (slab->free == nullptr) { //full
+    pool.unlink(slab);
+  }
+  pool.stats_.bytesFree -= block;
+  pool.stats_.bytesLive += bytes;
+  pool.stats_.numLive++;
+  return free;
+}
+
+
+void SlabPool::deallocate(void *ptr, const size_t bytes) noexcept {
+  if (ptr == nullptr) return;
+
+  if (bytes > MAX_BLOCK) {
+    ::operator delete(ptr);
+    largeBytes_ -= bytes;
+    numLarge_--;
+    return;
+  }
+
+  Slab *slab = slabOf(ptr);
+  auto &pool = *slab->pool;
+  const size_t cls = slab->cls;
+  std::lock_guard<std::mutex> lock(pool.mutex_);
+
+  if (slab->free == nullptr) { //was full, has a free block again
+    slab->next = pool.available_[cls];
+    if (slab->next != nullptr) {
+      slab->next->prev = slab;
+    }
+    pool.available_[cls] = slab;
+  }
+  auto free  = static_cast<FreeBlock*>(ptr);
+  free->next = slab->free;
+  slab->free = free;
+  pool.stats_.bytesFree += MIN_BLOCK << cls;
+  pool.stats_.bytesLive -= bytes;
+  pool.stats_.numLive--;
+
+  if (--slab->numLive == 0u) {
+    // Keep the most recently emptied slab, return the older one.
+    if (pool.spare_[cls] != nullptr) {
+      releaseSlab(pool.spare_[cls]);
+    }
+    pool.spare_[cls] = slab;
+  }
+}
+
+
+SlabAllocatorStats SlabPool::stats() {
+  SlabAllocatorStats total;
+  for (size_t i = 0u; i < NUM_POOLS; i++) {
+    auto &pool = pools()[i];
+    std::lock_guard<std::mutex> lock(pool.mutex_);
+    total.bytesReserved += pool.stats_.bytesReserved;
+    total.bytesLive     += pool.stats_.bytesLive;
+    total.bytesFree     += pool.stats_.bytesFree;
+    total.numSlabs      += pool.stats_.numSlabs;
+    total.numLive       += pool.stats_.numLive;
+  }
+  const size_t large = largeBytes_;
+  total.bytesReserved += large;
+  total.bytesLive     += large;
+  total.numLive       += numLarge_;
+  return total;
+}
+
+
+void SlabPool::trim() {
+  for (size_t i = 0u; i < NUM_POOLS; i++) {
+    auto &pool = pools()[i];
+    std::lock_guard<std::mutex> lock(pool.mutex_);
+    for (auto &spare : pool.spare_) {
+      if (spare != nullptr) {
+        releaseSlab(spare);
+        spare = nullptr;
+      }
+    }
+  }
+}
+
+} // end namespace htm
@@ -0,0 +1,148 @@
+/* ---------------------------------------------------------------------
+ * HTM Community Edition of NuPIC
+ * Copyright (C) 2019, The HTM Community
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ * ---------------------------------------------------------------------- */
+
+#ifndef NTA_SLAB_ALLOCATOR_HPP
+#define NTA_SLAB_ALLOCATOR_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+#include <htm/types/Types.hpp>
+
+namespace htm {
+/** @file
+ * Pooled storage for the many small lists kept by Connections (the synapses
+ * of each segment, the segments of each cell).
+ *
+ * Memory is carved out of large slabs into blocks of power-of-two size
+ * classes, each slab holds blocks of one size class. Freed blocks go back
+ * onto the free-list of their slab and are handed out again before new slabs
+ * are reserved, so a long running model which keeps creating and destroying
+ * segments reaches a steady state instead of fragmenting the heap. A slab
+ * whose blocks are all freed is returned to the system, except for one spare
+ * slab per size class. Requests larger than the biggest size class are
+ * passed to the global operator new.
+ *
+ * Each thread allocates from its own pool, threads are assigned round robin
+ * to NUM_POOLS pools. A block is freed to the pool of its slab, so the lock
+ * of a pool is only contended when threads share it or free the blocks of
+ * each other.
+ */
+
+/**
+ * Memory statistics of the SlabPool.
+ */
+struct SlabAllocatorStats {
+  size_t bytesReserved = 0; //memory taken from the system: slabs and large blocks
+  size_t bytesLive     = 0; //memory requested by the containers and not yet freed
+  size_t bytesFree     = 0; //memory in free-lists, ready to be reused
+  size_t numSlabs      = 0;
+  size_t numLive       = 0; //number of live allocations
+
+  /**
+   * Fraction of the reserved memory which is not in use by the containers,
+   * includes both the free-lists and rounding up to the size classes.
+   */
+  Real fragmentation() const {
+    return bytesReserved == 0u ? 0.0f
+         : 1.0f - static_cast<Real>(bytesLive) / static_cast<Real>(bytesReserved);
+  }
+};
+
+/**
+ * Thread safe pools backing the SlabAllocator, see above.
+ * All methods are static, stats() and trim() apply to all the pools.
+ */
+class SlabPool {
+public:
+  static const size_t MIN_BLOCK  = 16u;        //smallest size class, in bytes
+  static const size_t MAX_BLOCK  = 4096u;      //largest size class, in bytes
+  static const size_t SLAB_BYTES = 64u * 1024u; //also the alignment of a slab
+  static const size_t NUM_POOLS  = 16u;
+
+  static void *allocate(const size_t bytes);
+  static void deallocate(void *ptr, const size_t bytes) noexcept;
+  static SlabAllocatorStats stats();
+
+  /**
+   * Returns the spare empty slabs to the system, ie. after a model was
+   * destroyed. Slabs with blocks in use stay.
+   */
+  static void trim();
+
+private:
+  SlabPool() = default;
+  static SlabPool *pools();
+  static SlabPool &forThisThread();
+  static size_t sizeClass(const size_t bytes);
+
+  struct FreeBlock { FreeBlock *next; };
+
+  // Header at the start of each slab, found by aligning a block address
+  // down to SLAB_BYTES.
+  struct Slab {
+    SlabPool  *pool;    //which owns this slab
+    Slab      *prev;    //in the list of slabs with free blocks, of the pool
+    Slab      *next;
+    FreeBlock *free;
+    size_t     cls;
+    size_t     numLive;
+  };
+  static Slab *slabOf(void *block);
+  static void  releaseSlab(Slab *slab);
+  void unlink(Slab *slab);
+
+  std::mutex mutex_;
+  // Per size class: the slabs with free blocks, and the empty slab kept.
+  std::vector<Slab*> available_ = std::vector<Slab*>(sizeClass(MAX_BLOCK) + 1u, nullptr);
+  std::vector<Slab*> spare_     = std::vector<Slab*>(sizeClass(MAX_BLOCK) + 1u, nullptr);
+  SlabAllocatorStats stats_; //of the slabs, the large blocks are counted below
+
+  static std::atomic<size_t> largeBytes_;
+  static std::atomic<size_t> numLarge_;
+};
+
+/**
+ * Standard allocator using the SlabPool, for use with std::vector and other
+ * STL containers. It is stateless, all instances are interchangeable.
+ */
+template <typename T>
+struct SlabAllocator {
+  typedef T value_type;
+
+  SlabAllocator() = default;
+  template <typename U> SlabAllocator(const SlabAllocator<U> &) noexcept {}
+
+  T *allocate(const size_t n) {
+    return static_cast<T*>(SlabPool::allocate(n * sizeof(T)));
+  }
+  void deallocate(T *ptr, const size_t n) noexcept {
+    SlabPool::deallocate(ptr, n * sizeof(T));
+  }
+
+  template <typename U> struct rebind { typedef SlabAllocator<U> other; };
+};
+
+template <typename T, typename U>
+bool operator==(const SlabAllocator<T> &, const SlabAllocator<U> &) noexcept { return true; }
+template <typename T, typename U>
+bool operator!=(const SlabAllocator<T> &, const SlabAllocator<U> &) noexcept { return false; }
+
+} // end namespace htm
+#endif // NTA_SLAB_ALLOCATOR_HPP
@@ -23,6 +23,7 @@
 
 #include <fstream>
 #include <iostream>
+#include <sstream>
 
 #include <htm/algorithms/SpatialPooler.hpp>
 #include <htm/algorithms/TemporalMemory.hpp>
@@ -96,6 +97,7 @@ float runTemporalMemoryTest(UInt numColumns, UInt w,   int numSequences, //TODO
   NTA_CHECK(avgAnomAfter <= 0.021f) << "Anomaly scores diverged: "<< avgAnomAfter;
 #endif
   cout << (float)timer.getElapsed() << " in " << label << ": initialize + learn + test"  << endl;
+  cout << avgAnomAfter << " in " << label << ": average anomaly after learning" << endl; //accuracy, ie. for PERMANENCE_FIXED16
   timer.stop();
   return (float)timer.getElapsed();
 }
@@ -151,6 +153,114 @@ float runSpatialPoolerTest(
 
 
 
+/**
+ * Times Connections::computeActivity alone on a TM-sized set of segments,
+ * for the default (map) and the flat presynaptic index, and a given number
+ * of threads.
+ */
+float runComputeActivityTest(
+                  UInt   numCells,
+                  UInt   numSegments,
+                  UInt   synapsesPerSegment,
+                  Real   inputSparsity,
+                  UInt   iterations,
+                  bool   flatIndex,
+                  UInt   numThreads,
+                  string label)
+{
+  Random rnd(SEED); //same connections and inputs for both layouts
+  Connections connections(numCells, 0.5f, false, flatIndex);
+  connections.setNumThreads(numThreads);
+  for (UInt i = 0; i < numSegments; i++) {
+    const Segment segment = connections.createSegment( rnd.getUInt32(numCells) );
+    for (UInt j = 0; j < synapsesPerSegment; j++) {
+      connections.createSynapse( segment, rnd.getUInt32(numCells), (Permanence)rnd.getReal64() );
+    }
+  }
+  SDR input({ numCells });
+  vector<SynapseIdx> numConnected(connections.segmentFlatListLength());
+  vector<SynapseIdx> numPotential(connections.segmentFlatListLength());
+
+  Timer timer(true);
+  for (UInt i = 0; i < iterations; i++) {
+    input.randomize( inputSparsity, rnd );
+    connections.computeActivity( numConnected, numPotential, input.getSparse() );
+  }
+  timer.stop();
+  cout << (float)timer.getElapsed() << " in " << label << ": computeActivity"  << endl;
+  return (float)timer.getElapsed();
+}
+
+
+/**
+ * Times restoring a TM-sized Connections from the cereal BINARY archive
+ * (load) and from a flat snapshot (loadSnapshot), read from memory and
+ * memory mapped from a file.
+ *
+ * @retval The restore times: cereal, snapshot (stream), snapshot (mmap).
+ */
+vector<float> runRestoreTest(
+                  UInt   numCells,
+                  UInt   numSegments,
+                  UInt   synapsesPerSegment,
+                  string label)
+{
+  Random rnd(SEED);
+  Connections connections(numCells, 0.5f);
+  vector<CellIdx> presyn(synapsesPerSegment);
+  vector<Permanence> perms(synapsesPerSegment);
+  for (UInt i = 0; i < numSegments; i++) {
+    const Segment segment = connections.createSegment( rnd.getUInt32(numCells) );
+    for (UInt j = 0; j < synapsesPerSegment; j++) {
+      presyn[j] = rnd.getUInt32(numCells);
+      perms[j]  = (Permanence)rnd.getReal64();
+    }
+    connections.createSynapses( segment, presyn, perms );
+  }
+  vector<float> times;
+
+  stringstream archive;
+  connections.save( archive, SerializableFormat::BINARY );
+  {
+    Connections restored;
+    Timer timer(true);
+    restored.load( archive, SerializableFormat::BINARY );
+    timer.stop();
+    NTA_CHECK(restored == connections);
+    times.push_back( (float)timer.getElapsed() );
+  }
+
+  stringstream snapshot;
+  connections.saveSnapshot( snapshot );
+  {
+    Connections restored;
+    Timer timer(true);
+    restored.loadSnapshot( ConnectionsSnapshot(snapshot) );
+    timer.stop();
+    NTA_CHECK(restored == connections);
+    times.push_back( (float)timer.getElapsed() );
+  }
+
+  const string filename = "ConnectionsPerformanceSnapshot.tmp";
+  connections.saveSnapshot( filename );
+  {
+    Connections restored;
+    Timer timer(true);
+    restored.loadSnapshot( filename );
+    timer.stop();
+    NTA_CHECK(restored == connections);
+    times.push_back( (float)timer.getElapsed() );
+  }
+  ::remove(filename.c_str());
+
+  cout << times[0] << " in " << label << ": restore from cereal BINARY" << endl;
+  cout << times[1] << " in " << label << ": restore from snapshot (stream)" << endl;
+  cout << times[2] << " in " << label << ": restore from snapshot (mmap)" << endl;
+  return times;
+}
+
+
+
 // TESTS
 #if defined( NDEBUG) && !defined(NTA_OS_WINDOWS)
   const UInt COLS 	= 2048; //standard num of columns in SP/TM
@@ -205,4 +315,44 @@ TEST(ConnectionsPerformanceTest, testSP) {
   UNUSED(tim);
 }
 
+/**
+ * Compares computeActivity with the default (map) and the flat presynaptic index.
+ */
+TEST(ConnectionsPerformanceTest, testComputeActivityFlatIndex) {
+  const UInt cells = COLS * 32;
+  const UInt iters = EPOCHS * SEQ;
+  auto timMap  = runComputeActivityTest(cells, cells, 40, 0.02f, iters, false, 1, "computeActivity (map index)");
+  auto timFlat = runComputeActivityTest(cells, cells, 40, 0.02f, iters, true,  1, "computeActivity (flat index)");
+#ifdef NDEBUG
+  ASSERT_LE(timFlat, 1.2f * timMap) << "flat presynaptic index should not be slower";
+#endif
+  UNUSED(timMap);
+  UNUSED(timFlat);
+}
+
+/**
+ * Compares serial and multi-threaded computeActivity.
+ */
+TEST(ConnectionsPerformanceTest, testComputeActivityThreads) {
+  const UInt cells = COLS * 32;
+  const UInt iters = EPOCHS * SEQ;
+  auto timSerial   = runComputeActivityTest(cells, cells, 40, 0.02f, iters, true, 1, "computeActivity (1 thread)");
+  auto timParallel = runComputeActivityTest(cells, cells, 40, 0.02f, iters, true, 4, "computeActivity (4 threads)");
+  UNUSED(timSerial); //no timing assert, the speedup depends on the cores of the machine
+  UNUSED(timParallel);
+}
+
+/**
+ * Compares restoring Connections from cereal and from a flat snapshot.
+ */
+TEST(ConnectionsPerformanceTest, testRestoreSnapshot) {
+  const UInt cells = COLS * 32;
+  const auto times = runRestoreTest(cells, cells, 40, "restore");
+#ifdef NDEBUG
+  ASSERT_LE(times[1], times[0]) << "restoring a snapshot should be faster than cereal";
+  ASSERT_LE(times[2], times[0]) << "restoring a snapshot should be faster than cereal";
+#endif
+  UNUSED(times);
+}
+
 } // end namespace
@@ -20,8 +20,12 @@
  */
 
 #include "gtest/gtest.h"
+#include <algorithm>
+#include <cstring> // memcpy
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <numeric>
 #include <htm/algorithms/Connections.hpp>
 
 using namespace std;
@@ -88,7 +92,7 @@ TEST(ConnectionsTest, testCreateSegment) {
   Segment segment2 = connections.createSegment(cell);
   ASSERT_EQ(cell, connections.cellForSegment(segment2));
 
-  vector<Segment> segments = connections.segmentsForCell(cell);
+  SegmentList segments = connections.segmentsForCell(cell);
   ASSERT_EQ(segments.size(), 2ul);
 
   ASSERT_EQ(segment1, segments[0]);
@@ -110,7 +114,7 @@ TEST(ConnectionsTest, testCreateSynapse) {
   Synapse synapse2 = connections.createSynapse(segment, 150, 0.48f);
   ASSERT_EQ(segment, connections.segmentForSynapse(synapse2));
 
-  vector<Synapse> synapses = connections.synapsesForSegment(segment);
+  SynapseList synapses = connections.synapsesForSegment(segment);
   ASSERT_EQ(synapses.size(), 2ul);
 
   ASSERT_EQ(synapse1, synapses[0]);
@@ -118,11 +122,97 @@ TEST(ConnectionsTest, testCreateSynapse) {
 
   SynapseData synapseData1 = connections.dataForSynapse(synapses[0]);
   ASSERT_EQ(50ul, synapseData1.presynapticCell);
-  ASSERT_NEAR((Permanence)0.34, synapseData1.permanence, htm::Epsilon);
+  ASSERT_NEAR((Permanence)0.34, synapseData1.permanence, permanenceTolerance);
 
   SynapseData synapseData2 = connections.dataForSynapse(synapses[1]);
   ASSERT_EQ(synapseData2.presynapticCell, 150ul);
-  ASSERT_NEAR((Permanence)0.48, synapseData2.permanence, htm::Epsilon);
+  ASSERT_NEAR((Permanence)0.48, synapseData2.permanence, permanenceTolerance);
+}
+
+class CountCreateSynapsesHandler : public ConnectionsEventHandler {
+public:
+  virtual void onCreateSynapse(Synapse synapse) { numCreated++; }
+  virtual void onCreateSynapses(const vector<Synapse> &synapses) {
+    numBatches++;
+    ConnectionsEventHandler::onCreateSynapses(synapses);
+  }
+  UInt numCreated = 0u;
+  UInt numBatches = 0u;
+};
+
+/**
+ * Creates synapses in batches, and makes sure the result is the same as
+ * creating them one by one, with either presynaptic index.
+ */
+TEST(ConnectionsTest, testCreateSynapses) {
+  for(const bool flatIndex : {false, true}) {
+    Connections single(1024, 0.5f, false, flatIndex);
+    Connections batch( 1024, 0.5f, false, flatIndex);
+    auto handler = new CountCreateSynapsesHandler();
+    const auto token = batch.subscribe(handler);
+
+    Random rng(42);
+    const UInt numInputs = 2000u;
+    for(UInt iter = 0; iter < 100; iter++) {
+      const CellIdx cell = iter;
+      const Segment seg1 = single.createSegment(cell);
+      const Segment seg2 = batch.createSegment(cell);
+      ASSERT_EQ(seg1, seg2);
+
+      vector<CellIdx> cells;
+      vector<Permanence> perms;
+      const UInt numNew = 1u + rng.getUInt32(20u);
+      for(UInt i = 0; i < numNew; i++) {
+        cells.push_back(rng.getUInt32(numInputs));
+        perms.push_back((Permanence)rng.getReal64());
+      }
+      for(size_t i = 0; i < cells.size(); i++) {
+        single.createSynapse(seg1, cells[i], (iter % 2u) ? perms[i] : 0.6f);
+      }
+      if(iter % 2u) {
+        batch.createSynapses(seg2, cells, perms);
+      } else {
+        batch.createSynapses(seg2, cells, 0.6f);
+      }
+      ASSERT_EQ(single.synapsesForSegment(seg1), batch.synapsesForSegment(seg2));
+      ASSERT_EQ(single.dataForSegment(seg1).numConnected,
+                batch.dataForSegment(seg2).numConnected);
+
+      // Destroy some synapses, so that the next batch reuses them.
+      if(iter % 3u == 0u) {
+        const auto synapses = single.synapsesForSegment(seg1);
+        for(size_t i = 0; i < synapses.size(); i += 2) {
+          single.destroySynapse(synapses[i]);
+          batch.destroySynapse(synapses[i]);
+        }
+      }
+    }
+    ASSERT_EQ(single, batch);
+    ASSERT_EQ(single.numSynapses(), batch.numSynapses());
+    EXPECT_EQ(100u, handler->numBatches);
+    EXPECT_GE(handler->numCreated, handler->numBatches);
+
+    vector<SynapseIdx> active1(single.segmentFlatListLength(), 0u);
+    vector<SynapseIdx> active2(batch.segmentFlatListLength(), 0u);
+    vector<SynapseIdx> potential1(single.segmentFlatListLength(), 0u);
+    vector<SynapseIdx> potential2(batch.segmentFlatListLength(), 0u);
+    vector<CellIdx> input;
+    for(CellIdx presyn = 0; presyn < numInputs; presyn += 3) {
+      input.push_back(presyn);
+    }
+    single.computeActivity(active1, potential1, input);
+    batch.computeActivity(active2, potential2, input);
+    ASSERT_EQ(active1, active2);
+    ASSERT_EQ(potential1, potential2);
+
+    batch.unsubscribe(token);
+  }
+
+  Connections connections(1024);
+  const Segment segment = connections.createSegment(10);
+  EXPECT_ANY_THROW(connections.createSynapses(segment, {1, 2, 3}, vector<Permanence>{0.5f}));
+  connections.createSynapses(segment, {}, 0.5f);
+  ASSERT_EQ(0u, connections.numSynapses(segment));
 }
 
 /**
@@ -289,7 +379,7 @@ TEST(ConnectionsTest, testUpdateSynapsePermanence) {
   connections.updateSynapsePermanence(synapse, 0.21f);
 
   SynapseData synapseData = connections.dataForSynapse(synapse);
-  ASSERT_NEAR(synapseData.permanence, (Real)0.21, htm::Epsilon);
+  ASSERT_NEAR(synapseData.permanence, (Real)0.21, permanenceTolerance);
 
   // Test permanence floor
   connections.updateSynapsePermanence(synapse, -0.02f);
@@ -403,7 +493,7 @@ TEST(ConnectionsTest, testAdaptSynapses) {
       perms[ synData.presynapticCell ] = synData.permanence;
     }
     for(UInt i = 0; i < numInputs; i++)
-      ASSERT_NEAR( truePerms[cell][i], perms[i], htm::Epsilon );
+      ASSERT_NEAR( truePerms[cell][i], perms[i], permanenceTolerance );
   }
 }
 
@@ -647,7 +737,11 @@ TEST(ConnectionsTest, testBumpSegment) {
     for(auto synapse : con.synapsesForSegment(segment)) {
       auto synData = con.dataForSynapse( synapse );
       auto presyn  = synData.presynapticCell;
+#ifdef NTA_PERMANENCE_FIXED16
+      ASSERT_NEAR( synData.permanence, truePermArr[seg][presyn], permanenceTolerance );
+#else
       ASSERT_FLOAT_EQ( synData.permanence, truePermArr[seg][presyn] );
+#endif
     }
   }
 }
@@ -737,6 +831,54 @@ TEST(ConnectionsTest, subscribe) {
   connections.unsubscribe(token);
 }
 
+class BufferedEventHandler : public ConnectionsEventHandler {
+public:
+  virtual void onCreateSynapse(Synapse synapse) { numDirectCalls++; }
+  virtual void onEvents(const vector<ConnectionsEvent> &events) {
+    numBatches++;
+    for(const auto &event : events) {
+      types.push_back(event.type);
+    }
+  }
+  UInt numDirectCalls = 0u;
+  UInt numBatches = 0u;
+  vector<ConnectionsEvent::Type> types;
+};
+
+/**
+ * A buffered event handler gets all of the changes at once, per step.
+ */
+TEST(ConnectionsTest, subscribeBuffered) {
+  Connections connections(1024, 0.5f);
+  auto handler = new BufferedEventHandler();
+  const auto token = connections.subscribe(handler, true);
+
+  const Segment segment = connections.createSegment(42);
+  const Synapse synapse = connections.createSynapse(segment, 41, 0.25f);
+  connections.createSynapses(segment, {1u, 2u}, 0.6f);
+  connections.updateSynapsePermanence(synapse, 0.60f);
+  connections.destroySynapse(synapse);
+  EXPECT_EQ(0u, handler->numBatches) << "nothing is delivered until the next step";
+
+  vector<SynapseIdx> numActive(connections.segmentFlatListLength(), 0u);
+  connections.computeActivity(numActive, {1u}, true);
+  ASSERT_EQ(1u, handler->numBatches);
+  EXPECT_EQ(0u, handler->numDirectCalls);
+  const vector<ConnectionsEvent::Type> expected = {
+    ConnectionsEvent::CREATE_SEGMENT,
+    ConnectionsEvent::CREATE_SYNAPSE,
+    ConnectionsEvent::CREATE_SYNAPSE,
+    ConnectionsEvent::CREATE_SYNAPSE,
+    ConnectionsEvent::UPDATE_SYNAPSE_PERMANENCE,
+    ConnectionsEvent::DESTROY_SYNAPSE };
+  ASSERT_EQ(expected, handler->types);
+
+  connections.flushEvents(); //nothing new
+  ASSERT_EQ(1u, handler->numBatches);
+  connections.destroySegment(segment);
+  connections.unsubscribe(token); //delivers the rest, then deletes the handler
+}
+
 /**
  * Make sure the event handler is destructed on unsubscribe.
  */
@@ -797,6 +939,134 @@ TEST(ConnectionsTest, testSaveLoad) {
   ASSERT_EQ(c1, c2);
 }
 
+/**
+ * Destroying a segment moves the last segment of the cell into its place.
+ * Saving and loading must still keep the order of compareSegments().
+ */
+TEST(ConnectionsTest, testSaveLoadKeepsSegmentOrder) {
+  Connections c1(16);
+  const Segment s1 = c1.createSegment(0);
+  const Segment s2 = c1.createSegment(0);
+  const Segment s3 = c1.createSegment(0);
+  c1.createSynapse(s1, 1, 0.5f);
+  c1.createSynapse(s2, 2, 0.5f);
+  c1.createSynapse(s3, 3, 0.5f);
+  c1.destroySegment(s1);
+  ASSERT_TRUE(c1.compareSegments(s2, s3));
+
+  // The segment of c whose synapse is on presynapticCell.
+  const auto find = [](const Connections &c, const CellIdx presynapticCell) {
+    for(const auto segment : c.segmentsForCell(0)) {
+      if(c.dataForSynapse(c.synapsesForSegment(segment)[0]).presynapticCell == presynapticCell) {
+        return segment;
+      }
+    }
+    return std::numeric_limits<Segment>::max();
+  };
+
+  for(const bool snapshot : {false, true}) {
+    Connections c2;
+    stringstream ss;
+    if(snapshot) {
+      c1.saveSnapshot(ss);
+      c2.loadSnapshot(ConnectionsSnapshot(ss));
+    } else {
+      c1.save(ss);
+      c2.load(ss);
+    }
+    ASSERT_EQ(c1, c2);
+    ASSERT_TRUE(c2.compareSegments(find(c2, 2), find(c2, 3))) << "snapshot " << snapshot;
+    ASSERT_FALSE(c2.compareSegments(find(c2, 3), find(c2, 2))) << "snapshot " << snapshot;
+  }
+}
+
+/**
+ * A snapshot restores the same connections, in both index layouts, from a
+ * stream and from a memory mapped file.
+ */
+TEST(ConnectionsTest, testSnapshot) {
+  Connections c1(1024);
+  setupSampleConnections(c1);
+  auto segment = c1.createSegment(10);
+  c1.createSynapse(segment, 400, 0.5);
+  c1.destroySegment(segment);
+  computeSampleActivity(c1);
+  c1.touchSegment(c1.getSegment(20, 0));
+
+  stringstream ss;
+  c1.saveSnapshot(ss);
+  const string bytes = ss.str();
+
+  for(const bool flat : {false, true}) {
+    Connections c2(1, 0.5f, false, flat);
+    {
+      stringstream in(bytes);
+      const ConnectionsSnapshot snapshot(in);
+      EXPECT_EQ(1024u, snapshot.numCells());
+      EXPECT_EQ(c1.numSegments(), snapshot.numSegments());
+      EXPECT_EQ(c1.numSynapses(), snapshot.numSynapses());
+      c2.loadSnapshot(snapshot);
+    }
+    ASSERT_EQ(c1, c2);
+    EXPECT_EQ(flat, c2.hasFlatPresynapticIndex()) << "index layout is not part of the snapshot";
+
+    vector<SynapseIdx> active1(c1.segmentFlatListLength()), active2(c2.segmentFlatListLength());
+    vector<SynapseIdx> potential1(active1.size()), potential2(active2.size());
+    const vector<CellIdx> input = {50, 52, 53, 80, 81, 82, 150, 151};
+    c1.computeActivity(active1, potential1, input, false);
+    c2.computeActivity(active2, potential2, input, false);
+    for(CellIdx cell = 0; cell < 1024; cell++) { //the Segment handles may differ
+      for(const auto seg : c1.segmentsForCell(cell)) {
+        const auto seg2 = c2.getSegment(cell, c1.idxOnCellForSegment(seg));
+        EXPECT_EQ(c1.dataForSegment(seg).lastUsed, c2.dataForSegment(seg2).lastUsed);
+        EXPECT_EQ(c1.dataForSegment(seg).numConnected, c2.dataForSegment(seg2).numConnected);
+        EXPECT_EQ(active1[seg], active2[seg2]);
+        EXPECT_EQ(potential1[seg], potential2[seg2]);
+      }
+    }
+
+    // The LRU order is restored: evicts the untouched segment (4 synapses),
+    // keeps the touched one (3 synapses).
+    c2.createSegment(20, 2);
+    vector<size_t> numSynapsesOnCell;
+    for(const auto seg : c2.segmentsForCell(20)) {
+      numSynapsesOnCell.push_back(c2.numSynapses(seg));
+    }
+    std::sort(numSynapsesOnCell.begin(), numSynapsesOnCell.end());
+    EXPECT_EQ(vector<size_t>({0u, 3u}), numSynapsesOnCell);
+  }
+
+  const char *filename = "ConnectionsSnapshot.tmp";
+  c1.saveSnapshot(filename);
+  Connections c3;
+  c3.loadSnapshot(filename);
+  ASSERT_EQ(c1, c3);
+  const int ret = ::remove(filename);
+  ASSERT_TRUE(ret == 0) << "Failed to delete " << filename;
+
+  string corrupt = bytes;
+  corrupt[0] = 'X';
+  stringstream badMagic(corrupt);
+  EXPECT_ANY_THROW(ConnectionsSnapshot snapshot(badMagic));
+  stringstream truncated(bytes.substr(0, bytes.size() - 4u));
+  EXPECT_ANY_THROW(ConnectionsSnapshot snapshot(truncated));
+  // A huge count in the header must not allocate it up front.
+  string huge = bytes;
+  const UInt32 numSynapses = std::numeric_limits<UInt32>::max();
+  std::memcpy(&huge[24], &numSynapses, sizeof(numSynapses));
+  stringstream hugeCount(huge);
+  EXPECT_ANY_THROW(ConnectionsSnapshot snapshot(hugeCount));
+  // Corrupt presynaptic cells: the largest CellIdx, and one beyond the
+  // numPresynapticCells of the header.
+  const size_t presynapticCells = 64u + sizeof(UInt32) * (c1.numCells() + 2u * c1.numSegments());
+  for(const CellIdx corrupt : {std::numeric_limits<CellIdx>::max(), (CellIdx)1000000u}) {
+    string badCell = bytes;
+    std::memcpy(&badCell[presynapticCells], &corrupt, sizeof(corrupt));
+    stringstream badPresynaptic(badCell);
+    EXPECT_ANY_THROW(ConnectionsSnapshot snapshot(badPresynaptic)) << corrupt;
+  }
+}
+
 TEST(ConnectionsTest, testCreateSegmentOverflow) {
     const auto LIMIT = std::numeric_limits<Segment>::max();
     if(LIMIT <= 256) { //connections::Segment is too large (likely uint32), so this test would run, but memory 
@@ -866,3 +1136,582 @@ TEST(ConnectionsTest, testTimeseries) {
     ASSERT_TRUE( (synData.permanence == 0.0f) or (synData.permanence == 1.0f) );
   }
 }
+
+/**
+ * The flat presynaptic index must give exactly the same results as the
+ * default (map) layout, also after synapses were destroyed, reconnected and
+ * disconnected, and the blocks of the flat index relocated.
+ */
+TEST(ConnectionsTest, testFlatPresynapticIndex) {
+  Connections mapped(1024, 0.5f, false, false);
+  Connections flat(  1024, 0.5f, false, true);
+  ASSERT_FALSE( mapped.hasFlatPresynapticIndex() );
+  ASSERT_TRUE(  flat.hasFlatPresynapticIndex() );
+
+  setupSampleConnections(mapped);
+  setupSampleConnections(flat);
+
+  Random rng(42);
+  const UInt numInputs = 2000u; //presynaptic cells may exceed numCells
+  for(UInt iter = 0; iter < 200; iter++) {
+    const CellIdx cell = rng.getUInt32(1024u);
+    const Segment seg1 = mapped.createSegment(cell);
+    const Segment seg2 = flat.createSegment(cell);
+    ASSERT_EQ(seg1, seg2);
+    for(UInt i = 0; i < 20; i++) {
+      const CellIdx presyn = rng.getUInt32(numInputs);
+      const Permanence perm = rng.getReal64();
+      const Synapse syn1 = mapped.createSynapse(seg1, presyn, perm);
+      const Synapse syn2 = flat.createSynapse(seg2, presyn, perm);
+      ASSERT_EQ(syn1, syn2);
+    }
+
+    // Randomly destroy and (dis)connect some synapses.
+    const auto synapses = mapped.synapsesForSegment(seg1);
+    for(const auto syn : synapses) {
+      const UInt action = rng.getUInt32(4u);
+      if(action == 0u) {
+        mapped.destroySynapse(syn);
+        flat.destroySynapse(syn);
+      }
+      else if(action == 1u) {
+        const Permanence perm = rng.getReal64();
+        mapped.updateSynapsePermanence(syn, perm);
+        flat.updateSynapsePermanence(syn, perm);
+      }
+    }
+  }
+  ASSERT_EQ(mapped, flat);
+
+  for(CellIdx presyn = 0; presyn < numInputs; presyn++) {
+    auto syns1 = mapped.synapsesForPresynapticCell(presyn);
+    auto syns2 = flat.synapsesForPresynapticCell(presyn);
+    std::sort(syns1.begin(), syns1.end());
+    std::sort(syns2.begin(), syns2.end());
+    ASSERT_EQ(syns1, syns2) << "presynaptic cell " << presyn;
+  }
+
+  SDR input({ numInputs });
+  for(UInt iter = 0; iter < 20; iter++) {
+    input.randomize(0.1f, rng);
+    vector<SynapseIdx> connected1(mapped.segmentFlatListLength(), 0);
+    vector<SynapseIdx> potential1(mapped.segmentFlatListLength(), 0);
+    vector<SynapseIdx> connected2(flat.segmentFlatListLength(), 0);
+    vector<SynapseIdx> potential2(flat.segmentFlatListLength(), 0);
+    mapped.computeActivity(connected1, potential1, input.getSparse());
+    flat.computeActivity(connected2, potential2, input.getSparse());
+    ASSERT_EQ(connected1, connected2);
+    ASSERT_EQ(potential1, potential2);
+  }
+
+  // The layout is a runtime choice and is kept when loading.
+  Connections loaded(1, 0.5f, false, true);
+  {
+    stringstream ss;
+    mapped.save(ss);
+    loaded.load(ss);
+  }
+  ASSERT_TRUE( loaded.hasFlatPresynapticIndex() );
+  ASSERT_EQ(mapped, loaded);
+}
+
+/**
+ * Multi-threaded computeActivity must give exactly the same counts as the
+ * serial one, for both presynaptic index layouts.
+ */
+TEST(ConnectionsTest, testComputeActivityThreads) {
+  for(const bool flatIndex : {false, true}) {
+    Connections connections(1024, 0.5f, false, flatIndex);
+    Random rng(7);
+    for(UInt i = 0; i < 2000u; i++) {
+      const Segment segment = connections.createSegment(rng.getUInt32(1024u));
+      for(UInt j = 0; j < 30u; j++) {
+        connections.createSynapse(segment, rng.getUInt32(1024u), (Permanence)rng.getReal64());
+      }
+    }
+    ASSERT_EQ(1u, connections.getNumThreads()) << "serial by default";
+
+    SDR input({ 1024u });
+    for(UInt iter = 0; iter < 10u; iter++) {
+      input.randomize(0.4f, rng);
+      vector<SynapseIdx> connected1(connections.segmentFlatListLength(), 0);
+      vector<SynapseIdx> potential1(connections.segmentFlatListLength(), 0);
+      connections.setNumThreads(1);
+      connections.computeActivity(connected1, potential1, input.getSparse(), false);
+
+      for(const UInt threads : {2u, 3u, 8u}) {
+        vector<SynapseIdx> connected2(connections.segmentFlatListLength(), 0);
+        vector<SynapseIdx> potential2(connections.segmentFlatListLength(), 0);
+        connections.setNumThreads(threads);
+        connections.computeActivity(connected2, potential2, input.getSparse(), false);
+        ASSERT_EQ(connected1, connected2) << "threads " << threads;
+        ASSERT_EQ(potential1, potential2) << "threads " << threads;
+      }
+    }
+  }
+}
+
+/**
+ * updateActivity applies a change of the active cells to the counts of the
+ * previously active cells, which must match counting the new cells.
+ */
+TEST(ConnectionsTest, testUpdateActivity) {
+  for(const bool flatIndex : {false, true}) {
+    Connections connections(1024, 0.5f, false, flatIndex);
+    Random rng(8);
+    for(UInt i = 0; i < 2000u; i++) {
+      const Segment segment = connections.createSegment(rng.getUInt32(1024u));
+      for(UInt j = 0; j < 30u; j++) {
+        connections.createSynapse(segment, rng.getUInt32(1024u), (Permanence)rng.getReal64());
+      }
+    }
+
+    for(const UInt threads : {1u, 4u}) {
+      connections.setNumThreads(threads);
+      SDR previous({ 1024u });
+      previous.randomize(0.4f, rng);
+      vector<SynapseIdx> counts(connections.segmentFlatListLength(), 0);
+      connections.computeActivity(counts, previous.getSparse(), false);
+
+      for(const Real noise : {0.0f, 0.01f, 0.5f, 1.0f}) {
+        SDR input(previous);
+        input.addNoise(noise, rng);
+        vector<CellIdx> activated, deactivated;
+        std::set_difference(input.getSparse().begin(), input.getSparse().end(),
+                            previous.getSparse().begin(), previous.getSparse().end(),
+                            std::back_inserter(activated));
+        std::set_difference(previous.getSparse().begin(), previous.getSparse().end(),
+                            input.getSparse().begin(), input.getSparse().end(),
+                            std::back_inserter(deactivated));
+        connections.updateActivity(counts, activated, deactivated, false);
+
+        vector<SynapseIdx> expected(connections.segmentFlatListLength(), 0);
+        connections.computeActivity(expected, input.getSparse(), false);
+        ASSERT_EQ(expected, counts) << "threads " << threads << ", noise " << noise;
+        previous = input;
+      }
+    }
+  }
+}
+
+/**
+ * computeActivityBatch gives the counts of computeActivity for each input.
+ */
+TEST(ConnectionsTest, testComputeActivityBatch) {
+  for(const bool flatIndex : {false, true}) {
+    Connections connections(1024, 0.5f, false, flatIndex);
+    Random rng(10);
+    for(UInt i = 0; i < 500u; i++) {
+      const Segment segment = connections.createSegment(rng.getUInt32(1024u));
+      for(UInt j = 0; j < 30u; j++) {
+        connections.createSynapse(segment, rng.getUInt32(1024u), (Permanence)rng.getReal64());
+      }
+    }
+
+    vector<vector<CellIdx>> inputs;
+    for(UInt i = 0; i < 7u; i++) {
+      SDR input({ 1024u });
+      input.randomize(0.1f, rng);
+      inputs.push_back(input.getSparse());
+    }
+    inputs.push_back({}); //no active cells
+    vector<SynapseIdx> counts;
+    connections.computeActivityBatch(counts, inputs);
+    const size_t numSegments = connections.segmentFlatListLength();
+    ASSERT_EQ(numSegments * inputs.size(), counts.size());
+
+    for(size_t i = 0; i < inputs.size(); i++) {
+      vector<SynapseIdx> expected(numSegments, 0);
+      connections.computeActivity(expected, inputs[i], false);
+      for(size_t segment = 0; segment < numSegments; segment++) {
+        ASSERT_EQ(expected[segment], counts[i * numSegments + segment]) << "input " << i;
+      }
+    }
+  }
+}
+
+/**
+ * computeActivity with touchedSegments gives the counts of computeActivity,
+ * while segments are created, destroyed and compacted between the calls.
+ */
+TEST(ConnectionsTest, testComputeActivityTouched) {
+  for(const bool flatIndex : {false, true}) {
+    for(const UInt threads : {1u, 4u}) {
+      Connections connections(1024, 0.5f, false, flatIndex);
+      connections.setCompactionThreshold(0.1f);
+      connections.setNumThreads(threads);
+      Random rng(11);
+      vector<SynapseIdx> connected, potential;
+      vector<Segment> touched;
+      for(UInt step = 0; step < 20u; step++) {
+        for(UInt i = 0; i < 100u; i++) {
+          const Segment segment = connections.createSegment(rng.getUInt32(1024u));
+          for(UInt j = 0; j < 20u; j++) {
+            connections.createSynapse(segment, rng.getUInt32(1024u), (Permanence)rng.getReal64());
+          }
+        }
+        for(UInt i = 0; i < 30u; i++) {
+          const auto &segments = connections.segmentsForCell(rng.getUInt32(1024u));
+          if( !segments.empty() ) connections.destroySegment(segments[0]);
+        }
+        SDR input({ 1024u });
+        input.randomize(0.05f, rng);
+        connections.computeActivity(connected, potential, input.getSparse(), true, touched);
+
+        const size_t numSegments = connections.segmentFlatListLength();
+        vector<SynapseIdx> expectedConnected(numSegments, 0);
+        vector<SynapseIdx> expectedPotential(numSegments, 0);
+        connections.computeActivity(expectedConnected, expectedPotential, input.getSparse(), false);
+        ASSERT_EQ(expectedConnected, connected) << "step " << step;
+        ASSERT_EQ(expectedPotential, potential) << "step " << step;
+
+        vector<Segment> expectedTouched;
+        for(Segment segment = 0; segment < numSegments; segment++) {
+          if( potential[segment] > 0u ) expectedTouched.push_back(segment);
+        }
+        std::sort(touched.begin(), touched.end());
+        ASSERT_EQ(expectedTouched, touched) << "step " << step;
+      }
+    }
+  }
+}
+
+/**
+ * adaptSegments gives the same permanences and connected synapses as
+ * adaptSegment on each segment, for any number of threads.
+ */
+TEST(ConnectionsTest, testAdaptSegments) {
+  Connections serial(1024, 0.5f);
+  Random rng(9);
+  for(UInt i = 0; i < 200u; i++) {
+    const Segment segment = serial.createSegment(i);
+    for(UInt j = 0; j < 50u; j++) {
+      serial.createSynapse(segment, rng.getUInt32(1024u), (Permanence)rng.getReal64());
+    }
+  }
+  Connections parallel(serial);
+  parallel.setNumThreads(3u);
+
+  SDR input({ 1024u });
+  vector<Segment> segments;
+  for(UInt iter = 0; iter < 10u; iter++) {
+    input.randomize(0.3f, rng);
+    segments.clear();
+    for(Segment segment = iter % 3u; segment < 200u; segment += 3u) {
+      segments.push_back(segment);
+    }
+    for(const auto segment : segments) {
+      serial.adaptSegment(segment, input, 0.1f, 0.05f);
+    }
+    parallel.adaptSegments(segments, input, 0.1f, 0.05f);
+    ASSERT_EQ(serial, parallel);
+
+    vector<SynapseIdx> connected1(serial.segmentFlatListLength(), 0);
+    vector<SynapseIdx> connected2(parallel.segmentFlatListLength(), 0);
+    serial.computeActivity(connected1, input.getSparse(), false);
+    parallel.computeActivity(connected2, input.getSparse(), false);
+    ASSERT_EQ(connected1, connected2);
+    for(const auto segment : segments) {
+      ASSERT_EQ(serial.dataForSegment(segment).numConnected,
+                parallel.dataForSegment(segment).numConnected);
+    }
+  }
+}
+
+/**
+ * adaptSegments prunes the same synapses and segments as adaptSegment, for
+ * any number of threads.
+ */
+TEST(ConnectionsTest, testAdaptSegmentsPrune) {
+  Connections serial(1024, 0.5f);
+  Random rng(12);
+  for(UInt i = 0; i < 200u; i++) {
+    const Segment segment = serial.createSegment(i);
+    // Every 10th segment has only weak synapses, which all get pruned.
+    const Real maxPermanence = i % 10u == 0u ? 0.02f : 1.0f;
+    for(UInt j = 0; j < 20u; j++) {
+      serial.createSynapse(segment, rng.getUInt32(1024u), (Permanence)(rng.getReal64() * maxPermanence));
+    }
+  }
+  Connections parallel(serial);
+  parallel.setNumThreads(3u);
+
+  SDR input({ 1024u });
+  vector<Segment> segments;
+  for(UInt iter = 0; iter < 5u; iter++) {
+    input.randomize(0.02f, rng);
+    segments.clear();
+    for(CellIdx cell = iter % 3u; cell < 200u; cell += 3u) {
+      for(const auto segment : serial.segmentsForCell(cell)) {
+        segments.push_back(segment);
+      }
+    }
+    for(const auto segment : segments) {
+      serial.adaptSegment(segment, input, 0.1f, 0.05f, true);
+    }
+    parallel.adaptSegments(segments, input, 0.1f, 0.05f, true);
+    ASSERT_EQ(serial, parallel);
+    ASSERT_EQ(serial.numSegments(), parallel.numSegments());
+    ASSERT_EQ(serial.numSynapses(), parallel.numSynapses());
+  }
+  ASSERT_LT(serial.numSegments(), 200u);
+}
+
+/**
+ * adaptSegment & bumpSegment update all permanences of a segment at once,
+ * check the clamping and that the connected-synapse bookkeeping follows.
+ */
+TEST(ConnectionsTest, testAdaptSegmentBulkUpdate) {
+  Connections connections(100, 0.5f);
+  const Segment segment = connections.createSegment(0);
+  const vector<Permanence> initial = {0.0f, 0.05f, 0.45f, 0.48f, 0.5f, 0.52f, 0.95f, 1.0f};
+  vector<Synapse> synapses;
+  for(UInt i = 0; i < initial.size(); i++) {
+    synapses.push_back( connections.createSynapse(segment, i, initial[i]) );
+  }
+  SDR input({ 100u });
+  input.setSparse(SDR_sparse_t{ 1u, 3u, 5u, 7u }); //odd presynaptic cells active
+
+  connections.adaptSegment(segment, input, 0.1f, 0.05f);
+  const vector<Permanence> adapted = {0.0f, 0.15f, 0.40f, 0.58f, 0.45f, 0.62f, 0.90f, 1.0f};
+  for(UInt i = 0; i < synapses.size(); i++) {
+    ASSERT_NEAR(adapted[i], connections.dataForSynapse(synapses[i]).permanence, permanenceTolerance) << i;
+  }
+  ASSERT_EQ(4u, connections.dataForSegment(segment).numConnected);
+  vector<SynapseIdx> numConnected(connections.segmentFlatListLength(), 0);
+  input.setSparse(SDR_sparse_t{ 0u, 1u, 2u, 3u, 4u, 5u, 6u, 7u });
+  connections.computeActivity(numConnected, input.getSparse(), false);
+  ASSERT_EQ(4u, numConnected[segment]);
+
+  connections.bumpSegment(segment, -0.2f);
+  const vector<Permanence> bumped = {0.0f, 0.0f, 0.20f, 0.38f, 0.25f, 0.42f, 0.70f, 0.80f};
+  for(UInt i = 0; i < synapses.size(); i++) {
+    ASSERT_NEAR(bumped[i], connections.dataForSynapse(synapses[i]).permanence, permanenceTolerance) << i;
+  }
+  ASSERT_EQ(2u, connections.dataForSegment(segment).numConnected);
+  numConnected.assign(connections.segmentFlatListLength(), 0);
+  connections.computeActivity(numConnected, input.getSparse(), false);
+  ASSERT_EQ(2u, numConnected[segment]);
+}
+
+/**
+ * Stored permanences are what roundPermanence() returns (a no-op with Real32
+ * storage, 16-bit fixed point with PERMANENCE_FIXED16), and the connected
+ * state follows exactly from the stored value.
+ */
+TEST(ConnectionsTest, testStoredPermanence) {
+  const Permanence threshold = 0.5f;
+  Connections connections(10, threshold);
+  const Segment segment = connections.createSegment(0);
+
+  for(const Permanence perm : {0.0f, 0.1234567f, 0.49999f, 0.5f, 0.50001f, 0.987654f, 1.0f}) {
+    const Permanence rounded = roundPermanence(perm);
+    ASSERT_EQ(rounded, roundPermanence(rounded)) << "rounding must be idempotent";
+    ASSERT_NEAR(perm, rounded, 1.0f / 65535.0f);
+
+    const Synapse synapse = connections.createSynapse(segment, 1, perm);
+    ASSERT_EQ(rounded, connections.dataForSynapse(synapse).permanence);
+
+    vector<SynapseIdx> numConnected(connections.segmentFlatListLength(), 0);
+    connections.computeActivity(numConnected, {1u}, false);
+    const bool connected = rounded >= connections.getConnectedThreshold();
+    ASSERT_EQ(connected ? 1u : 0u, numConnected[segment]) << "permanence " << perm;
+    ASSERT_EQ(connected ? 1u : 0u, connections.dataForSegment(segment).numConnected);
+    connections.destroySynapse(synapse);
+  }
+  ASSERT_EQ(roundPermanence(1.0f), 1.0f);
+  ASSERT_EQ(roundPermanence(0.0f), 0.0f);
+}
+
+class CompactHandler : public ConnectionsEventHandler {
+public:
+  virtual void onCompact(const vector<Segment> &segments, const vector<Synapse> &synapses) {
+    numCalls++;
+    segmentMap = segments;
+    synapseMap = synapses;
+  }
+  UInt numCalls = 0u;
+  vector<Segment> segmentMap;
+  vector<Synapse> synapseMap;
+};
+
+/**
+ * Destroys some segments and synapses, compacts, and makes sure the remaining
+ * ones are renumbered densely and work the same as before.
+ */
+TEST(ConnectionsTest, testCompact) {
+  for(const bool flatIndex : {false, true}) {
+    Connections connections(1024, 0.5f, false, flatIndex);
+    auto handler = new CompactHandler();
+    const auto token = connections.subscribe(handler);
+
+    Random rng(7);
+    const UInt numInputs = 2000u;
+    vector<Segment> segments;
+    for(UInt i = 0; i < 300; i++) {
+      const Segment segment = connections.createSegment(rng.getUInt32(1024u));
+      vector<CellIdx> presyn;
+      vector<Permanence> perms;
+      for(UInt s = 0; s < 10; s++) {
+        presyn.push_back(rng.getUInt32(numInputs));
+        perms.push_back((Permanence)rng.getReal64());
+      }
+      connections.createSynapses(segment, presyn, perms);
+      segments.push_back(segment);
+    }
+    vector<Segment> live;
+    for(size_t i = 0; i < segments.size(); i++) {
+      if(i % 3 == 0) {
+        connections.destroySegment(segments[i]);
+        continue;
+      }
+      const auto synapses = connections.synapsesForSegment(segments[i]);
+      for(size_t s = i % 4; s < synapses.size(); s += 4) {
+        connections.destroySynapse(synapses[s]);
+      }
+      live.push_back(segments[i]);
+    }
+    const size_t numSynapses = connections.numSynapses();
+
+    vector<CellIdx> input;
+    for(CellIdx presyn = 0; presyn < numInputs; presyn += 2) {
+      input.push_back(presyn);
+    }
+    vector<SynapseIdx> active1(connections.segmentFlatListLength(), 0u);
+    vector<SynapseIdx> potential1(connections.segmentFlatListLength(), 0u);
+    connections.computeActivity(active1, potential1, input, false);
+    map<Segment, vector<Synapse>> synapsesBefore;
+    map<Segment, CellIdx> cellsBefore;
+    for(const auto segment : live) {
+      const auto &synapses = connections.synapsesForSegment(segment);
+      synapsesBefore[segment] = vector<Synapse>(synapses.begin(), synapses.end());
+      cellsBefore[segment] = connections.cellForSegment(segment);
+    }
+
+    connections.compact();
+    ASSERT_EQ(1u, handler->numCalls);
+    ASSERT_EQ(200u, connections.segmentFlatListLength());
+    ASSERT_EQ(200u, connections.numSegments());
+    ASSERT_EQ(numSynapses, connections.numSynapses());
+
+    vector<SynapseIdx> active2(connections.segmentFlatListLength(), 0u);
+    vector<SynapseIdx> potential2(connections.segmentFlatListLength(), 0u);
+    connections.computeActivity(active2, potential2, input, false);
+    for(const auto segment : live) {
+      const Segment moved = handler->segmentMap[segment];
+      ASSERT_NE(Connections::REMOVED_SEGMENT, moved);
+      ASSERT_EQ(cellsBefore[segment], connections.cellForSegment(moved));
+      ASSERT_EQ(active1[segment], active2[moved]);
+      ASSERT_EQ(potential1[segment], potential2[moved]);
+      const auto &synapses = connections.synapsesForSegment(moved);
+      ASSERT_EQ(synapsesBefore[segment].size(), synapses.size());
+      for(size_t s = 0; s < synapses.size(); s++) {
+        ASSERT_EQ(handler->synapseMap[synapsesBefore[segment][s]], synapses[s]);
+        ASSERT_EQ(moved, connections.segmentForSynapse(synapses[s]));
+      }
+    }
+    ASSERT_EQ(Connections::REMOVED_SEGMENT, handler->segmentMap[segments[0]]);
+
+    // Keeps working after the compaction.
+    const Segment segment = connections.createSegment(5);
+    ASSERT_EQ(200u, segment);
+    connections.createSynapses(segment, {1u, 2u, 3u}, 0.6f);
+    connections.destroySegment(connections.segmentsForCell(cellsBefore[live[0]])[0]);
+    connections.compact();
+    ASSERT_EQ(2u, handler->numCalls);
+    ASSERT_EQ(200u, connections.numSegments());
+    connections.compact(); //nothing to do
+    ASSERT_EQ(2u, handler->numCalls);
+
+    connections.unsubscribe(token);
+  }
+}
+
+/**
+ * Automatic compaction happens when learning, once enough segments died.
+ */
+TEST(ConnectionsTest, testCompactionThreshold) {
+  Connections connections(1024);
+  EXPECT_ANY_THROW(connections.setCompactionThreshold(1.5f));
+  connections.setCompactionThreshold(0.25f);
+
+  vector<Segment> segments;
+  for(CellIdx cell = 0; cell < 100; cell++) {
+    segments.push_back(connections.createSegment(cell));
+    connections.createSynapses(segments.back(), {cell, cell + 1u}, 0.6f);
+  }
+  for(UInt i = 0; i < 30; i++) {
+    connections.destroySegment(segments[i * 3]);
+  }
+  vector<SynapseIdx> active(connections.segmentFlatListLength(), 0u);
+  vector<SynapseIdx> potential(connections.segmentFlatListLength(), 0u);
+  connections.computeActivity(active, potential, {4u}, false);
+  ASSERT_EQ(100u, connections.segmentFlatListLength()) << "no compaction without learning";
+
+  active.assign(connections.segmentFlatListLength(), 0u);
+  potential.assign(connections.segmentFlatListLength(), 0u);
+  connections.computeActivity(active, potential, {4u}, true);
+  ASSERT_EQ(70u, connections.segmentFlatListLength());
+  ASSERT_EQ(70u, active.size());
+  ASSERT_EQ(70u, potential.size());
+  // Cell 4 is on the segments of cells 3 (destroyed) & 4. Segment 4 is now 2.
+  ASSERT_EQ(1u, std::accumulate(active.begin(), active.end(), 0u));
+  ASSERT_EQ(1u, active[2]);
+  ASSERT_EQ(4u, connections.cellForSegment(2));
+}
+
+/**
+ * Randomly creates, uses and destroys segments, and makes sure createSegment
+ * evicts the least recently used segment (ties by the lower Segment), and
+ * that the segments' indices on their cells stay correct.
+ */
+TEST(ConnectionsTest, testSegmentLRU) {
+  Connections connections(4);
+  Random rng(3);
+  const SegmentIdx maxSegments = 5;
+  vector<SynapseIdx> counts;
+
+  for(UInt step = 0; step < 2000; step++) {
+    const CellIdx cell = rng.getUInt32(4u);
+    const SegmentList segments = connections.segmentsForCell(cell);
+    const UInt action = rng.getUInt32(4u);
+    if(action == 0u) {
+      Segment lru = Connections::REMOVED_SEGMENT;
+      for(const auto segment : segments) {
+        if(lru == Connections::REMOVED_SEGMENT ||
+           connections.dataForSegment(segment).lastUsed < connections.dataForSegment(lru).lastUsed ||
+          (connections.dataForSegment(segment).lastUsed == connections.dataForSegment(lru).lastUsed && segment < lru)) {
+          lru = segment;
+        }
+      }
+      const Segment created = connections.createSegment(cell, maxSegments);
+      ASSERT_EQ(connections.iteration(), connections.dataForSegment(created).lastUsed);
+      if(segments.size() == maxSegments) {
+        ASSERT_EQ(lru, created) << "the evicted segment is reused right away";
+        ASSERT_EQ(maxSegments, connections.numSegments(cell));
+      }
+    }
+    else if(action == 1u && !segments.empty()) {
+      connections.touchSegment(segments[rng.getUInt32((UInt32)segments.size())]);
+    }
+    else if(action == 2u && !segments.empty()) {
+      connections.destroySegment(segments[rng.getUInt32((UInt32)segments.size())]);
+    }
+    else if(action == 3u) {
+      counts.assign(connections.segmentFlatListLength(), 0u);
+      connections.computeActivity(counts, {}, true); //next iteration
+    }
+
+    size_t total = 0u;
+    for(CellIdx c = 0; c < 4u; c++) {
+      const auto &onCell = connections.segmentsForCell(c);
+      total += onCell.size();
+      for(SegmentIdx i = 0; i < onCell.size(); i++) {
+        ASSERT_EQ(i, connections.idxOnCellForSegment(onCell[i]));
+        ASSERT_EQ(c, connections.cellForSegment(onCell[i]));
+        ASSERT_EQ(onCell[i], connections.getSegment(c, i));
+      }
+    }
+    ASSERT_EQ(total, connections.numSegments());
+  }
+}
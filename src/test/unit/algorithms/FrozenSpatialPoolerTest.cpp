@@ -0,0 +1,158 @@
+/* ---------------------------------------------------------------------
+ * HTM Community Edition of NuPIC
+ * Copyright (C) 2019, The HTM Community
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ * --------------------------------------------------------------------- */
+
+/** @file
+ * Implementation of unit tests for FrozenSpatialPooler
+ */
+
+#include "gtest/gtest.h"
+
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <htm/algorithms/FrozenSpatialPooler.hpp>
+#include <htm/algorithms/SpatialPooler.hpp>
+#include <htm/utils/Random.hpp>
+
+namespace testing {
+
+using namespace htm;
+using std::vector;
+
+// Trains a SpatialPooler on random inputs.
+void train(SpatialPooler &sp, Random &rng, UInt steps = 50u) {
+  SDR input(sp.getInputDimensions());
+  SDR active(sp.getColumnDimensions());
+  for (UInt i = 0; i < steps; i++) {
+    input.randomize(0.1f, rng);
+    sp.compute(input, true, active);
+  }
+}
+
+// The frozen SP computes the same columns as the SP without learning.
+void expectSameOutputs(SpatialPooler &sp, const FrozenSpatialPooler &frozen, Random &rng) {
+  SDR input(sp.getInputDimensions());
+  SDR expected(sp.getColumnDimensions());
+  SDR actual(sp.getColumnDimensions());
+  for (UInt i = 0; i < 50u; i++) {
+    input.randomize(0.1f, rng);
+    sp.compute(input, false, expected);
+    frozen.compute(input, actual);
+    ASSERT_EQ(expected, actual) << "input " << i;
+  }
+}
+
+
+TEST(FrozenSpatialPoolerTest, GlobalInhibition) {
+  Random rng(1);
+  SpatialPooler sp({100u}, {400u});
+  sp.setBoostStrength(3.0f);
+  train(sp, rng);
+  const FrozenSpatialPooler frozen(sp);
+  EXPECT_EQ(sp.getNumInputs(), frozen.getNumInputs());
+  EXPECT_EQ(sp.getNumColumns(), frozen.getNumColumns());
+  expectSameOutputs(sp, frozen, rng);
+
+  // Without boosting
+  sp.setBoostStrength(0.0f);
+  expectSameOutputs(sp, FrozenSpatialPooler(sp), rng);
+}
+
+
+TEST(FrozenSpatialPoolerTest, LocalInhibition) {
+  for (const bool wrap : {false, true}) {
+    Random rng(2);
+    SpatialPooler sp({16u, 16u}, {16u, 16u}, 4u);
+    sp.setGlobalInhibition(false);
+    sp.setWrapAround(wrap);
+    train(sp, rng);
+    ASSERT_LT(sp.getInhibitionRadius(), 16u);
+    expectSameOutputs(sp, FrozenSpatialPooler(sp), rng);
+  }
+}
+
+
+TEST(FrozenSpatialPoolerTest, Snapshot) {
+  Random rng(3);
+  SpatialPooler sp({100u}, {200u});
+  train(sp, rng);
+  const FrozenSpatialPooler frozen(sp);
+  SpatialPooler copy(sp);
+
+  // Learning does not change the frozen SP
+  train(sp, rng);
+  expectSameOutputs(copy, frozen, rng);
+}
+
+
+TEST(FrozenSpatialPoolerTest, Serialization) {
+  Random rng(4);
+  SpatialPooler sp({100u}, {200u});
+  sp.setBoostStrength(1.0f);
+  train(sp, rng);
+  const FrozenSpatialPooler frozen(sp);
+
+  std::stringstream frozenStream, spStream;
+  frozen.save(frozenStream);
+  sp.save(spStream);
+  EXPECT_LT(frozenStream.str().size(), spStream.str().size());
+
+  FrozenSpatialPooler restored;
+  restored.load(frozenStream);
+  ASSERT_EQ(frozen, restored);
+  expectSameOutputs(sp, restored, rng);
+
+  FrozenSpatialPooler empty;
+  EXPECT_NE(frozen, empty);
+}
+
+
+TEST(FrozenSpatialPoolerTest, Threads) {
+  Random rng(5);
+  SpatialPooler sp({100u}, {400u});
+  train(sp, rng);
+  const FrozenSpatialPooler frozen(sp);
+
+  vector<SDR> inputs;
+  vector<SDR> expected;
+  for (UInt i = 0; i < 40u; i++) {
+    inputs.emplace_back(vector<UInt>{100u});
+    inputs.back().randomize(0.1f, rng);
+    expected.emplace_back(vector<UInt>{400u});
+    frozen.compute(inputs.back(), expected.back());
+  }
+
+  vector<vector<SDR>> outputs(4u);
+  vector<std::thread> threads;
+  for (auto &output : outputs) {
+    threads.emplace_back([&]() {
+      for (const auto &input : inputs) {
+        output.emplace_back(vector<UInt>{400u});
+        frozen.compute(input, output.back());
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (const auto &output : outputs) {
+    ASSERT_EQ(expected, output);
+  }
+}
+
+} // end namespace testing
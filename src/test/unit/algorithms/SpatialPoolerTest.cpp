@@ -29,6 +29,7 @@
 #include <htm/algorithms/SpatialPooler.hpp>
 
 #include <htm/utils/StlIo.hpp>
+#include <htm/utils/Topology.hpp>
 #include <htm/types/Types.hpp>
 #include <htm/utils/Log.hpp>
 #include <htm/os/Timer.hpp>
@@ -52,7 +53,11 @@ UInt countNonzero(const vector<UInt> &vec) {
 
 bool almost_eq(Real a, Real b) {
   Real diff = a - b;
+#ifdef NTA_PERMANENCE_FIXED16
+  return (diff > -permanenceTolerance && diff < permanenceTolerance);
+#else
   return (diff > -1e-5 && diff < 1e-5);
+#endif
 }
 
 bool check_vector_eq(UInt arr[], vector<UInt> vec) {  //TODO replace with ArrayBase, VectorHelpers or teplates
@@ -929,7 +934,11 @@ TEST(SpatialPoolerTest, testBumpUpWeakColumns) {
     Real perm[8];
     sp.getPermanence(i, perm);
     for(UInt z = 0; z < numInputs; z++)
+#ifdef NTA_PERMANENCE_FIXED16
+      ASSERT_NEAR( truePermArr[i][z], perm[z], permanenceTolerance );
+#else
       ASSERT_FLOAT_EQ( truePermArr[i][z], perm[z] );
+#endif
   }
 }
 
@@ -969,6 +978,283 @@ TEST(SpatialPoolerTest, testUpdateDutyCyclesHelper) {
 }
 
 
+/**
+ * Lazy duty cycles track the eager updates, between and on update rounds,
+ * and are serialized as eager duty cycles.
+ */
+TEST(SpatialPoolerTest, testLazyDutyCycles) {
+  for(const bool global : {true, false}) {
+    SpatialPooler eager({10u, 10u}, {12u, 12u}, 3u);
+    eager.setGlobalInhibition(global);
+    eager.setDutyCyclePeriod(40u);
+    eager.setUpdatePeriod(7u);
+    eager.setBoostStrength(0.0f);
+    SpatialPooler lazy(eager);
+    lazy.setLazyDutyCycles(true);
+    ASSERT_TRUE(lazy.getLazyDutyCycles());
+
+    const UInt numColumns = eager.getNumColumns();
+    vector<Real> expected(numColumns), actual(numColumns);
+    auto expectNear = [&](void (SpatialPooler::*get)(Real[]) const) {
+      (eager.*get)(expected.data());
+      (lazy.*get)(actual.data());
+      for(UInt i = 0; i < numColumns; i++) {
+        ASSERT_NEAR(expected[i], actual[i], 1e-5f) << "column " << i;
+      }
+    };
+
+    // Without boosting the active columns do not depend on rounding.
+    Random rng(global ? 1 : 2);
+    SDR input({10u, 10u}), output1({12u, 12u}), output2({12u, 12u});
+    for(UInt i = 0; i < 60u; i++) {
+      input.randomize(0.2f, rng);
+      eager.compute(input, true, output1);
+      lazy.compute(input, true, output2);
+      ASSERT_EQ(output1, output2) << "step " << i;
+      expectNear(&SpatialPooler::getOverlapDutyCycles);
+      expectNear(&SpatialPooler::getActiveDutyCycles);
+      expectNear(&SpatialPooler::getMinOverlapDutyCycles);
+    }
+
+    // The boost factors, and the boosted overlaps computed from them.
+    eager.setBoostStrength(2.0f);
+    lazy.setBoostStrength(2.0f);
+    vector<SynapseIdx> overlaps(numColumns);
+    vector<Real> boosted1(numColumns), boosted2(numColumns);
+    for(UInt i = 0; i < 10u; i++) {
+      input.randomize(0.2f, rng);
+      eager.compute(input, true, output1);
+      lazy.compute(input, true, output2);
+      expectNear(&SpatialPooler::getBoostFactors);
+      for(auto &overlap : overlaps) {
+        overlap = (SynapseIdx)rng.getUInt32(3u);
+      }
+      eager.boostOverlaps_(overlaps, boosted1);
+      lazy.boostOverlaps_(overlaps, boosted2);
+      for(UInt c = 0; c < numColumns; c++) {
+        ASSERT_NEAR(boosted1[c], boosted2[c], 1e-4f);
+      }
+    }
+
+    // Serialized as eager duty cycles
+    stringstream ss;
+    lazy.save(ss);
+    SpatialPooler restored;
+    restored.load(ss);
+    ASSERT_FALSE(restored.getLazyDutyCycles());
+    ASSERT_TRUE(restored == lazy);
+    lazy.setLazyDutyCycles(false);
+    ASSERT_FALSE(lazy.getLazyDutyCycles());
+    ASSERT_TRUE(restored == lazy);
+    vector<Real> restoredDuty(numColumns);
+    restored.getActiveDutyCycles(restoredDuty.data());
+    lazy.getActiveDutyCycles(actual.data());
+    ASSERT_EQ(restoredDuty, actual);
+  }
+}
+
+
+/**
+ * Inference after lazy training computes the stale boost factors once,
+ * not on every compute.
+ */
+class LazyBoostSpatialPooler : public SpatialPooler {
+public:
+  using SpatialPooler::SpatialPooler;
+  bool boostFactorsStale() const { return boostFactorsStale_; }
+};
+
+TEST(SpatialPoolerTest, testLazyDutyCyclesInference) {
+  LazyBoostSpatialPooler sp({10u, 10u}, {12u, 12u}, 3u);
+  sp.setGlobalInhibition(true);
+  sp.setDutyCyclePeriod(40u);
+  sp.setUpdatePeriod(50u);
+  sp.setBoostStrength(2.0f);
+  sp.setLazyDutyCycles(true);
+
+  Random rng(3);
+  SDR input({10u, 10u}), output({12u, 12u}), expected({12u, 12u});
+  for(UInt i = 0; i < 20u; i++) {
+    input.randomize(0.2f, rng);
+    sp.compute(input, true, output);
+  }
+  ASSERT_TRUE(sp.boostFactorsStale());
+
+  const UInt numColumns = sp.getNumColumns();
+  vector<Real> boostFactors(numColumns), dutyCycles(numColumns);
+  sp.getBoostFactors(boostFactors.data());
+  sp.getActiveDutyCycles(dutyCycles.data());
+  SpatialPooler eager(sp);
+  eager.setLazyDutyCycles(false);
+
+  for(UInt i = 0; i < 5u; i++) {
+    input.randomize(0.2f, rng);
+    sp.compute(input, false, output);
+    ASSERT_FALSE(sp.boostFactorsStale());
+    eager.compute(input, false, expected);
+    ASSERT_EQ(output, expected) << "step " << i;
+  }
+  vector<Real> actual(numColumns);
+  sp.getBoostFactors(actual.data());
+  ASSERT_EQ(boostFactors, actual);
+  sp.getActiveDutyCycles(actual.data());
+  for(UInt i = 0; i < numColumns; i++) {
+    ASSERT_NEAR(dutyCycles[i], actual[i], 1e-6f) << "column " << i;
+  }
+  ASSERT_TRUE(sp.getLazyDutyCycles());
+
+  // Learning again marks them stale.
+  sp.compute(input, true, output);
+  ASSERT_TRUE(sp.boostFactorsStale());
+}
+
+
+TEST(SpatialPoolerTest, testIncrementalOverlaps) {
+  for(const bool learn : {false, true}) {
+    SpatialPooler full({20u, 20u}, {16u, 16u}, 4u);
+    full.setBoostStrength(1.0f);
+    full.setMinPctOverlapDutyCycles(0.2f); //bump up weak columns
+    full.setUpdatePeriod(5u);
+    SpatialPooler incremental(full);
+    incremental.setIncrementalOverlaps(true);
+    ASSERT_TRUE(incremental.getIncrementalOverlaps());
+
+    Random rng(learn ? 3 : 4);
+    SDR input({20u, 20u}), output1({16u, 16u}), output2({16u, 16u});
+    input.randomize(0.1f, rng);
+    for(UInt i = 0; i < 100u; i++) {
+      // Mostly small changes, and sometimes a new input.
+      if(i % 25u == 0u) {
+        input.randomize(0.1f, rng);
+      } else {
+        input.addNoise(0.02f, rng);
+      }
+      full.compute(input, learn, output1);
+      incremental.compute(input, learn, output2);
+      ASSERT_EQ(full.getOverlaps(), incremental.getOverlaps()) << "step " << i;
+      ASSERT_EQ(output1, output2) << "step " << i;
+    }
+
+    // Changing the synapses discards the kept overlaps.
+    vector<Real> permanences(full.getNumInputs());
+    full.getPermanence(0u, permanences.data());
+    for(auto &permanence : permanences) {
+      permanence = permanence > 0.0f ? 1.0f : 0.0f;
+    }
+    full.setPermanence(0u, permanences.data());
+    incremental.setPermanence(0u, permanences.data());
+    input.addNoise(0.02f, rng);
+    full.compute(input, learn, output1);
+    incremental.compute(input, learn, output2);
+    ASSERT_EQ(full.getOverlaps(), incremental.getOverlaps());
+    ASSERT_EQ(output1, output2);
+    ASSERT_TRUE(full == incremental);
+  }
+}
+
+TEST(SpatialPoolerTest, testNumThreads) {
+  struct Setup { vector<UInt> columns; bool global; Real boost; };
+  for(const auto &setup : {Setup{{96u, 96u}, true, 2.0f},   //parallel global inhibition
+                           Setup{{24u, 24u}, false, 0.0f},  //many ties
+                           Setup{{24u, 24u}, false, 1.0f}}) {
+    SpatialPooler serial({12u, 12u}, setup.columns, 4u);
+    serial.setGlobalInhibition(setup.global);
+    serial.setLocalAreaDensity(0.05f);
+    serial.setBoostStrength(setup.boost);
+    serial.setMinPctOverlapDutyCycles(0.1f);
+    serial.setUpdatePeriod(10u);
+    ASSERT_EQ(1u, serial.getNumThreads()) << "serial by default";
+    SpatialPooler parallel(serial);
+    parallel.setNumThreads(4u);
+    ASSERT_EQ(4u, parallel.getNumThreads());
+
+    Random rng(5);
+    SDR input({12u, 12u}), output1(setup.columns), output2(setup.columns);
+    for(UInt i = 0; i < 40u; i++) {
+      input.randomize(0.2f, rng);
+      const bool learn = i % 4u != 3u;
+      serial.compute(input, learn, output1);
+      parallel.compute(input, learn, output2);
+      ASSERT_EQ(output1, output2) << "step " << i;
+    }
+    ASSERT_TRUE(serial == parallel);
+  }
+}
+
+TEST(SpatialPoolerTest, testComputeBatch) {
+  struct Setup { vector<UInt> columns; bool global; UInt threads; };
+  for(const auto &setup : {Setup{{40u, 40u}, true,  1u},
+                           Setup{{40u, 40u}, true,  3u},
+                           Setup{{24u, 24u}, false, 1u},
+                           Setup{{24u, 24u}, false, 3u}}) {
+    SpatialPooler sp({12u, 12u}, setup.columns, 4u);
+    sp.setGlobalInhibition(setup.global);
+    sp.setBoostStrength(1.0f);
+    Random rng(6);
+    SDR input({12u, 12u}), output(setup.columns);
+    for(UInt i = 0; i < 20u; i++) {
+      input.randomize(0.2f, rng);
+      sp.compute(input, true, output);
+    }
+    SpatialPooler batch(sp);
+    batch.setNumThreads(setup.threads);
+
+    // More than a tile, the last one is partial.
+    vector<SDR> inputs;
+    for(UInt i = 0; i < SpatialPooler::BATCH_TILE + 9u; i++) {
+      inputs.emplace_back(vector<UInt>{12u, 12u});
+      inputs.back().randomize(0.2f, rng);
+    }
+    vector<SDR> outputs(2u, SDR(setup.columns));
+    batch.computeBatch(inputs, outputs);
+    ASSERT_EQ(inputs.size(), outputs.size());
+    for(size_t i = 0; i < inputs.size(); i++) {
+      sp.compute(inputs[i], false, output);
+      ASSERT_EQ(output, outputs[i]) << "input " << i;
+    }
+    ASSERT_EQ(sp.getOverlaps(), batch.getOverlaps());
+    ASSERT_EQ(sp.getBoostedOverlaps(), batch.getBoostedOverlaps());
+    ASSERT_TRUE(sp == batch);
+
+    batch.computeBatch({}, outputs);
+    ASSERT_TRUE(outputs.empty());
+  }
+}
+
+TEST(SpatialPoolerTest, testInitializeSynapses) {
+  SpatialPooler serial({30u, 30u}, {12u, 12u}, 3u, 0.5f, false);
+  SpatialPooler parallel(serial);
+  parallel.setNumThreads(4u);
+  serial.initializeSynapses(NoTopology(0.2f));
+  parallel.initializeSynapses(NoTopology(0.2f));
+  ASSERT_TRUE(serial == parallel) << "same synapses for any number of threads";
+
+  vector<UInt> potential(serial.getNumInputs());
+  vector<UInt> connectedCounts(serial.getNumColumns());
+  serial.getConnectedCounts(connectedCounts.data());
+  for(UInt column = 0; column < serial.getNumColumns(); column++) {
+    serial.getPotential(column, potential.data());
+    const UInt numPotential = std::accumulate(potential.begin(), potential.end(), 0u);
+    ASSERT_EQ(180u, numPotential); // 20% of the inputs, anywhere
+    ASSERT_GE(connectedCounts[column], serial.getStimulusThreshold());
+  }
+
+  SDR input({30u, 30u}), output1({12u, 12u}), output2({12u, 12u});
+  Random rng(7);
+  for(UInt i = 0; i < 10u; i++) {
+    input.randomize(0.1f, rng);
+    serial.compute(input, true, output1);
+    parallel.compute(input, true, output2);
+    ASSERT_EQ(output1, output2);
+  }
+
+  // The topology must give the input dimensions.
+  const Topology_t wrong = [](const SDR &, const vector<UInt> &, Random &) {
+    return SDR({10u});
+  };
+  EXPECT_ANY_THROW(serial.initializeSynapses(wrong));
+}
+
 TEST(SpatialPoolerTest, testUpdateBoostFactors) {
   SpatialPooler sp;
   setup(sp, 5, 6);
@@ -1197,6 +1483,51 @@ TEST(SpatialPoolerTest, testInhibitColumnsGlobal) {
 }
 
 
+/**
+ * Counting selection picks the same columns, in the same order, as the
+ * partial sort: integer overlaps with many ties, boosted real overlaps,
+ * a wide range of overlaps and equal overlaps.
+ */
+TEST(SpatialPoolerTest, testInhibitColumnsGlobalCounting) {
+  SpatialPooler sp;
+  const UInt numColumns = 500;
+  setup(sp, 100, numColumns);
+  sp.setStimulusThreshold(2u);
+  Random rng(7);
+  vector<Real> overlaps(numColumns);
+  for(UInt trial = 0; trial < 4u * 20u; trial++) {
+    for(UInt i = 0; i < numColumns; i++) {
+      switch(trial % 4u) {
+        case 0: overlaps[i] = (Real)rng.getUInt32(12u); break;
+        case 1: overlaps[i] = (Real)rng.getUInt32(12u) * (Real)(0.5 + rng.getReal64()); break;
+        case 2: overlaps[i] = (Real)(rng.getReal64() * 1.0e6); break;
+        case 3: overlaps[i] = 3.0f; break;
+      }
+    }
+    const Real density = 0.01f + 0.2f * (Real)rng.getReal64();
+    vector<UInt> sorted, counted;
+    sp.setCountingInhibition(false);
+    sp.inhibitColumnsGlobal_(overlaps, density, sorted);
+    sp.setCountingInhibition(true);
+    sp.inhibitColumnsGlobal_(overlaps, density, counted);
+    ASSERT_EQ(sorted, counted) << "trial " << trial;
+  }
+
+  // Whole runs, with boosting
+  sp.setLocalAreaDensity(0.05f);
+  SDR input({sp.getNumInputs()}), output1({numColumns}), output2({numColumns});
+  SpatialPooler sp1(sp);
+  sp1.setCountingInhibition(false);
+  SpatialPooler sp2(sp);
+  for(UInt i = 0; i < 100u; i++) {
+    input.randomize(0.2f, rng);
+    sp1.compute(input, true, output1);
+    sp2.compute(input, true, output2);
+    ASSERT_EQ(output1, output2);
+  }
+}
+
+
 TEST(SpatialPoolerTest, testValidateGlobalInhibitionParameters) {
   // With 10 columns the minimum sparsity for global inhibition is 10%
   // Setting sparsity to 2% should throw an exception
@@ -1360,6 +1691,124 @@ TEST(SpatialPoolerTest, testInhibitColumnsLocal) {
   }
 }
 
+/**
+ * Local inhibition on a 2-D grid uses cached neighborhoods; they must follow
+ * changes of the inhibition radius and of wrapAround. With the table limited
+ * the neighborhoods are walked, with the same results.
+ */
+TEST(SpatialPoolerTest, testInhibitColumnsLocalNeighborhoodCache) {
+  const vector<UInt> dimensions = {8u, 8u};
+  SpatialPooler sp(dimensions, dimensions);
+  sp.setGlobalInhibition(false);
+  Random rng(42);
+  vector<Real> overlaps(sp.getNumColumns());
+  for(auto &overlap : overlaps) {
+    overlap = (Real)rng.getUInt32(10u);
+  }
+  const Real density = 0.2f;
+  ASSERT_GE(sp.getNeighborhoodTableLimit(), 1024u * sp.getNumColumns()); //default
+
+  for(const size_t limit : {(size_t)1u << 20, (size_t)600u, (size_t)0u}) {
+    sp.setNeighborhoodTableLimit(limit);
+    ASSERT_EQ(limit, sp.getNeighborhoodTableLimit());
+    for(const bool wrap : {false, true, false}) {
+      for(const UInt radius : {1u, 3u, 2u}) {
+        sp.setWrapAround(wrap);
+        sp.setInhibitionRadius(radius);
+        vector<UInt> active;
+        sp.inhibitColumnsLocal_(overlaps, density, active);
+
+        // Reference: walk the neighborhoods.
+        vector<UInt> expected;
+        vector<bool> activeDense(sp.getNumColumns(), false);
+        for(UInt column = 0; column < sp.getNumColumns(); column++) {
+          if(overlaps[column] < sp.getStimulusThreshold()) continue;
+          vector<UInt> neighbors;
+          if(wrap) {
+            for(auto n : WrappingNeighborhood(column, radius, dimensions)) neighbors.push_back(n);
+          } else {
+            for(auto n : Neighborhood(column, radius, dimensions)) neighbors.push_back(n);
+          }
+          UInt numNeighbors = 0u, numBigger = 0u;
+          for(const auto n : neighbors) {
+            if(n == column) continue;
+            numNeighbors++;
+            if(overlaps[n] > overlaps[column] || (overlaps[n] == overlaps[column] && activeDense[n])) {
+              numBigger++;
+            }
+          }
+          if(numBigger < (UInt)(0.5f + density * (numNeighbors + 1))) {
+            expected.push_back(column);
+            activeDense[column] = true;
+          }
+        }
+        EXPECT_EQ(expected, active) << "limit " << limit << " wrap " << wrap << " radius " << radius;
+      }
+    }
+  }
+}
+
+/**
+ * The box filter engine for local inhibition gives the same results as
+ * visiting the neighborhoods, on 2-D and 3-D grids.
+ */
+TEST(SpatialPoolerTest, testBoxFilterInhibition) {
+  const vector<vector<UInt>> grids = {{12u, 10u}, {4u, 5u, 6u}};
+  Random rng(42);
+  for(const auto &dimensions : grids) {
+    SpatialPooler sp(dimensions, dimensions);
+    sp.setGlobalInhibition(false);
+    const UInt numColumns = sp.getNumColumns();
+    vector<Real> overlaps(numColumns), overlapDuty(numColumns), activeDuty(numColumns);
+    for(UInt i = 0; i < numColumns; i++) {
+      overlaps[i]    = (Real)rng.getUInt32(6u); //many ties
+      overlapDuty[i] = (Real)rng.getReal64();
+      activeDuty[i]  = (Real)rng.getReal64() * 0.1f;
+    }
+    sp.setOverlapDutyCycles(overlapDuty.data());
+    sp.setActiveDutyCycles(activeDuty.data());
+
+    for(const bool wrap : {false, true}) {
+      for(const UInt radius : {1u, 3u, 7u}) {
+        sp.setWrapAround(wrap);
+        sp.setInhibitionRadius(radius);
+        vector<UInt> active[2];
+        vector<Real> minDuty[2], boost[2];
+        for(const bool box : {false, true}) {
+          sp.setBoxFilterInhibition(box);
+          sp.inhibitColumnsLocal_(overlaps, 0.1f, active[box]);
+          sp.updateMinDutyCyclesLocal_();
+          sp.updateBoostFactorsLocal_();
+          minDuty[box].resize(numColumns);
+          boost[box].resize(numColumns);
+          sp.getMinOverlapDutyCycles(minDuty[box].data());
+          sp.getBoostFactors(boost[box].data());
+        }
+        EXPECT_EQ(active[0], active[1]) << "wrap " << wrap << " radius " << radius;
+        EXPECT_EQ(minDuty[0], minDuty[1]);
+        for(UInt i = 0; i < numColumns; i++) {
+          ASSERT_NEAR(boost[0][i], boost[1][i], 1e-4f);
+        }
+      }
+    }
+  }
+
+  // Whole runs, without boosting (which could differ in rounding).
+  const vector<UInt> dimensions = {16u, 16u};
+  SDR input(dimensions), output1(dimensions), output2(dimensions);
+  SpatialPooler sp1(dimensions, dimensions, 4u);
+  sp1.setGlobalInhibition(false);
+  sp1.setBoostStrength(0.0f);
+  SpatialPooler sp2(sp1);
+  sp2.setBoxFilterInhibition(true);
+  for(UInt i = 0; i < 100u; i++) {
+    input.randomize(0.1f, rng);
+    sp1.compute(input, true, output1);
+    sp2.compute(input, true, output2);
+    ASSERT_EQ(output1, output2);
+  }
+}
+
 TEST(SpatialPoolerTest, testIsUpdateRound) {
   SpatialPooler sp;
   sp.setUpdatePeriod(50);
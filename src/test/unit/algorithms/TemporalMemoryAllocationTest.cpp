@@ -0,0 +1,129 @@
+/* ---------------------------------------------------------------------
+ * HTM Community Edition of NuPIC
+ * Copyright (C) 2019, The HTM Community
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ * --------------------------------------------------------------------- */
+
+/** @file
+ * Allocation counting tests of the TemporalMemory.
+ *
+ * This file replaces the global operator new and delete, so it is built as
+ * its own executable (allocation_tests) and not as part of unit_tests. The
+ * allocations are only counted inside a CountAllocations scope, on the
+ * thread which opened it.
+ */
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include <htm/algorithms/TemporalMemory.hpp>
+#include <htm/types/Sdr.hpp>
+#include <htm/utils/Random.hpp>
+
+namespace {
+
+thread_local bool countAllocations = false;
+thread_local size_t numAllocations = 0u;
+
+void *allocate(std::size_t size) {
+  if (countAllocations) {
+    numAllocations++;
+  }
+  void *ptr = std::malloc(size > 0u ? size : 1u);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+// Counts the allocations of this thread during its lifetime.
+class CountAllocations {
+public:
+  CountAllocations() : start_(numAllocations) { countAllocations = true; }
+  ~CountAllocations() { countAllocations = false; }
+  size_t count() const { return numAllocations - start_; }
+
+private:
+  const size_t start_;
+};
+
+} // end anonymous namespace
+
+// The over-aligned variants are not replaced, they keep the allocator of the
+// standard library for both new and delete.
+void *operator new(std::size_t size) { return allocate(size); }
+void *operator new[](std::size_t size) { return allocate(size); }
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+
+namespace testing {
+
+using std::vector;
+using namespace htm;
+
+TEST(AllocationTest, countAllocations) {
+  ::operator delete(::operator new(16u)); //not counted
+  CountAllocations counter;
+  EXPECT_EQ(0u, counter.count());
+  ::operator delete(::operator new(16u));
+  EXPECT_EQ(1u, counter.count());
+}
+
+/**
+ * Once the TM learned a sequence, computing it again (with learning) does not
+ * allocate memory.
+ */
+TEST(TemporalMemoryTest, testComputeDoesNotAllocate) {
+  vector<SDR> pattern(20, SDR({1000u}));
+  Random rng(13);
+  for(auto &sdr : pattern) {
+    sdr.randomize(0.04f, rng);
+  }
+  TemporalMemory tm({1000u}, 8, 13, 0.21f, 0.50f, 10, 20, 0.10f, 0.10f, 0.01f, 42);
+  for(UInt trial = 0; trial < 20; trial++) {
+    for(const auto &x : pattern) {
+      tm.compute(x, true);
+    }
+    tm.reset();
+  }
+
+  {
+    CountAllocations counter;
+    for(const auto &x : pattern) {
+      tm.compute(x, true);
+    }
+    EXPECT_EQ(0u, counter.count());
+  }
+  EXPECT_EQ(0.0f, tm.anomaly);
+
+  // Nor does inference on a state.
+  TMState state = tm.createState();
+  for(const auto &x : pattern) {
+    tm.compute(state, x);
+  }
+  state.reset();
+  {
+    CountAllocations counter;
+    for(const auto &x : pattern) {
+      tm.compute(state, x);
+    }
+    EXPECT_EQ(0u, counter.count());
+  }
+}
+
+} // end namespace testing
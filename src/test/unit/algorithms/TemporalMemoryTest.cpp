@@ -21,6 +21,7 @@
 
 #include <cstring>
 #include <fstream>
+#include <thread>
 #include <htm/utils/StlIo.hpp>
 #include <htm/types/Types.hpp>
 #include <htm/types/Sdr.hpp>
@@ -28,6 +29,7 @@
 #include <stdio.h>
 
 #include "gtest/gtest.h"
+#include <htm/algorithms/Anomaly.hpp>
 #include <htm/algorithms/TemporalMemory.hpp>
 
 
@@ -35,7 +37,11 @@ namespace testing {
 
 using namespace std;
 using namespace htm;
+#ifdef NTA_PERMANENCE_FIXED16
+#define EPSILON permanenceTolerance //permanences are stored as 16-bit fixed point
+#else
 #define EPSILON 0.0000001
+#endif
 
 
 TEST(TemporalMemoryTest, testInitInvalidParams) {
@@ -505,9 +511,9 @@ TEST(TemporalMemoryTest, NewSegmentAddSynapsesToSubsetOfWinnerCells) {
 
   auto winnerCells = tm.getWinnerCells();
   ASSERT_EQ(1ul, winnerCells.size());
-  vector<Segment> segments = tm.connections.segmentsForCell(winnerCells[0]);
+  SegmentList segments = tm.connections.segmentsForCell(winnerCells[0]);
   ASSERT_EQ(1ul, segments.size());
-  vector<Synapse> synapses = tm.connections.synapsesForSegment(segments[0]);
+  SynapseList synapses = tm.connections.synapsesForSegment(segments[0]);
   ASSERT_EQ(2ul, synapses.size());
   for (Synapse synapse : synapses) {
     SynapseData synapseData = tm.connections.dataForSynapse(synapse);
@@ -550,9 +556,9 @@ TEST(TemporalMemoryTest, NewSegmentAddSynapsesToAllWinnerCells) {
 
   vector<CellIdx> winnerCells = tm.getWinnerCells();
   ASSERT_EQ(1ul, winnerCells.size());
-  vector<Segment> segments = tm.connections.segmentsForCell(winnerCells[0]);
+  SegmentList segments = tm.connections.segmentsForCell(winnerCells[0]);
   ASSERT_EQ(1ul, segments.size());
-  vector<Synapse> synapses = tm.connections.synapsesForSegment(segments[0]);
+  SynapseList synapses = tm.connections.synapsesForSegment(segments[0]);
   ASSERT_EQ(3ul, synapses.size());
 
   vector<CellIdx> presynapticCells;
@@ -600,7 +606,7 @@ TEST(TemporalMemoryTest, MatchingSegmentAddSynapsesToSubsetOfWinnerCells) {
 
   tm.compute(activeColumns);
 
-  vector<Synapse> synapses = tm.connections.synapsesForSegment(matchingSegment);
+  SynapseList synapses = tm.connections.synapsesForSegment(matchingSegment);
   ASSERT_EQ(3ul, synapses.size());
   for (SynapseIdx i = 1; i < synapses.size(); i++) {
     SynapseData synapseData = tm.connections.dataForSynapse(synapses[i]);
@@ -646,7 +652,7 @@ TEST(TemporalMemoryTest, MatchingSegmentAddSynapsesToAllWinnerCells) {
 
   tm.compute(activeColumns);
 
-  vector<Synapse> synapses = tm.connections.synapsesForSegment(matchingSegment);
+  SynapseList synapses = tm.connections.synapsesForSegment(matchingSegment);
   ASSERT_EQ(2ul, synapses.size());
 
   SynapseData synapseData = tm.connections.dataForSynapse(synapses[1]);
@@ -692,7 +698,7 @@ TEST(TemporalMemoryTest, ActiveSegmentGrowSynapsesAccordingToPotentialOverlap) {
 
   tm.compute(activeColumns);
 
-  vector<Synapse> synapses = tm.connections.synapsesForSegment(activeSegment);
+  SynapseList synapses = tm.connections.synapsesForSegment(activeSegment);
 
   ASSERT_EQ(4ul, synapses.size());
 
@@ -828,7 +834,7 @@ TEST(TemporalMemoryTest, RecycleWeakestSynapseToMakeRoomForNewSynapse) {
   tm.compute(activeColumns);
 
   // There should now be 3 synapses, and none of them should be to cell 0.
-  const vector<Synapse> &synapses =
+  const SynapseList &synapses =
       tm.connections.synapsesForSegment(matchingSegment);
   ASSERT_EQ(4ul, synapses.size());
 
@@ -1065,9 +1071,9 @@ TEST(TemporalMemoryTest, AddSegmentToCellWithFewestSegments) {
     EXPECT_EQ(1ul, tm.connections.numSynapses(segment1));
     EXPECT_EQ(1ul, tm.connections.numSynapses(segment2));
 
-    vector<Segment> segments = tm.connections.segmentsForCell(1);
+    SegmentList segments = tm.connections.segmentsForCell(1);
     if (segments.empty()) {
-      vector<Segment> segments2 = tm.connections.segmentsForCell(2);
+      SegmentList segments2 = tm.connections.segmentsForCell(2);
       EXPECT_FALSE(segments2.empty());
       grewOnCell2 = true;
       segments.insert(segments.end(), segments2.begin(), segments2.end());
@@ -1076,7 +1082,7 @@ TEST(TemporalMemoryTest, AddSegmentToCellWithFewestSegments) {
     }
 
     ASSERT_EQ(1ul, segments.size());
-    vector<Synapse> synapses = tm.connections.synapsesForSegment(segments[0]);
+    SynapseList synapses = tm.connections.synapsesForSegment(segments[0]);
     EXPECT_EQ(4ul, synapses.size());
 
     set<CellIdx> columnChecklist(previousActiveColumns.getSparse().data(),
@@ -1286,11 +1292,11 @@ TEST(TemporalMemoryTest, CreateSegmentDestroyOld) {
   tm.connections.createSynapse(segment3, 1, 0.5);
   tm.connections.createSynapse(segment3, 2, 0.5);
 
-  vector<Segment> segments = tm.connections.segmentsForCell(12);
+  SegmentList segments = tm.connections.segmentsForCell(12);
   ASSERT_EQ(2ul, segments.size());
 
   // Verify first segment is still there with the same synapses.
-  vector<Synapse> synapses1 = tm.connections.synapsesForSegment(segment1);
+  SynapseList synapses1 = tm.connections.synapsesForSegment(segment1);
   ASSERT_EQ(3ul, synapses1.size());
   ASSERT_EQ(1ul, tm.connections.dataForSynapse(synapses1[0]).presynapticCell);
   ASSERT_EQ(2ul, tm.connections.dataForSynapse(synapses1[1]).presynapticCell);
@@ -1464,7 +1470,7 @@ void serializationTestVerify(TemporalMemory &tm) {
   // Verify the active segment learned.
   ASSERT_EQ(1ul, tm.connections.numSegments(4));
   Segment activeSegment = tm.connections.segmentsForCell(4)[0];
-  const vector<Synapse> syns1 =
+  const SynapseList syns1 =
       tm.connections.synapsesForSegment(activeSegment);
   ASSERT_EQ(4ul, syns1.size());
   EXPECT_EQ(0ul, tm.connections.dataForSynapse(syns1[0]).presynapticCell);
@@ -1479,7 +1485,7 @@ void serializationTestVerify(TemporalMemory &tm) {
   // Verify the non-best matching segment is unchanged.
   ASSERT_EQ(1ul, tm.connections.numSegments(8));
   Segment matchingSegment1 = tm.connections.segmentsForCell(8)[0];
-  const vector<Synapse> syns2 =
+  const SynapseList syns2 =
       tm.connections.synapsesForSegment(matchingSegment1);
   ASSERT_EQ(3ul, syns2.size());
   EXPECT_EQ(0ul, tm.connections.dataForSynapse(syns2[0]).presynapticCell);
@@ -1492,7 +1498,7 @@ void serializationTestVerify(TemporalMemory &tm) {
   // Verify the best matching segment learned.
   ASSERT_EQ(1ul, tm.connections.numSegments(9));
   Segment matchingSegment2 = tm.connections.segmentsForCell(9)[0];
-  const vector<Synapse> syns3 =
+  const SynapseList syns3 =
       tm.connections.synapsesForSegment(matchingSegment2);
   ASSERT_EQ(4ul, syns3.size());
   EXPECT_EQ(0ul, tm.connections.dataForSynapse(syns3[0]).presynapticCell);
@@ -1510,7 +1516,7 @@ void serializationTestVerify(TemporalMemory &tm) {
   EXPECT_LT(winnerCell, 16u);
   ASSERT_EQ(1ul, tm.connections.numSegments(winnerCell));
   Segment newSegment = tm.connections.segmentsForCell(winnerCell)[0];
-  const vector<Synapse> syns4 = tm.connections.synapsesForSegment(newSegment);
+  const SynapseList syns4 = tm.connections.synapsesForSegment(newSegment);
   ASSERT_EQ(1ul, syns4.size());
   EXPECT_EQ(prevWinnerCells[0],
             tm.connections.dataForSynapse(syns4[0]).presynapticCell);
@@ -1576,6 +1582,54 @@ TEST(TemporalMemoryTest, testSaveArLoadAr) {
 }
 
 
+/**
+ * Destroying a segment leaves the segments of its cell out of creation order
+ * (see Connections::destroySegment). A loaded TM must still order them by
+ * compareSegments() and compute exactly like the original.
+ */
+TEST(TemporalMemoryTest, testSaveLoadAfterDestroyedSegments) {
+  TemporalMemory tm1({32u}, 2, 3, 0.21f, 0.50f, 2, 3, 0.10f, 0.10f, 0.0f, 42);
+  Random rng(1);
+  vector<SDR> inputs(20, SDR({32u}));
+  for(auto &input : inputs) {
+    input.randomize(0.25f, rng);
+  }
+  for(UInt i = 0; i < 100u; i++) {
+    tm1.compute(inputs[i % inputs.size()], true);
+  }
+
+  // Destroy the oldest segment of the cells with 3 or more segments.
+  auto &connections = tm1.connections;
+  UInt numDestroyed = 0u;
+  for(CellIdx cell = 0; cell < tm1.numberOfCells(); cell++) {
+    if(connections.numSegments(cell) < 3u) continue;
+    auto segments = connections.segmentsForCell(cell);
+    std::sort(segments.begin(), segments.end(), [&](const Segment a, const Segment b) {
+      return connections.compareSegments(a, b);
+    });
+    connections.destroySegment(segments[0]);
+    numDestroyed++;
+  }
+  ASSERT_GT(numDestroyed, 0u);
+  tm1.reset();
+
+  stringstream ss;
+  tm1.save(ss);
+  TemporalMemory tm2;
+  tm2.load(ss);
+  ASSERT_TRUE(tm1 == tm2);
+
+  for(UInt i = 0; i < 100u; i++) {
+    const auto &input = inputs[(i * 7u) % inputs.size()];
+    tm1.compute(input, true);
+    tm2.compute(input, true);
+    ASSERT_EQ(tm1.getActiveCells(), tm2.getActiveCells()) << "step " << i;
+    ASSERT_EQ(tm1.getWinnerCells(), tm2.getWinnerCells()) << "step " << i;
+  }
+  ASSERT_TRUE(tm1 == tm2);
+}
+
+
 /*
  * Test compute( extraActive, extraWinners )
  
@@ -1662,6 +1716,164 @@ TEST(TemporalMemoryTest, testEquals) {
   ASSERT_EQ(tm, tmCopy);
 }
 
+/**
+ * With parallel learning the TM learns a sequence, with the same results for
+ * any number of threads.
+ */
+TEST(TemporalMemoryTest, testParallelLearning) {
+  vector<SDR> pattern(20, SDR({1000u}));
+  Random rng(7);
+  for(auto &sdr : pattern) {
+    sdr.randomize(0.05f, rng);
+  }
+
+  const auto makeTM = [](const UInt threads) {
+    TemporalMemory tm({1000u},
+      /* cellsPerColumn */               8,
+      /* activationThreshold */          13,
+      /* initialPermanence */            0.21f,
+      /* connectedPermanence */          0.50f,
+      /* minThreshold */                 10,
+      /* maxNewSynapseCount */           20,
+      /* permanenceIncrement */          0.10f,
+      /* permanenceDecrement */          0.10f,
+      /* predictedSegmentDecrement */    0.01f,
+      /* seed */                         42,
+      /* maxSegmentsPerCell */           2,
+      /* maxSynapsesPerSegment */        24);
+    tm.setParallelLearning(true);
+    tm.setNumThreads(threads);
+    return tm;
+  };
+  auto serial   = makeTM(1u);
+  auto parallel = makeTM(4u);
+  EXPECT_TRUE(parallel.getParallelLearning());
+  EXPECT_EQ(4u, parallel.getNumThreads());
+
+  for(UInt trial = 0; trial < 15; trial++) {
+    for(const auto &x : pattern) {
+      serial.compute(x, true);
+      parallel.compute(x, true);
+      ASSERT_EQ(serial.getActiveCells(), parallel.getActiveCells()) << "trial " << trial;
+      ASSERT_EQ(serial.getWinnerCells(), parallel.getWinnerCells()) << "trial " << trial;
+      ASSERT_EQ(serial.anomaly, parallel.anomaly);
+    }
+    serial.reset();
+    parallel.reset();
+  }
+  ASSERT_EQ(serial, parallel);
+
+  // Learned the sequence, apart from its first element.
+  for(const auto &x : pattern) {
+    parallel.compute(x, false);
+  }
+  EXPECT_EQ(0.0f, parallel.anomaly);
+}
+
+TEST(TemporalMemoryTest, testComputeState) {
+  vector<SDR> pattern(20, SDR({500u}));
+  Random rng(11);
+  for(auto &sdr : pattern) {
+    sdr.randomize(0.05f, rng);
+  }
+  TemporalMemory tm({500u}, 8, 13, 0.21f, 0.50f, 10, 20, 0.10f, 0.10f, 0.01f, 42);
+  for(UInt trial = 0; trial < 10; trial++) {
+    for(const auto &x : pattern) {
+      tm.compute(x, true);
+    }
+    tm.reset();
+  }
+
+  // The inputs of a stream: the pattern, then noise which bursts.
+  vector<SDR> inputs(pattern);
+  for(UInt i = 0; i < 10; i++) {
+    inputs.push_back(SDR({500u}));
+    inputs.back().randomize(0.05f, rng);
+  }
+
+  for(const bool parallel : {false, true}) {
+    tm.setParallelLearning(parallel);
+    // The copy constructor would bind copy.anomaly to tm.
+    std::stringstream ss;
+    tm.save(ss);
+    TemporalMemory copy;
+    copy.load(ss);
+    copy.setParallelLearning(parallel);
+    copy.reset();
+    TMState state = tm.createState();
+    for(const auto &x : inputs) {
+      copy.compute(x, false);
+      tm.compute(state, x);
+      ASSERT_EQ(copy.getActiveCells(), state.getActiveCells());
+      ASSERT_EQ(copy.getWinnerCells(), state.getWinnerCells());
+      ASSERT_EQ(copy.anomaly, state.getAnomaly());
+      copy.activateDendrites(false);
+      ASSERT_EQ(copy.getPredictiveCells(), tm.getPredictiveCells(state));
+    }
+  }
+  tm.setParallelLearning(false);
+
+  // Several streams at once.
+  vector<vector<CellIdx>> expected;
+  TMState state = tm.createState();
+  for(const auto &x : inputs) {
+    tm.compute(state, x);
+    expected.push_back(state.getActiveCells());
+  }
+  const TemporalMemory before(tm);
+  vector<vector<vector<CellIdx>>> outputs(4u);
+  vector<std::thread> threads;
+  for(auto &output : outputs) {
+    threads.emplace_back([&]() {
+      TMState own = tm.createState();
+      for(const auto &x : inputs) {
+        tm.compute(own, x);
+        output.push_back(own.getActiveCells());
+      }
+    });
+  }
+  for(auto &thread : threads) {
+    thread.join();
+  }
+  for(const auto &output : outputs) {
+    ASSERT_EQ(expected, output);
+  }
+  EXPECT_EQ(before, tm);
+}
+
+/**
+ * The anomaly counted by activateCells is the raw anomaly score of the
+ * predicted columns, with and without parallel learning.
+ */
+TEST(TemporalMemoryTest, testAnomaly) {
+  vector<SDR> pattern(20, SDR({500u}));
+  Random rng(17);
+  for(auto &sdr : pattern) {
+    sdr.randomize(0.05f, rng);
+  }
+  for(const bool parallel : {false, true}) {
+    TemporalMemory tm({500u}, 8, 13, 0.21f, 0.50f, 10, 20, 0.10f, 0.10f, 0.01f, 42);
+    tm.setParallelLearning(parallel);
+    bool partial = false;
+    for(UInt trial = 0; trial < 10; trial++) {
+      for(auto x : pattern) {
+        x.addNoise(0.2f, rng); //some predicted, some bursting columns
+        tm.activateDendrites(true);
+        const Real expected = computeRawAnomalyScore(x, tm.cellsToColumns(tm.getPredictiveCells()));
+        tm.compute(x, true);
+        ASSERT_EQ(expected, tm.anomaly);
+        partial = partial || (expected > 0.0f && expected < 1.0f);
+      }
+      tm.reset();
+    }
+    EXPECT_TRUE(partial);
+
+    SDR none({500u});
+    tm.compute(none, false);
+    EXPECT_EQ(0.0f, tm.anomaly);
+  }
+}
+
 TEST(TemporalMemoryTest, testIncorrectDefaultConstructor) {
   TemporalMemory tmFail; //default empty constructor is only used for deserialization
   SDR data1({0});
@@ -0,0 +1,124 @@
+/* ---------------------------------------------------------------------
+ * HTM Community Edition of NuPIC
+ * Copyright (C) 2019, The HTM Community
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ * ---------------------------------------------------------------------- */
+
+#include "gtest/gtest.h"
+
+#include <vector>
+
+#include "htm/types/Types.hpp"
+#include "htm/utils/BoxFilter.hpp"
+#include "htm/utils/Random.hpp"
+#include "htm/utils/Topology.hpp"
+
+namespace testing {
+
+using namespace htm;
+using std::vector;
+
+// The box filters must agree with walking the (Wrapping)Neighborhood.
+
+vector<UInt> neighbors(const UInt index, const UInt radius, const vector<UInt> &dimensions,
+                       const bool wrap) {
+  vector<UInt> result;
+  if (wrap) {
+    for (const auto n : WrappingNeighborhood(index, radius, dimensions)) result.push_back(n);
+  } else {
+    for (const auto n : Neighborhood(index, radius, dimensions)) result.push_back(n);
+  }
+  return result;
+}
+
+UInt gridSize(const vector<UInt> &dimensions) {
+  UInt size = 1u;
+  for (const auto dim : dimensions) size *= dim;
+  return size;
+}
+
+const vector<vector<UInt>> GRIDS = {{7u}, {5u, 6u}, {3u, 4u, 5u}};
+const vector<UInt> RADII = {0u, 1u, 2u, 4u, 10u};
+
+TEST(BoxFilterTest, Volume) {
+  for (const auto &dimensions : GRIDS) {
+    for (const auto radius : RADII) {
+      for (const bool wrap : {false, true}) {
+        const BoxFilter box(dimensions, radius, wrap);
+        const UInt size = gridSize(dimensions);
+        for (UInt i = 0; i < size; i++) {
+          ASSERT_EQ(neighbors(i, radius, dimensions, wrap).size(), box.volume(i));
+        }
+      }
+    }
+  }
+}
+
+TEST(BoxFilterTest, SumAndMax) {
+  Random rng(42);
+  for (const auto &dimensions : GRIDS) {
+    const UInt size = gridSize(dimensions);
+    vector<Real> values(size);
+    for (auto &value : values) {
+      value = (Real)rng.getReal64();
+    }
+    for (const auto radius : RADII) {
+      for (const bool wrap : {false, true}) {
+        const BoxFilter box(dimensions, radius, wrap);
+        vector<Real> sums, maxs;
+        box.sum(values, sums);
+        box.max(values, maxs);
+        for (UInt i = 0; i < size; i++) {
+          Real sum = 0.0f, max = 0.0f;
+          for (const auto n : neighbors(i, radius, dimensions, wrap)) {
+            sum += values[n];
+            max = std::max(max, values[n]);
+          }
+          ASSERT_NEAR(sum, sums[i], 1e-5f);
+          ASSERT_EQ(max, maxs[i]);
+        }
+      }
+    }
+  }
+}
+
+TEST(BoxFilterTest, Counter) {
+  Random rng(42);
+  for (const auto &dimensions : GRIDS) {
+    const UInt size = gridSize(dimensions);
+    for (const auto radius : RADII) {
+      for (const bool wrap : {false, true}) {
+        const BoxFilter box(dimensions, radius, wrap);
+        BoxFilter::Counter counter(box);
+        vector<UInt> members(size, 0u);
+        for (UInt k = 0; k < size / 2u; k++) {
+          const UInt i = rng.getUInt32(size);
+          counter.add(i);
+          members[i]++;
+        }
+        for (UInt i = 0; i < size; i++) {
+          UInt expected = 0u;
+          for (const auto n : neighbors(i, radius, dimensions, wrap)) {
+            expected += members[n];
+          }
+          ASSERT_EQ(expected, counter.count(i));
+        }
+        counter.clear();
+        ASSERT_EQ(0u, counter.count(0u));
+      }
+    }
+  }
+}
+
+} // end namespace testing
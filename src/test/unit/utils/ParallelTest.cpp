@@ -0,0 +1,101 @@
+/* ---------------------------------------------------------------------
+ * HTM Community Edition of NuPIC
+ * Copyright (C) 2019, The HTM Community
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ * --------------------------------------------------------------------- */
+
+#include "gtest/gtest.h"
+
+#include <stdexcept>
+#include <vector>
+
+#include "htm/types/Types.hpp"
+#include "htm/utils/Parallel.hpp"
+
+namespace testing {
+
+using namespace htm;
+using std::vector;
+
+TEST(ParallelTest, WorkerRange) {
+  size_t end = 0u;
+  for(UInt worker = 0; worker < 3u; worker++) {
+    const auto range = workerRange(10u, worker, 3u);
+    ASSERT_EQ(end, range.first);
+    ASSERT_LE(range.first, range.second);
+    end = range.second;
+  }
+  ASSERT_EQ(10u, end);
+}
+
+
+TEST(ParallelTest, ThreadPool) {
+  ThreadPool pool(4u);
+  ASSERT_EQ(4u, pool.size());
+
+  // Each worker runs exactly once per step, for many steps.
+  vector<UInt> counts(4u, 0u);
+  for(UInt step = 0; step < 1000u; step++) {
+    const UInt numWorkers = 1u + step % 4u;
+    pool.parallelFor(numWorkers, [&](const UInt worker) {
+      ASSERT_LT(worker, numWorkers);
+      counts[worker]++;
+    });
+  }
+  EXPECT_EQ(vector<UInt>({1000u, 750u, 500u, 250u}), counts);
+
+  // At most size() workers.
+  UInt numCalls = 0u;
+  pool.resize(2u);
+  pool.parallelFor(8u, [&](const UInt worker) {
+    ASSERT_LT(worker, 2u);
+  });
+  pool.resize(1u);
+  pool.parallelFor(8u, [&](const UInt worker) { numCalls++; });
+  EXPECT_EQ(1u, numCalls);
+
+  pool.resize(0u);
+  EXPECT_EQ(hardwareThreads(), pool.size());
+}
+
+
+TEST(ParallelTest, ThreadPoolCopy) {
+  ThreadPool pool(3u);
+  ThreadPool copy(pool);
+  EXPECT_EQ(3u, copy.size());
+  ThreadPool assigned;
+  EXPECT_EQ(1u, assigned.size());
+  assigned = pool;
+  EXPECT_EQ(3u, assigned.size());
+
+  vector<UInt> seen(3u, 0u);
+  copy.parallelFor(3u, [&](const UInt worker) { seen[worker]++; });
+  assigned.parallelFor(3u, [&](const UInt worker) { seen[worker]++; });
+  EXPECT_EQ(vector<UInt>({2u, 2u, 2u}), seen);
+}
+
+
+TEST(ParallelTest, ThreadPoolException) {
+  ThreadPool pool(3u);
+  EXPECT_THROW(pool.parallelFor(3u, [](const UInt worker) {
+    if(worker == 2u) throw std::runtime_error("worker 2");
+  }), std::runtime_error);
+
+  // The pool is still usable.
+  vector<UInt> seen(3u, 0u);
+  pool.parallelFor(3u, [&](const UInt worker) { seen[worker]++; });
+  EXPECT_EQ(vector<UInt>({1u, 1u, 1u}), seen);
+}
+
+} // end namespace testing
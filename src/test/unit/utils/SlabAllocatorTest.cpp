@@ -0,0 +1,128 @@
+/* ---------------------------------------------------------------------
+ * HTM Community Edition of NuPIC
+ * Copyright (C) 2019, The HTM Community
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ * --------------------------------------------------------------------- */
+
+#include "gtest/gtest.h"
+
+#include <thread>
+#include <vector>
+
+#include "htm/types/Types.hpp"
+#include "htm/utils/SlabAllocator.hpp"
+
+namespace testing {
+
+using namespace htm;
+
+// The pool is shared by the whole process, so the tests only look at the
+// changes of its statistics.
+
+TEST(SlabAllocatorTest, VectorUsesPool) {
+  const auto before = SlabPool::stats();
+  {
+    std::vector<UInt32, SlabAllocator<UInt32>> vec;
+    for(UInt32 i = 0; i < 100u; i++) {
+      vec.push_back(i);
+    }
+    for(UInt32 i = 0; i < 100u; i++) {
+      ASSERT_EQ(i, vec[i]);
+    }
+    const auto during = SlabPool::stats();
+    ASSERT_EQ(before.numLive + 1u, during.numLive);
+    ASSERT_EQ(before.bytesLive + vec.capacity() * sizeof(UInt32), during.bytesLive);
+  }
+  const auto after = SlabPool::stats();
+  ASSERT_EQ(before.numLive,   after.numLive);
+  ASSERT_EQ(before.bytesLive, after.bytesLive);
+}
+
+TEST(SlabAllocatorTest, FreedBlocksAreRecycled) {
+  void *first = SlabPool::allocate(40u);
+  SlabPool::deallocate(first, 40u);
+  const auto reserved = SlabPool::stats().bytesReserved;
+
+  // Same size class (33-64 bytes), the freed block is handed out again.
+  void *second = SlabPool::allocate(60u);
+  ASSERT_EQ(first, second);
+  ASSERT_EQ(reserved, SlabPool::stats().bytesReserved);
+  SlabPool::deallocate(second, 60u);
+}
+
+TEST(SlabAllocatorTest, SteadyStateDoesNotGrow) {
+  std::vector<std::vector<UInt32, SlabAllocator<UInt32>>> lists(200);
+  size_t reserved = 0u;
+  for(UInt round = 0; round < 10u; round++) {
+    for(size_t i = 0; i < lists.size(); i++) {
+      lists[i].assign(1u + (i * 7u + round) % 60u, round);
+    }
+    for(auto &list : lists) {
+      std::vector<UInt32, SlabAllocator<UInt32>>().swap(list);
+    }
+    if(round == 0u) {
+      reserved = SlabPool::stats().bytesReserved;
+    }
+  }
+  ASSERT_EQ(reserved, SlabPool::stats().bytesReserved) << "freed blocks must be reused";
+}
+
+TEST(SlabAllocatorTest, LargeAllocations) {
+  const auto before = SlabPool::stats();
+  const size_t bytes = SlabPool::MAX_BLOCK * 3u;
+  void *ptr = SlabPool::allocate(bytes);
+  ASSERT_NE(nullptr, ptr);
+  const auto during = SlabPool::stats();
+  ASSERT_EQ(before.bytesReserved + bytes, during.bytesReserved);
+  ASSERT_EQ(before.bytesLive + bytes, during.bytesLive);
+  SlabPool::deallocate(ptr, bytes);
+  ASSERT_EQ(before.bytesReserved, SlabPool::stats().bytesReserved);
+}
+
+TEST(SlabAllocatorTest, EmptySlabsAreReleased) {
+  const auto before = SlabPool::stats();
+  const size_t bytes = SlabPool::MAX_BLOCK; //15 blocks per slab
+  std::vector<void*> blocks;
+  for(UInt i = 0; i < 100u; i++) {
+    blocks.push_back(SlabPool::allocate(bytes));
+  }
+  ASSERT_GE(SlabPool::stats().numSlabs, before.numSlabs + 6u);
+  for(auto block : blocks) {
+    SlabPool::deallocate(block, bytes);
+  }
+  // All but one spare slab are returned.
+  ASSERT_LE(SlabPool::stats().numSlabs, before.numSlabs + 1u);
+  SlabPool::trim();
+  ASSERT_LE(SlabPool::stats().numSlabs, before.numSlabs);
+  ASSERT_EQ(before.numLive, SlabPool::stats().numLive);
+}
+
+TEST(SlabAllocatorTest, FreeOnOtherThread) {
+  const auto before = SlabPool::stats();
+  std::vector<UInt32, SlabAllocator<UInt32>> vec;
+  std::thread([&vec]() { vec.assign(100u, 7u); }).join();
+  ASSERT_EQ(before.numLive + 1u, SlabPool::stats().numLive);
+  std::vector<UInt32, SlabAllocator<UInt32>>().swap(vec);
+  ASSERT_EQ(before.numLive,   SlabPool::stats().numLive);
+  ASSERT_EQ(before.bytesLive, SlabPool::stats().bytesLive);
+}
+
+TEST(SlabAllocatorTest, Fragmentation) {
+  const auto stats = SlabPool::stats();
+  ASSERT_GE(stats.fragmentation(), 0.0f);
+  ASSERT_LE(stats.fragmentation(), 1.0f);
+  ASSERT_LE(stats.bytesLive + stats.bytesFree, stats.bytesReserved);
+}
+
+} // end namespace